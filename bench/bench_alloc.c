@@ -0,0 +1,378 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#define LOGGER_DEBUG(...) do {} while (0)
+#define SMART_PTR_SLAB
+#define POOL_MAGAZINE
+#include "region_allocator.h"
+#include "frame_allocator.h"
+#include "smart_ptr_allocator.h"
+#include "pool_allocator.h"
+
+
+/* Measures allocation throughput and latency of the allocators and
+ * of the system malloc. Each workload is run with 1, 2, 4, ... up to
+ * the given number of threads and with several allocation sizes.
+ * Every thread does the same number of operations. An operation is
+ * one allocation whose first byte is written, or one ref and unref
+ * pair for smart_ptr_ref. Memory is released after the measurement,
+ * except in the round trip workloads, where each object is released
+ * right after its allocation.
+ *
+ * Throughput is measured in a run without timers. Latencies are
+ * measured in a second run which times every operation, so they
+ * include the cost of reading the clock.
+ *
+ * Built with REGION_WAIT_FREE and FRAME_WAIT_FREE as
+ * bench_alloc_wait_free, only the region and frame workloads are run
+ * and their names get a _wait_free suffix, so the output can be
+ * appended to the one of bench_alloc.
+ *
+ * Usage: bench_alloc [max threads] [operations per thread]
+ * The results are written to stdout as CSV.
+ */
+
+#if defined(REGION_WAIT_FREE) && defined(FRAME_WAIT_FREE)
+# define WAIT_FREE 1
+# define SUFFIX "_wait_free"
+#else
+# define WAIT_FREE 0
+# define SUFFIX ""
+#endif
+
+DECLARE_REGION_ALLOCATOR();
+DECLARE_FRAME_ALLOCATOR();
+DECLARE_SMART_PTR_SLAB();
+DECLARE_POOL_ALLOCATOR();
+DECLARE_POOL_MAGAZINE();
+
+typedef enum {
+    BENCH_MALLOC,
+    BENCH_REGION_MALLOC,
+    BENCH_REGION_MALLOC_WITH_CLEANUP,
+    BENCH_FRAME_MALLOC,
+    BENCH_SMART_PTR_MALLOC,
+    BENCH_SMART_PTR_SLAB_MALLOC,
+    BENCH_SMART_PTR_ROUND_TRIP,
+    BENCH_SMART_PTR_SLAB_ROUND_TRIP,
+    BENCH_SMART_PTR_REF,
+    BENCH_POOL_MALLOC,
+    BENCH_POOL_ROUND_TRIP,
+    BENCH_COUNT
+} workload_t;
+
+static const char* workload_names[BENCH_COUNT] = {
+    "malloc",
+    "region_malloc" SUFFIX,
+    "region_malloc_with_cleanup" SUFFIX,
+    "frame_malloc" SUFFIX,
+    "smart_ptr_malloc",
+    "smart_ptr_slab_malloc",
+    "smart_ptr_malloc_unref",
+    "smart_ptr_slab_malloc_unref",
+    "smart_ptr_ref",
+    "pool_malloc",
+    "pool_malloc_free",
+};
+
+static const size_t sizes[] = { 16, 64, 256, 1024 };
+
+typedef struct {
+    workload_t workload;
+    size_t size;
+    int ops;
+    void** ptrs;
+    uint32_t* latencies;
+    pthread_barrier_t* barrier;
+    uint64_t start;
+    uint64_t end;
+} thread_arg_t;
+
+static void* shared_ptr;
+
+static inline uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+nop_cleanup(void* p)
+{
+    (void) p;
+}
+
+static inline void*
+bench_op(workload_t workload, size_t size)
+{
+    void* p = NULL;
+
+    switch (workload) {
+    case BENCH_MALLOC:
+        p = malloc(size);
+        break;
+    case BENCH_REGION_MALLOC:
+        p = region_malloc(size);
+        break;
+    case BENCH_REGION_MALLOC_WITH_CLEANUP:
+        p = region_malloc_with_cleanup(size, nop_cleanup);
+        break;
+    case BENCH_FRAME_MALLOC:
+        p = frame_malloc(size);
+        break;
+    case BENCH_SMART_PTR_MALLOC:
+        p = smart_ptr_malloc(size);
+        break;
+    case BENCH_SMART_PTR_SLAB_MALLOC:
+        p = smart_ptr_slab_malloc(size);
+        break;
+    case BENCH_SMART_PTR_ROUND_TRIP:
+        p = smart_ptr_malloc(size);
+        if (p) {
+            *(char*) p = 1;
+            smart_ptr_unref(p);
+        }
+        return p;
+    case BENCH_SMART_PTR_SLAB_ROUND_TRIP:
+        p = smart_ptr_slab_malloc(size);
+        if (p) {
+            *(char*) p = 1;
+            smart_ptr_unref(p);
+        }
+        return p;
+    case BENCH_SMART_PTR_REF:
+        smart_ptr_unref(smart_ptr_ref(shared_ptr));
+        return shared_ptr;
+    case BENCH_POOL_MALLOC:
+        p = pool_malloc();
+        break;
+    case BENCH_POOL_ROUND_TRIP:
+        p = pool_malloc();
+        if (p) {
+            *(char*) p = 1;
+            pool_free(p);
+        }
+        return p;
+    default:
+        break;
+    }
+
+    if (p)
+        *(char*) p = 1;
+
+    return p;
+}
+
+static void*
+thread_cb(void* arg)
+{
+    thread_arg_t* t = arg;
+
+    pthread_barrier_wait(t->barrier);
+    t->start = now_ns();
+    if (t->latencies) {
+        for (int i = 0; i < t->ops; i++) {
+            uint64_t begin = now_ns();
+            t->ptrs[i] = bench_op(t->workload, t->size);
+            t->latencies[i] = (uint32_t) (now_ns() - begin);
+        }
+    } else {
+        for (int i = 0; i < t->ops; i++)
+            t->ptrs[i] = bench_op(t->workload, t->size);
+    }
+    t->end = now_ns();
+    smart_ptr_slab_thread_exit();
+    if (t->workload == BENCH_POOL_MALLOC || t->workload == BENCH_POOL_ROUND_TRIP)
+        pool_magazine_release();
+
+    return NULL;
+}
+
+static int
+setup(workload_t workload, int threads, int ops, size_t size)
+{
+    /* Room for every allocation with its headers */
+    size_t area = (size_t) threads * ops * (size + 64) + 1024 * 1024;
+
+    /* The pages of the region and the frame are touched before the
+     * run, as they would be when the allocator is reused. */
+    switch (workload) {
+    case BENCH_REGION_MALLOC:
+    case BENCH_REGION_MALLOC_WITH_CLEANUP:
+        if (region_allocator_init(area))
+            return 1;
+        memset(_region_allocator->start, 0,
+               (unsigned char*) _region_allocator - _region_allocator->start);
+        return 0;
+    case BENCH_FRAME_MALLOC:
+        if (frame_allocator_init(area))
+            return 1;
+        memset(_frame_allocator->start, 0,
+               (unsigned char*) _frame_allocator - _frame_allocator->start);
+        return 0;
+    case BENCH_SMART_PTR_REF:
+        shared_ptr = smart_ptr_malloc(size);
+        return !shared_ptr;
+    case BENCH_POOL_MALLOC:
+    case BENCH_POOL_ROUND_TRIP:
+        if (pool_allocator_init(size, area))
+            return 1;
+        memset(_pool_allocator->start, 0,
+               (unsigned char*) _pool_allocator - _pool_allocator->start);
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+static void
+tear_down(workload_t workload, thread_arg_t* args, int threads)
+{
+    switch (workload) {
+    case BENCH_MALLOC:
+        for (int t = 0; t < threads; t++)
+            for (int i = 0; i < args[t].ops; i++)
+                free(args[t].ptrs[i]);
+        break;
+    case BENCH_REGION_MALLOC:
+    case BENCH_REGION_MALLOC_WITH_CLEANUP:
+        region_allocator_destroy();
+        break;
+    case BENCH_FRAME_MALLOC:
+        frame_allocator_destroy();
+        break;
+    case BENCH_SMART_PTR_MALLOC:
+    case BENCH_SMART_PTR_SLAB_MALLOC:
+        for (int t = 0; t < threads; t++)
+            for (int i = 0; i < args[t].ops; i++)
+                smart_ptr_unref(args[t].ptrs[i]);
+        break;
+    case BENCH_SMART_PTR_REF:
+        smart_ptr_unref(shared_ptr);
+        break;
+    case BENCH_POOL_MALLOC:
+    case BENCH_POOL_ROUND_TRIP:
+        pool_allocator_destroy();
+        break;
+    default:
+        break;
+    }
+}
+
+/* Run the workload once. Returns the elapsed time in nanoseconds
+ * or zero on failure. */
+static uint64_t
+run(workload_t workload, int threads, int ops, size_t size, uint32_t* latencies)
+{
+    pthread_t id[threads];
+    thread_arg_t args[threads];
+    pthread_barrier_t barrier;
+    int failed = 0;
+
+    if (setup(workload, threads, ops, size))
+        return 0;
+
+    pthread_barrier_init(&barrier, NULL, threads);
+    for (int t = 0; t < threads; t++) {
+        args[t].workload = workload;
+        args[t].size = size;
+        args[t].ops = ops;
+        args[t].ptrs = malloc(sizeof(void*) * ops);
+        args[t].latencies = latencies ? latencies + (size_t) t * ops : NULL;
+        args[t].barrier = &barrier;
+        pthread_create(&id[t], NULL, thread_cb, &args[t]);
+    }
+
+    uint64_t start = UINT64_MAX, end = 0;
+    for (int t = 0; t < threads; t++) {
+        pthread_join(id[t], NULL);
+        if (args[t].start < start)
+            start = args[t].start;
+        if (args[t].end > end)
+            end = args[t].end;
+        for (int i = 0; i < ops; i++)
+            if (!args[t].ptrs[i])
+                failed = 1;
+    }
+    pthread_barrier_destroy(&barrier);
+
+    tear_down(workload, args, threads);
+    for (int t = 0; t < threads; t++)
+        free(args[t].ptrs);
+
+    return failed ? 0 : end - start;
+}
+
+static int
+compare_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv)
+{
+    int max_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int ops = 100000;
+
+    if (argc > 1)
+        max_threads = atoi(argv[1]);
+    if (argc > 2)
+        ops = atoi(argv[2]);
+    if (max_threads < 1 || ops < 1) {
+        fprintf(stderr, "Usage: %s [max threads] [operations per thread]\n", argv[0]);
+        return 1;
+    }
+
+    uint32_t* latencies = malloc(sizeof(uint32_t) * max_threads * ops);
+    if (!latencies) {
+        fprintf(stderr, "Unable to allocate enough memory\n");
+        return 1;
+    }
+
+    if (!getenv("NO_HEADER"))
+        printf("allocator,threads,size,ops,ops_per_sec,p50_ns,p99_ns,p999_ns\n");
+    for (int w = 0; w < BENCH_COUNT; w++) {
+        if (WAIT_FREE && w != BENCH_REGION_MALLOC &&
+            w != BENCH_REGION_MALLOC_WITH_CLEANUP && w != BENCH_FRAME_MALLOC)
+            continue;
+        for (int threads = 1; threads <= max_threads;
+             threads = threads < max_threads && threads * 2 > max_threads ?
+                       max_threads : threads * 2) {
+            for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+                size_t n = (size_t) threads * ops;
+                uint64_t elapsed = run(w, threads, ops, sizes[s], NULL);
+
+                if (!elapsed || !run(w, threads, ops, sizes[s], latencies)) {
+                    printf("%s,%d,%zu,%zu,FAILED,,,\n", workload_names[w],
+                           threads, sizes[s], n);
+                    continue;
+                }
+
+                qsort(latencies, n, sizeof(uint32_t), compare_u32);
+                printf("%s,%d,%zu,%zu,%.0f,%u,%u,%u\n", workload_names[w],
+                       threads, sizes[s], n, n * 1e9 / elapsed,
+                       latencies[n / 2], latencies[n * 99 / 100],
+                       latencies[n * 999 / 1000]);
+                fflush(stdout);
+            }
+            if (threads == max_threads)
+                break;
+        }
+    }
+
+    free(latencies);
+
+    return 0;
+}
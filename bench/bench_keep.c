@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#define LOGGER_DEBUG(...) do {} while (0)
+#define FRAME_REALLOC
+#define FRAME_PARALLEL_KEEP
+#define FRAME_KEEP_SLOTS (256 * 1024)
+#include "frame_allocator.h"
+
+
+/* Measures the latency of frame_swap when objects are kept across
+ * swaps. The keep set holds from 100 to 100000 objects of 64 bytes
+ * and is copied by 1, 2, 4, ... up to the given number of threads.
+ * The workers of the default FRAME_KEEP_RUN are started by an
+ * untimed swap, so only their wake-up cost is included. For each
+ * number of threads the smallest keep set which is copied faster
+ * than by a single thread is reported as the crossover point.
+ *
+ * Usage: bench_keep [max threads] [swaps]
+ * The results are written to stdout as CSV and the crossover points
+ * to stderr.
+ */
+
+#define OBJECT_SIZE 64
+#define MAX_KEPT 100000
+#define MAX_RUNS 16
+
+DECLARE_FRAME_ALLOCATOR();
+
+static void* objects[MAX_KEPT];
+
+static inline uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+compare(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char** argv)
+{
+    static const int kept_counts[] = { 100, 300, 1000, 3000, 10000, 30000, MAX_KEPT };
+    static double means[sizeof(kept_counts) / sizeof(kept_counts[0])][MAX_RUNS];
+    int runs = 0;
+    int max_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int swaps = 100;
+
+    if (argc > 1)
+        max_threads = atoi(argv[1]);
+    if (argc > 2)
+        swaps = atoi(argv[2]);
+    if (max_threads < 1 || swaps < 1) {
+        fprintf(stderr, "Usage: %s [max threads] [swaps]\n", argv[0]);
+        return 1;
+    }
+
+    uint64_t* latencies = malloc(sizeof(uint64_t) * swaps);
+
+    if (!latencies ||
+        frame_allocator_init(MAX_KEPT * (OBJECT_SIZE + 2 * FRAME_MIN_ALIGN) +
+                             1024 * 1024)) {
+        fprintf(stderr, "Unable to allocate enough memory\n");
+        return 1;
+    }
+
+    if (!getenv("NO_HEADER"))
+        printf("threads,kept,object_size,swaps,mean_us,p50_us,p99_us\n");
+    for (size_t k = 0; k < sizeof(kept_counts) / sizeof(kept_counts[0]); k++) {
+        int kept = kept_counts[k];
+
+        for (int i = 0; i < kept; i++) {
+            objects[i] = frame_malloc(OBJECT_SIZE);
+            if (!objects[i] || frame_keep_ptr(&objects[i], NULL)) {
+                fprintf(stderr, "Out of memory\n");
+                return 1;
+            }
+        }
+
+        runs = 0;
+        for (int threads = 1; threads <= max_threads && runs < MAX_RUNS; threads *= 2) {
+            uint64_t total = 0;
+
+            frame_set_keep_threads(threads);
+            frame_swap(true);
+            for (int s = 0; s < swaps; s++) {
+                uint64_t start = now_ns();
+
+                frame_swap(true);
+                latencies[s] = now_ns() - start;
+                total += latencies[s];
+            }
+            qsort(latencies, swaps, sizeof(uint64_t), compare);
+            printf("%d,%d,%d,%d,%.1f,%.1f,%.1f\n", threads, kept, OBJECT_SIZE,
+                   swaps, total / 1000.0 / swaps, latencies[swaps / 2] / 1000.0,
+                   latencies[swaps * 99 / 100] / 1000.0);
+            fflush(stdout);
+            means[k][runs++] = total / 1000.0 / swaps;
+        }
+
+        for (int i = 0; i < kept; i++)
+            frame_discard_ptr(&objects[i]);
+        frame_swap(true);
+        frame_swap(true);
+    }
+
+    for (int run = 1; run < runs; run++) {
+        size_t k = 0;
+
+        while (k < sizeof(kept_counts) / sizeof(kept_counts[0]) &&
+               means[k][run] >= means[k][0])
+            k++;
+        if (k < sizeof(kept_counts) / sizeof(kept_counts[0]))
+            fprintf(stderr, "crossover: %d threads faster than 1 from %d kept objects\n",
+                    1 << run, kept_counts[k]);
+        else
+            fprintf(stderr, "crossover: %d threads not faster than 1 up to %d kept objects\n",
+                    1 << run, MAX_KEPT);
+    }
+
+    frame_allocator_destroy();
+    free(latencies);
+
+    return 0;
+}
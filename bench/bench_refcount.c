@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "smart_ptr_allocator.h"
+
+
+/* Measures the cost of a smart_ptr_ref and smart_ptr_unref pair in
+ * the reference counting mode the benchmark is built with:
+ *
+ * - atomic: the default mode
+ * - single: SMART_PTR_SINGLE_THREADED
+ * - biased: SMART_PTR_BIASED
+ *
+ * In the local case each thread uses an object it allocated itself.
+ * In the shared case all threads use one object allocated by the main
+ * thread. The single threaded mode is run with one thread only.
+ *
+ * Usage: bench_refcount [max threads] [pairs per thread]
+ * The results are written to stdout as CSV.
+ */
+
+#if defined(SMART_PTR_SINGLE_THREADED)
+# define MODE "single"
+#elif defined(SMART_PTR_BIASED)
+# define MODE "biased"
+DECLARE_SMART_PTR_BIASED();
+#else
+# define MODE "atomic"
+#endif
+
+typedef struct {
+    void* shared;
+    int ops;
+    pthread_barrier_t* barrier;
+    uint64_t start;
+    uint64_t end;
+} thread_arg_t;
+
+static inline uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Not inlined, so that the compiler does not track the size of the
+ * block into the branches of smart_ptr_unref which cannot be taken */
+static __attribute__((noinline)) void*
+new_object(void)
+{
+    return smart_ptr_malloc(64);
+}
+
+static void*
+thread_cb(void* arg)
+{
+    thread_arg_t* t = arg;
+    void* p = t->shared ? t->shared : new_object();
+
+    pthread_barrier_wait(t->barrier);
+    t->start = now_ns();
+    for (int i = 0; i < t->ops; i++)
+        smart_ptr_unref(smart_ptr_ref(p));
+    t->end = now_ns();
+
+    if (!t->shared)
+        smart_ptr_unref(p);
+#ifdef SMART_PTR_BIASED
+    smart_ptr_biased_thread_exit();
+#endif
+
+    return NULL;
+}
+
+/* Run the case once. Returns the elapsed time in nanoseconds. */
+static uint64_t
+run(bool shared, int threads, int ops)
+{
+    pthread_t id[threads];
+    thread_arg_t args[threads];
+    pthread_barrier_t barrier;
+    void* p = shared ? new_object() : NULL;
+
+    pthread_barrier_init(&barrier, NULL, threads);
+    for (int t = 0; t < threads; t++) {
+        args[t].shared = p;
+        args[t].ops = ops;
+        args[t].barrier = &barrier;
+        pthread_create(&id[t], NULL, thread_cb, &args[t]);
+    }
+
+    uint64_t start = UINT64_MAX, end = 0;
+    for (int t = 0; t < threads; t++) {
+        pthread_join(id[t], NULL);
+        if (args[t].start < start)
+            start = args[t].start;
+        if (args[t].end > end)
+            end = args[t].end;
+    }
+    pthread_barrier_destroy(&barrier);
+
+    if (p)
+        smart_ptr_unref(p);
+
+    return end - start;
+}
+
+int main(int argc, char** argv)
+{
+    int max_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int ops = 10000000;
+
+    if (argc > 1)
+        max_threads = atoi(argv[1]);
+    if (argc > 2)
+        ops = atoi(argv[2]);
+    if (max_threads < 1 || ops < 1) {
+        fprintf(stderr, "Usage: %s [max threads] [pairs per thread]\n", argv[0]);
+        return 1;
+    }
+#ifdef SMART_PTR_SINGLE_THREADED
+    max_threads = 1;
+#endif
+
+    if (!getenv("NO_HEADER"))
+        printf("mode,case,threads,ops,ops_per_sec,ns_per_op\n");
+    for (int shared = 0; shared < 2; shared++) {
+        for (int threads = 1; threads <= max_threads;
+             threads = threads < max_threads && threads * 2 > max_threads ?
+                       max_threads : threads * 2) {
+            size_t n = (size_t) threads * ops;
+            uint64_t elapsed = run(shared, threads, ops);
+
+            printf("%s,%s,%d,%zu,%.0f,%.2f\n", MODE, shared ? "shared" : "local",
+                   threads, n, n * 1e9 / elapsed, (double) elapsed / ops);
+            fflush(stdout);
+            if (threads == max_threads)
+                break;
+        }
+    }
+
+    return 0;
+}
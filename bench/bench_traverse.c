@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#define LOGGER_DEBUG(...) do {} while (0)
+#include "region_allocator.h"
+#include "frame_allocator.h"
+
+
+/* Measures how fast a linked list built in an arena is traversed in
+ * the order it was allocated, like an AST or a batch of records. The
+ * allocators lay the nodes out downwards by default and upwards when
+ * the benchmark is built with REGION_GROW_UP and FRAME_GROW_UP:
+ *
+ * - down: the default layout
+ * - up: REGION_GROW_UP and FRAME_GROW_UP
+ *
+ * The list is built once per node size and walked a number of times.
+ * malloc is included as a reference.
+ *
+ * Usage: bench_traverse [nodes] [rounds]
+ * The results are written to stdout as CSV.
+ */
+
+#if defined(REGION_GROW_UP) && defined(FRAME_GROW_UP)
+# define MODE "up"
+#else
+# define MODE "down"
+#endif
+
+DECLARE_REGION_ALLOCATOR();
+DECLARE_FRAME_ALLOCATOR();
+
+typedef struct node {
+    struct node* next;
+    uint64_t value;
+} node_t;
+
+static inline uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void*
+alloc_node(int allocator, size_t size)
+{
+    switch (allocator) {
+    case 0:
+        return malloc(size);
+    case 1:
+        return region_malloc(size);
+    default:
+        return frame_malloc(size);
+    }
+}
+
+/* Build a list of 'nodes' nodes linked in allocation order */
+static node_t*
+build(int allocator, size_t nodes, size_t size)
+{
+    node_t* head = NULL;
+    node_t** tail = &head;
+
+    for (size_t i = 0; i < nodes; i++) {
+        node_t* n = alloc_node(allocator, size);
+
+        if (!n) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        n->value = i;
+        n->next = NULL;
+        *tail = n;
+        tail = &n->next;
+    }
+
+    return head;
+}
+
+/* Walk the list. Returns the sum, so that the walk is not optimized
+ * away. */
+static uint64_t
+walk(node_t* head)
+{
+    uint64_t sum = 0;
+
+    for (node_t* n = head; n; n = n->next)
+        sum += n->value;
+
+    return sum;
+}
+
+static void
+release(int allocator, node_t* head)
+{
+    node_t* next;
+
+    switch (allocator) {
+    case 0:
+        for (node_t* n = head; n; n = next) {
+            next = n->next;
+            free(n);
+        }
+        break;
+    case 1:
+        region_allocator_clear();
+        break;
+    default:
+        frame_swap(true);
+        break;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    static const char* names[] = { "malloc", "region", "frame" };
+    static const size_t sizes[] = { 16, 32, 64, 128 };
+    size_t nodes = 1000000;
+    int rounds = 20;
+
+    if (argc > 1)
+        nodes = (size_t) atol(argv[1]);
+    if (argc > 2)
+        rounds = atoi(argv[2]);
+    if (nodes < 1 || rounds < 1) {
+        fprintf(stderr, "Usage: %s [nodes] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    size_t arena_size = nodes * (128 + 2 * REGION_MIN_ALIGN) + 1024 * 1024;
+
+    if (region_allocator_init(arena_size) || frame_allocator_init(arena_size)) {
+        fprintf(stderr, "Unable to allocate enough memory\n");
+        return 1;
+    }
+
+    if (!getenv("NO_HEADER"))
+        printf("layout,allocator,node_size,nodes,ns_per_node\n");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (int a = 0; a < 3; a++) {
+            node_t* head = build(a, nodes, sizes[s]);
+            uint64_t sum = walk(head);
+            uint64_t start = now_ns();
+
+            for (int r = 0; r < rounds; r++)
+                sum += walk(head);
+
+            uint64_t elapsed = now_ns() - start;
+
+            if (sum != (uint64_t) (rounds + 1) * nodes * (nodes - 1) / 2)
+                fprintf(stderr, "Checksum mismatch\n");
+            printf("%s,%s,%zu,%zu,%.2f\n", a ? MODE : "-", names[a], sizes[s],
+                   nodes, (double) elapsed / rounds / nodes);
+            fflush(stdout);
+            release(a, head);
+        }
+    }
+
+    frame_allocator_destroy();
+    region_allocator_destroy();
+
+    return 0;
+}
@@ -52,11 +52,70 @@ atomic_cas_uint(uint32_t* object, uint32_t* expected, uint32_t desired)
     return success;
 }
 
+static inline bool
+atomic_cas_u64(uint64_t* object, uint64_t* expected, uint64_t desired)
+{
+    int64_t comp = (int64_t)*expected;
+    int64_t value = _InterlockedCompareExchange64((int64_t*)object, (int64_t)desired, comp);
+    bool success = value == comp;
+
+    if (!success)
+        *expected = (uint64_t)value;
+
+    return success;
+}
+
+static inline void*
+atomic_fetch_sub_ptr(void** object, size_t value)
+{
+    if (sizeof(void*) == 4)
+        return (void*) _InterlockedExchangeAdd((long*)object, -(long)value);
+
+    return (void*) _InterlockedExchangeAdd64((int64_t*)object, -(int64_t)value);
+}
+
+static inline uint32_t
+atomic_fetch_add_uint(uint32_t* object, uint32_t value)
+{
+    return (uint32_t) _InterlockedExchangeAdd((long*)object, (long)value);
+}
+
+static inline size_t
+atomic_fetch_add_size(size_t* object, size_t value)
+{
+    if (sizeof(size_t) == 4)
+        return (size_t) _InterlockedExchangeAdd((long*)object, (long)value);
+
+    return (size_t) _InterlockedExchangeAdd64((int64_t*)object, (int64_t)value);
+}
+
 #define CAS(object, expected, desired)      \
     atomic_cas_ptr((void**) (object), (void**) (expected), (void*) (desired))
 #define CAS_UINT(object, expected, desired) \
     atomic_cas_uint((uint32_t*) (object), (uint32_t*) (expected), (uint32_t) (desired))
+#define CAS_U64(object, expected, desired) \
+    atomic_cas_u64((uint64_t*) (object), (uint64_t*) (expected), (uint64_t) (desired))
+#define FETCH_SUB(object, value)           \
+    ((unsigned char*) atomic_fetch_sub_ptr((void**) (object), (value)))
+#define FETCH_ADD(object, value)           \
+    atomic_fetch_add_size((size_t*) (object), (value))
+#define FETCH_ADD_UINT(object, value)      \
+    atomic_fetch_add_uint((uint32_t*) (object), (uint32_t) (value))
+#define FETCH_SUB_UINT(object, value)      \
+    atomic_fetch_add_uint((uint32_t*) (object), (uint32_t) -(int32_t) (value))
+/* The smart pointer slabs are never freed. Memory from _aligned_malloc
+ * must not be passed to FREE, only to _aligned_free. */
+#define ALIGNED_MALLOC(align, size)        \
+    _aligned_malloc((size), (align))
 #define BZERO(ptr,n)                       \
     SecureZeroMemory(ptr,n)
+#define THREAD_LOCAL                       \
+    __declspec(thread)
+#define FENCE()                            \
+    MemoryBarrier()
+#define RELEASE_FENCE()                    \
+    _ReadWriteBarrier()
+#define FRAME_EPOCH_YIELD()                \
+    SwitchToThread()
 
 #endif
\ No newline at end of file
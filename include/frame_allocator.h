@@ -46,33 +46,49 @@
 # define FRAME_CONTEXT_DECLAREV frame_allocator_t* _frame_allocator
 # define FRAME_CONTEXT_DECLARE FRAME_CONTEXT_DECLAREV,
 # define FRAME_CONTEXT _frame_allocator,
+# define FRAME_CONTEXTV _frame_allocator
 #else
 # define FRAME_CONTEXT_DECLAREP
 # define FRAME_CONTEXT_DECLAREV
 # define FRAME_CONTEXT_DECLARE
 # define FRAME_CONTEXT
+# define FRAME_CONTEXTV
 #endif
 
 
 /* Define FRAME_REALLOC if you want to be able to reallocate
- * objects. */
+ * objects. The size of the object is stored in front of it. The
+ * lowest bit tells whether a clean up record follows the object. */
 #ifdef FRAME_REALLOC
 #include <string.h>
 # define REALLOC_HEADER_SIZE                        \
-         (sizeof(unsigned))
+         (sizeof(size_t))
+# define REALLOC_FLAG_CLEAN_UP          1
 # define SET_REALLOC_SIZE(ptr,size)                 \
-         *((unsigned*)(ptr)) = (size)
+         *((size_t*)(ptr)) = (size_t) (size) << 1
+# define SET_REALLOC_SIZE_WITH_CLEAN_UP(ptr,size)   \
+         *((size_t*)(ptr)) = ((size_t) (size) << 1) | REALLOC_FLAG_CLEAN_UP
+# define GET_REALLOC_HEADER(ptr)                    \
+         (*((size_t*)(((unsigned char*) (ptr)) - sizeof(size_t))))
 # define GET_REALLOC_SIZE(ptr)                      \
-         (*((unsigned*)(((unsigned char*) (ptr)) - sizeof(unsigned))))
+         (GET_REALLOC_HEADER(ptr) >> 1)
+# define HAS_REALLOC_CLEAN_UP(ptr)                  \
+         (GET_REALLOC_HEADER(ptr) & REALLOC_FLAG_CLEAN_UP)
 #else
 # define REALLOC_HEADER_SIZE            0
 # define SET_REALLOC_SIZE(ptr,size)     do {} while (0)
+# define SET_REALLOC_SIZE_WITH_CLEAN_UP(ptr,size) do {} while (0)
 #endif
 
 
+/* Debug logger. Compiled away, if NDEBUG is defined. */
 #ifndef LOGGER_DEBUG
-# include <stdio.h>
-# define LOGGER_DEBUG(...) printf(__VA_ARGS__)
+# ifdef NDEBUG
+#  define LOGGER_DEBUG(...) do {} while (0)
+# else
+#  include <stdio.h>
+#  define LOGGER_DEBUG(...) printf(__VA_ARGS__)
+# endif
 #endif
 
 
@@ -84,6 +100,39 @@
 #endif
 
 
+/* Fetch and subtract method. Used only with FRAME_WAIT_FREE. */
+#if defined(FRAME_WAIT_FREE) && !defined(FETCH_SUB)
+#include <stdatomic.h>
+#define FETCH_SUB(destp,val)                                   \
+    atomic_fetch_sub(destp,val)
+#endif
+
+
+/* Fetch and add method. Used only with FRAME_STATS, FRAME_WAIT_FREE,
+ * FRAME_REALLOC and FRAME_ADAPTIVE. */
+#if (defined(FRAME_STATS) || defined(FRAME_WAIT_FREE) || \
+     defined(FRAME_REALLOC) || defined(FRAME_ADAPTIVE)) && !defined(FETCH_ADD)
+#include <stdatomic.h>
+#define FETCH_ADD(destp,val)                                   \
+    atomic_fetch_add_explicit(destp,val,memory_order_relaxed)
+#endif
+
+
+/* Release, acquire and full memory fence methods */
+#ifndef RELEASE_FENCE
+#include <stdatomic.h>
+#define RELEASE_FENCE() atomic_thread_fence(memory_order_release)
+#endif
+#ifndef ACQUIRE_FENCE
+#include <stdatomic.h>
+#define ACQUIRE_FENCE() atomic_thread_fence(memory_order_acquire)
+#endif
+#ifndef FENCE
+#include <stdatomic.h>
+#define FENCE() atomic_thread_fence(memory_order_seq_cst)
+#endif
+
+
 /* bzero method */
 #ifndef BZERO
 #include <strings.h>
@@ -91,13 +140,210 @@
 #endif
 
 
-/* Tagged pointers */
-#define BANK_1_TAG ((uintptr_t) 1)
-#define UNTAG(ptr)                                             \
-    ((unsigned char*) ( ((uintptr_t) (ptr)) & (~BANK_1_TAG) ))
-#define GETBANK(ptr)  ( ((uintptr_t) (ptr)) &   BANK_1_TAG  )
-#define SETBANK(ptr,bank)                                      \
-    ((unsigned char*) ( ((uintptr_t) UNTAG(ptr)) | bank) )
+/* Thread local storage class */
+#ifndef THREAD_LOCAL
+#define THREAD_LOCAL _Thread_local
+#endif
+
+
+/* Size of a cache line. The contended fields of the allocator
+ * are kept on separate cache lines. */
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+
+/* Minimum alignment of allocations. By default every allocation
+ * is suitably aligned for any type. */
+#ifndef FRAME_MIN_ALIGN
+#include <stddef.h>
+#define FRAME_MIN_ALIGN _Alignof(max_align_t)
+#endif
+
+
+/* Alignment helpers. The alignment must be a power of two. */
+#ifndef ROUND_UP
+#define ROUND_UP(n,align)                                      \
+    (((n) + (align) - 1) & ~((size_t) (align) - 1))
+#endif
+#ifndef ALIGN_DOWN
+#define ALIGN_DOWN(ptr,align)                                  \
+    ((unsigned char*) ((uintptr_t) (ptr) & ~((uintptr_t) (align) - 1)))
+#endif
+#ifndef ALIGN_UP
+#define ALIGN_UP(ptr,align)                                    \
+    ALIGN_DOWN(((unsigned char*) (ptr)) + (align) - 1, align)
+#endif
+
+
+/* Number of banks in the ring. Each frame_swap advances to the
+ * next bank, so an allocation stays valid for FRAME_BANKS - 1
+ * swaps. Define FRAME_BANKS 3 for triple buffering. */
+#ifndef FRAME_BANKS
+#define FRAME_BANKS 2
+#endif
+
+
+/* Define FRAME_ASYNC_CLEAN_UP if you want the clean up callbacks to
+ * be run in the background instead of inside frame_swap. When
+ * frame_swap(true) has activated a bank, it hands the clean up list
+ * of the bank which is the next to be cleared to an executor. That
+ * bank is then retired one swap earlier than usual, so allocations
+ * stay valid for FRAME_BANKS - 2 swaps and at least three banks are
+ * needed. A bank is not reused until its clean ups have completed.
+ * FRAME_CLEAN_UP_SUBMIT(task,arg) must arrange task(arg) to be called
+ * in some thread and return zero, or return nonzero to have the task
+ * run synchronously. By default the batches are run by a worker
+ * thread, which is started with the first batch and joined by
+ * frame_allocator_destroy. */
+#ifdef FRAME_ASYNC_CLEAN_UP
+#if FRAME_BANKS < 3
+#error "FRAME_ASYNC_CLEAN_UP needs at least three banks"
+#endif
+#include <stdatomic.h>
+#ifndef FRAME_CLEAN_UP_YIELD
+#include <sched.h>
+#define FRAME_CLEAN_UP_YIELD() sched_yield()
+#endif
+#ifndef FRAME_CLEAN_UP_SUBMIT
+#include <pthread.h>
+#define FRAME_CLEAN_UP_THREADS
+#endif
+#endif
+
+
+/* Define FRAME_GROW_UP if you want the objects to be laid out in
+ * ascending address order. By default the allocator structure is
+ * placed at the end of each bank and the frame pointer moves down,
+ * so objects allocated one after another are walked backwards in
+ * memory. With FRAME_GROW_UP the structure is placed at the start
+ * of the bank and the frame pointer moves up towards its end, which
+ * suits the hardware prefetchers when objects are traversed in the
+ * order they were allocated. */
+
+
+/* Define FRAME_MMAP if you want the memory of the banks to be
+ * mapped with mmap instead of MALLOC. Only address space is reserved
+ * up front and pages are committed when first touched. When a bank
+ * is cleared by frame_swap, its used pages below the top
+ * FRAME_MMAP_KEEP bytes are returned to the system with
+ * madvise(FRAME_MMAP_DECOMMIT). Define FRAME_HUGEPAGE to ask for
+ * transparent huge pages, or FRAME_HUGETLB to map the banks with
+ * huge pages falling back to transparent huge pages if none are
+ * available. */
+#ifdef FRAME_MMAP
+#include <sys/mman.h>
+#ifndef FRAME_MMAP_KEEP
+#define FRAME_MMAP_KEEP (1024 * 1024)
+#endif
+#ifndef FRAME_MMAP_DECOMMIT
+#define FRAME_MMAP_DECOMMIT MADV_DONTNEED
+#endif
+#ifndef FRAME_PAGE_SIZE
+# ifdef FRAME_HUGETLB
+#  define FRAME_PAGE_SIZE (2 * 1024 * 1024)
+# else
+#  define FRAME_PAGE_SIZE 4096
+# endif
+#endif
+#endif
+
+
+/* Define FRAME_PREZERO if you want the banks to be cleared in bulk
+ * when they are cleared by frame_swap instead of piece by piece when
+ * the memory is allocated. The memory not yet allocated is then
+ * always zero, so frame_malloc0 and frame_malloc_with_cleanup need
+ * not clear it. With FRAME_ASYNC_CLEAN_UP the bank is cleared in the
+ * background after its clean ups have been run. With FRAME_MMAP the
+ * decommitted pages read as zero and are not touched again, which
+ * requires FRAME_MMAP_DECOMMIT to be MADV_DONTNEED. An object shrunk
+ * with frame_realloc keeps its space. */
+#if defined(FRAME_PREZERO) && defined(FRAME_MMAP)
+#if FRAME_MMAP_DECOMMIT != MADV_DONTNEED
+#error "FRAME_PREZERO needs FRAME_MMAP_DECOMMIT to be MADV_DONTNEED"
+#endif
+#endif
+
+
+/* Define FRAME_ADAPTIVE if you want the banks to follow the load.
+ * The frame size given to frame_allocator_init is then only reserved
+ * as address space, and a bank hands out at most 'capacity' bytes
+ * from its initial frame pointer. On each swap the bytes used by the
+ * frame are recorded. When frame_swap(true) clears a bank, the
+ * capacity is set to the most bytes used by the last
+ * FRAME_ADAPTIVE_HISTORY frames plus FRAME_ADAPTIVE_HEADROOM percent.
+ * It grows as soon as the target exceeds it, but shrinks only when
+ * the target falls below half of it. The capacity is never less than
+ * FRAME_MMAP_KEEP, and the pages within it stay committed. Memory is
+ * not copied, as the limit of the bank just moves inside the
+ * reservation. Allocations which do not fit the capacity spill to
+ * secondary blocks of at least FRAME_SPILL_SIZE bytes, which are
+ * mapped on demand and unmapped when the bank is cleared. Each block
+ * is at least as large as the blocks of the bank before it together,
+ * and its address range is recorded in a table inside the bank. The
+ * table holds FRAME_SPILL_BLOCKS ranges and is chained to more parts
+ * of the same size, which are kept until the frame is destroyed.
+ * Lookups like frame_get_bank_by_ptr search the tables instead of the
+ * blocks, so they never touch memory which may have been unmapped,
+ * and skip a bank whose table changed while it was being searched. */
+#ifdef FRAME_ADAPTIVE
+#ifndef FRAME_MMAP
+#error "FRAME_ADAPTIVE needs FRAME_MMAP"
+#endif
+#include <stdatomic.h>
+#ifndef FRAME_ADAPTIVE_HISTORY
+#define FRAME_ADAPTIVE_HISTORY 16
+#endif
+#ifndef FRAME_ADAPTIVE_HEADROOM
+#define FRAME_ADAPTIVE_HEADROOM 25
+#endif
+#ifndef FRAME_SPILL_SIZE
+#define FRAME_SPILL_SIZE (1024 * 1024)
+#endif
+#ifndef FRAME_SPILL_BLOCKS
+#define FRAME_SPILL_BLOCKS 32
+#endif
+
+/* A secondary block of a bank. The header is placed at the start of
+ * the block. */
+typedef struct frame_spill {
+    unsigned char* fp;
+    unsigned char* base;
+    unsigned char* limit;
+    struct frame_spill* next;
+    size_t size;
+} frame_spill_t;
+
+/* The address range of a spill block. 'start' is NULL, if the
+ * entry is not in use. */
+typedef struct {
+    unsigned char* volatile start;
+    size_t size;
+} frame_spill_range_t;
+
+/* A part of the table of spill block ranges */
+typedef struct frame_spill_ranges {
+    frame_spill_range_t ranges[FRAME_SPILL_BLOCKS];
+    struct frame_spill_ranges* volatile next;
+} frame_spill_ranges_t;
+
+/* The ranges of the spill blocks of a bank. 'generation' is odd
+ * while the bank is being cleared. */
+typedef struct {
+    volatile unsigned long generation;
+    volatile size_t count;
+    size_t size;
+    frame_spill_ranges_t first;
+} frame_spill_table_t;
+
+/* The bytes used by the recent frames and the capacity they call
+ * for. Shared by the banks and updated by frame_swap only. */
+typedef struct {
+    size_t used[FRAME_ADAPTIVE_HISTORY];
+    size_t frames;
+    size_t capacity;
+} frame_adaptive_t;
+#endif
 
 
 /* We allow registering clean up callbacks to the frame */
@@ -107,301 +353,2881 @@ typedef struct frame_clean_up_cb_list {
     struct frame_clean_up_cb_list* next;
 } frame_clean_up_cb_list_t;
 
+/* The pointers registered with frame_keep_ptr are kept in an open
+ * addressing hash table keyed by the address of the pointer. A
+ * pointer is stored at most FRAME_KEEP_PROBES slots past its home
+ * slot. If there is no free slot that near, it is stored in an
+ * overflow chunk of FRAME_KEEP_CHUNK_SLOTS slots and linked to its
+ * home slot, so that it is found without searching the chunks. The
+ * first table of FRAME_KEEP_SLOTS slots and FRAME_KEEP_CHUNKS chunks
+ * are stored after the banks. More chunks and larger tables are
+ * taken like the memory of the banks, with mmap if FRAME_MMAP is
+ * defined, so keeping and discarding a pointer needs no MALLOC.
+ * frame_swap moves the pointers of the chunks to a table large
+ * enough for all of them, as it does once the table is three
+ * quarters full. FRAME_KEEP_SLOTS must be a power of two. */
 #ifdef FRAME_REALLOC
-typedef struct frame_keep_list {
+#ifndef FRAME_KEEP_SLOTS
+#define FRAME_KEEP_SLOTS 4096
+#endif
+#if (FRAME_KEEP_SLOTS & (FRAME_KEEP_SLOTS - 1)) != 0
+#error "FRAME_KEEP_SLOTS must be a power of two"
+#endif
+#ifndef FRAME_KEEP_PROBES
+#define FRAME_KEEP_PROBES 32
+#endif
+#ifndef FRAME_KEEP_CHUNK_SLOTS
+#define FRAME_KEEP_CHUNK_SLOTS 256
+#endif
+#ifndef FRAME_KEEP_CHUNKS
+#define FRAME_KEEP_CHUNKS 4
+#endif
+/* Marks a slot whose pointer has been discarded */
+#define FRAME_KEEP_DISCARDED ((void**) 1)
+
+#ifdef FRAME_EVACUATE
+/* State of the copying of the kept object graphs on frame_swap */
+typedef struct frame_evacuation frame_evacuation_t;
+
+/* Visitor of the pointers of an object. It calls frame_evacuate for
+ * each pointer field of the object 'obj'. */
+typedef void (*frame_visit_func_t)(frame_evacuation_t* ev, void* obj);
+#endif
+
+/* A slot of the keep set. In a table 'more' is the list of the
+ * pointers stored in the overflow chunks, whose home slot this is.
+ * In a chunk it links the slot to the next one of the list. */
+typedef struct frame_keep_slot {
     void** ptrp;
     void* (*copy_func)(void*);
-    struct frame_keep_list* next;
-} frame_keep_list_t;
+#ifdef FRAME_EVACUATE
+    frame_visit_func_t visit;
+#endif
+    struct frame_keep_slot* more;
+} frame_keep_slot_t;
+
+/* Slots taken when the table is crowded. 'count' is the number of
+ * slots claimed and may exceed FRAME_KEEP_CHUNK_SLOTS. */
+typedef struct frame_keep_chunk {
+    struct frame_keep_chunk* next;
+    size_t count;
+    frame_keep_slot_t slots[FRAME_KEEP_CHUNK_SLOTS];
+} frame_keep_chunk_t;
+
+/* The keep set shared by the banks. 'pooled' is the number of the
+ * chunks stored after the first table which have been taken. */
+typedef struct {
+    frame_keep_slot_t* slots;
+    size_t mask;
+    frame_keep_chunk_t* overflow;
+    size_t pooled;
+} frame_keep_set_t;
+#endif
+
+
+/* Define FRAME_EVACUATE if you want objects kept with frame_keep_graph
+ * to be copied together with the objects reachable from them, like a
+ * copying garbage collector does. The object graph is described by a
+ * visitor function per type, which calls frame_evacuate for each of
+ * the pointers of an object. Each object is copied once, even if it
+ * is reachable from several roots, and the pointers are updated to
+ * the copies. The copies are made breadth first, so they end up next
+ * to each other in the new bank. Requires FRAME_REALLOC. */
+#if defined(FRAME_EVACUATE) && !defined(FRAME_REALLOC)
+#error "FRAME_EVACUATE needs FRAME_REALLOC"
+#endif
+
+
+/* Define FRAME_PARALLEL_KEEP if you want frame_swap to copy the objects
+ * kept with frame_keep_ptr in several threads. The keep set is split
+ * into as many parts as set with frame_set_keep_threads, by default
+ * FRAME_KEEP_THREADS, and the copies are allocated concurrently from
+ * the new bank. The copy callbacks must then be thread-safe. Object
+ * graphs kept with frame_keep_graph are still copied by the swapping
+ * thread. FRAME_KEEP_RUN(task,parts,n) must call task(&parts[i]) for
+ * each of the 'n' parts, possibly in a pool of threads of its own, and
+ * return when all of them have completed. By default the swapping
+ * thread runs the parts together with a pool of worker threads,
+ * which are started as needed and joined by frame_allocator_destroy.
+ * Requires FRAME_REALLOC. */
+#ifdef FRAME_PARALLEL_KEEP
+#ifndef FRAME_REALLOC
+#error "FRAME_PARALLEL_KEEP needs FRAME_REALLOC"
+#endif
+#ifndef FRAME_KEEP_THREADS
+#define FRAME_KEEP_THREADS 4
+#endif
+#ifndef FRAME_KEEP_MAX_THREADS
+#define FRAME_KEEP_MAX_THREADS 64
+#endif
+#ifndef FRAME_KEEP_RUN
+#include <pthread.h>
+#define FRAME_KEEP_RUN(task,parts,n) frame_keep_run(task,parts,n)
+#define FRAME_KEEP_RUN_THREADS
+#endif
+#endif
+
+/* Define FRAME_STATS if you want the frame to count allocations,
+ * failures and CAS retries. The counters are split into
+ * FRAME_STATS_SHARDS shards on cache lines of their own, and each
+ * thread updates the shard it is mapped to, so that counting does
+ * not become a contention point itself. The shards are shared by
+ * all banks. The bytes in use in the bank left at the last
+ * FRAME_STATS_HISTORY swaps are kept as well. */
+#ifdef FRAME_STATS
+#ifndef FRAME_STATS_SHARDS
+#define FRAME_STATS_SHARDS 8
+#endif
+#ifndef FRAME_STATS_HISTORY
+#define FRAME_STATS_HISTORY 16
+#endif
+
+typedef struct {
+    size_t allocations;
+    size_t bytes;
+    size_t failures;
+    size_t cas_retries;
+    size_t cleanups;
+    size_t keep_copies;
+    unsigned char _pad[CACHE_LINE_SIZE - 6 * sizeof(size_t)];
+} frame_stats_shard_t;
+
+/* Snapshot of the statistics returned by frame_allocator_stats */
+typedef struct {
+    size_t allocations;     /* successful allocations */
+    size_t bytes;           /* bytes requested by successful allocations */
+    size_t failures;        /* allocations which returned NULL */
+    size_t cas_retries;     /* failed CAS operations while allocating */
+    size_t cleanups;        /* clean up callbacks run */
+    size_t keep_copies;     /* objects copied from the keep set */
+    size_t swaps;           /* frame swaps done */
+    size_t used;            /* bytes in use in the current bank */
+    size_t high_water;      /* most bytes in use in a bank at a swap */
+    size_t last_used;       /* bytes in use at the last swap */
+    size_t recent_used[FRAME_STATS_HISTORY];
+                            /* bytes in use at the recent swaps,
+                             * the latest first */
+} frame_stats_t;
+
+/* Bytes in use at the recent swaps. Placed after the shards. */
+typedef struct {
+    size_t used[FRAME_STATS_HISTORY];
+    size_t count;
+} frame_stats_history_t;
+#endif
+
+/* Define FRAME_SWAP_TIMING if you want frame_swap to measure how long
+ * each of its phases takes. The durations of the last
+ * FRAME_SWAP_LOG_SIZE swaps are kept in a ring buffer, which can be
+ * read with frame_swap_log while the frame is being swapped. Each
+ * phase is also counted in a histogram whose buckets split every
+ * power of two into FRAME_SWAP_HIST_SUB_BUCKETS linear steps, like
+ * an HDR histogram, and frame_swap_timing summarizes it. The clock
+ * is read with FRAME_CLOCK_NS(), which returns nanoseconds. */
+#ifdef FRAME_SWAP_TIMING
+#include <stdint.h>
+#include <stdatomic.h>
+#ifndef FRAME_SWAP_LOG_SIZE
+#define FRAME_SWAP_LOG_SIZE 256
+#endif
+#if (FRAME_SWAP_LOG_SIZE & (FRAME_SWAP_LOG_SIZE - 1)) != 0
+#error "FRAME_SWAP_LOG_SIZE must be a power of two"
+#endif
+#ifndef FRAME_CLOCK_NS
+#include <time.h>
+#define FRAME_CLOCK_NS() frame_clock_ns()
+#define FRAME_CLOCK_MONOTONIC
+#endif
+/* The values are recorded with a relative error below 1/16 */
+#define FRAME_SWAP_HIST_SUB_BITS 4
+#define FRAME_SWAP_HIST_SUB_BUCKETS (1 << FRAME_SWAP_HIST_SUB_BITS)
+#define FRAME_SWAP_HIST_BUCKETS                                 \
+    ((64 - FRAME_SWAP_HIST_SUB_BITS + 1) * FRAME_SWAP_HIST_SUB_BUCKETS)
+
+/* Phases of frame_swap */
+typedef enum {
+    FRAME_SWAP_WAIT,        /* waiting for allocating threads and clean ups */
+    FRAME_SWAP_CLEAN_UP,    /* running or handing out the clean ups */
+    FRAME_SWAP_RESET,       /* decommitting and resetting the bank */
+    FRAME_SWAP_PUBLISH,     /* publishing the new bank */
+    FRAME_SWAP_KEEP,        /* copying the kept objects */
+    FRAME_SWAP_TOTAL,       /* the whole swap */
+    FRAME_SWAP_PHASES
+} frame_swap_phase_t;
+
+/* Durations of the phases of one swap in nanoseconds */
+typedef struct {
+    unsigned long generation;
+    uint64_t ns[FRAME_SWAP_PHASES];
+} frame_swap_record_t;
+
+/* Summary of the durations of a phase returned by frame_swap_timing.
+ * The percentiles are upper bounds of the histogram buckets. */
+typedef struct {
+    size_t count;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t mean_ns;
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+} frame_swap_timing_t;
+
+/* The ring buffer and the histograms. Written by the swapping thread
+ * only. 'head' counts the records written. */
+typedef struct {
+    volatile size_t head;
+    frame_swap_record_t records[FRAME_SWAP_LOG_SIZE];
+    size_t count[FRAME_SWAP_PHASES];
+    uint64_t sum[FRAME_SWAP_PHASES];
+    uint64_t min[FRAME_SWAP_PHASES];
+    uint64_t max[FRAME_SWAP_PHASES];
+    size_t buckets[FRAME_SWAP_PHASES][FRAME_SWAP_HIST_BUCKETS];
+} frame_swap_log_t;
+
+/* Timer of the swap in progress */
+typedef struct {
+    frame_swap_record_t record;
+    uint64_t start;
+    uint64_t last;
+} frame_swap_timer_t;
+
+# define FRAME_SWAP_PHASE(timer,phase) frame_swap_phase(timer,phase)
+#else
+# define FRAME_SWAP_PHASE(timer,phase) do {} while (0)
 #endif
 
-/* Frame allocator data type */
+/* Frame allocator data type. The frame pointer and the clean
+ * up list are modified concurrently by allocating threads, so
+ * each of them has a cache line of its own. The rest of the
+ * fields are read mostly. */
 typedef struct {
     unsigned char* fp;
+    unsigned char _fp_pad[CACHE_LINE_SIZE - sizeof(unsigned char*)];
+    frame_clean_up_cb_list_t* cleanups;
+    unsigned char _cleanups_pad[CACHE_LINE_SIZE - sizeof(frame_clean_up_cb_list_t*)];
     unsigned char* start;
     size_t size;
-    frame_clean_up_cb_list_t* cleanups;
+    int bank;
+    unsigned long generation;
 #ifdef FRAME_REALLOC
-    frame_keep_list_t* keeplist;
+    frame_keep_set_t* keepset;
+#endif
+#ifdef FRAME_EVACUATE
+    frame_evacuation_t* evacuation;
+#endif
+#ifdef FRAME_PARALLEL_KEEP
+    int keep_threads;
+#endif
+#ifdef FRAME_KEEP_RUN_THREADS
+    struct frame_keep_pool* keep_pool;
+#endif
+#ifdef FRAME_TLAB
+    uintptr_t tlab_generation;
+#endif
+#ifdef FRAME_EPOCH
+    volatile int recycling;
+#endif
+#ifdef FRAME_ASYNC_CLEAN_UP
+    volatile int clean_up_pending;
+#endif
+#ifdef FRAME_CLEAN_UP_THREADS
+    struct frame_clean_up_worker* clean_up_worker;
+#endif
+#ifdef FRAME_STATS
+    frame_stats_shard_t* stats;
+    void* stats_area;
+    size_t high_water;
+#endif
+#ifdef FRAME_SWAP_TIMING
+    frame_swap_log_t* swap_log;
+#endif
+#ifdef FRAME_ADAPTIVE
+    size_t capacity;
+    frame_spill_t* spill;
+    frame_spill_table_t spill_table;
+    frame_adaptive_t* adaptive;
+#endif
+} frame_allocator_t;
+
+#ifdef FRAME_EVACUATE
+/* An object copied by the evacuation */
+typedef struct {
+    void* from;
+    void* to;
+    frame_visit_func_t visit;
+} frame_forward_t;
+
+/* The objects copied are kept in the order they were copied, which
+ * is also the order their pointers are visited in. An open addressing
+ * index maps the original addresses to the copies. Both grow as
+ * needed and are reused from swap to swap. */
+struct frame_evacuation {
+    frame_allocator_t* allocator;
+    frame_forward_t* objects;
+    size_t count;
+    size_t capacity;
+    size_t* index;
+};
+#endif
+
+
+#ifdef FRAME_STATS
+/* Get the statistics shard of the calling thread. Threads are
+ * mapped to the shards in the order they first update them. */
+static inline unsigned
+frame_stats_shard(void)
+{
+    static THREAD_LOCAL unsigned shard;
+    static uintptr_t next_shard;
+    uintptr_t orig;
+
+    if (!shard) {
+        do {
+            orig = next_shard;
+        } while (!CAS(&next_shard, &orig, orig + 1));
+        shard = (unsigned) (orig % FRAME_STATS_SHARDS) + 1;
+    }
+
+    return shard - 1;
+}
+
+# define FRAME_STATS_ADD(allocator,field,n)                     \
+         ((void) FETCH_ADD(&(allocator)->stats[frame_stats_shard()].field, (n)))
+#else
+# define FRAME_STATS_ADD(allocator,field,n)     do {} while (0)
+#endif
+
+
+#ifdef FRAME_SWAP_TIMING
+#ifdef FRAME_CLOCK_MONOTONIC
+/* Read the monotonic clock in nanoseconds */
+static inline uint64_t
+frame_clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+#endif
+
+/* Get the histogram bucket of a duration */
+static inline int
+frame_swap_hist_bucket(uint64_t ns)
+{
+    int e = FRAME_SWAP_HIST_SUB_BITS;
+
+    if (ns < FRAME_SWAP_HIST_SUB_BUCKETS)
+        return (int) ns;
+    while (e < 63 && ns >> (e + 1))
+        e++;
+
+    return (e - FRAME_SWAP_HIST_SUB_BITS + 1) * FRAME_SWAP_HIST_SUB_BUCKETS +
+            (int) ((ns >> (e - FRAME_SWAP_HIST_SUB_BITS)) &
+                   (FRAME_SWAP_HIST_SUB_BUCKETS - 1));
+}
+
+/* Get the largest duration counted in a histogram bucket */
+static inline uint64_t
+frame_swap_hist_value(int bucket)
+{
+    if (bucket < FRAME_SWAP_HIST_SUB_BUCKETS)
+        return (uint64_t) bucket;
+
+    int shift = bucket / FRAME_SWAP_HIST_SUB_BUCKETS - 1;
+    uint64_t sub = (uint64_t) (bucket % FRAME_SWAP_HIST_SUB_BUCKETS);
+
+    return ((FRAME_SWAP_HIST_SUB_BUCKETS + sub) << shift) +
+            ((uint64_t) 1 << shift) - 1;
+}
+
+static inline void
+frame_swap_timer_start(frame_swap_timer_t* timer, unsigned long generation)
+{
+    BZERO(&timer->record, sizeof(frame_swap_record_t));
+    timer->record.generation = generation;
+    timer->start = timer->last = FRAME_CLOCK_NS();
+}
+
+/* Add the time since the previous phase to 'phase' */
+static inline void
+frame_swap_phase(frame_swap_timer_t* timer, frame_swap_phase_t phase)
+{
+    uint64_t now = FRAME_CLOCK_NS();
+
+    timer->record.ns[phase] += now - timer->last;
+    timer->last = now;
+}
+
+/* Publish the record of the swap in the ring buffer and count its
+ * phases in the histograms */
+static inline void
+frame_swap_timer_stop(frame_swap_log_t* log, frame_swap_timer_t* timer)
+{
+    size_t head = log->head;
+
+    timer->record.ns[FRAME_SWAP_TOTAL] = FRAME_CLOCK_NS() - timer->start;
+    log->records[head & (FRAME_SWAP_LOG_SIZE - 1)] = timer->record;
+    RELEASE_FENCE();
+    log->head = head + 1;
+
+    for (int phase = 0; phase < FRAME_SWAP_PHASES; phase++) {
+        uint64_t ns = timer->record.ns[phase];
+
+        if (!log->count[phase] || ns < log->min[phase])
+            log->min[phase] = ns;
+        if (ns > log->max[phase])
+            log->max[phase] = ns;
+        log->sum[phase] += ns;
+        log->count[phase]++;
+        log->buckets[phase][frame_swap_hist_bucket(ns)]++;
+    }
+}
+#endif
+
+
+#ifndef FRAME_WITH_CONTEXT
+/* Use DECLARE_FRAME_ALLOCATOR() to declare frame allocator
+ * in the source file */
+#define DECLARE_FRAME_ALLOCATOR()                              \
+    frame_allocator_t* _frame_allocator
+
+extern DECLARE_FRAME_ALLOCATOR();
+#endif
+
+
+/* Define FRAME_TLAB if you want each thread to reserve a chunk
+ * of FRAME_TLAB_SIZE bytes from the current bank at once and
+ * allocate from it without atomic operations. The chunk is
+ * refilled only when it runs out or the bank is swapped. Each
+ * thread also keeps the clean up records it registers in a list of
+ * its own, which is linked to the bank once per generation. */
+#ifdef FRAME_TLAB
+#ifndef FRAME_TLAB_SIZE
+#define FRAME_TLAB_SIZE 4096
+#endif
+
+/* Thread local allocation buffer */
+typedef struct {
+    frame_allocator_t* owner;
+    uintptr_t generation;
+    unsigned char* fp;
+    unsigned char* limit;
+    frame_clean_up_cb_list_t* cleanups;
+    uintptr_t cleanups_generation;
+} frame_tlab_t;
+
+/* Use DECLARE_FRAME_TLAB() to declare the thread local buffers
+ * in one source file */
+#define DECLARE_FRAME_TLAB()                                   \
+    THREAD_LOCAL frame_tlab_t _frame_tlab;                     \
+    uintptr_t _frame_tlab_generation
+
+extern THREAD_LOCAL frame_tlab_t _frame_tlab;
+extern uintptr_t _frame_tlab_generation;
+
+/* Get a process wide unique generation number. A thread local
+ * buffer is valid only if its generation matches the TLAB
+ * generation of the bank. */
+static inline uintptr_t
+frame_tlab_next_generation(void)
+{
+    uintptr_t orig;
+
+    do {
+        orig = _frame_tlab_generation;
+    } while (!CAS(&_frame_tlab_generation, &orig, orig + 1));
+
+    return orig + 1;
+}
+
+/* Marks the record which links the clean up list of a thread to
+ * the bank. The data of the record is the head of the list. */
+static inline void
+frame_clean_up_thread_list(void* list)
+{
+    (void) list;
+}
+#endif
+
+
+/* Define FRAME_EPOCH if you want frame_swap to wait for the
+ * threads which are still allocating from, or have pinned, the
+ * bank that is about to be cleared. Each thread publishes the bank
+ * it uses in an epoch record of its own, so entering and leaving
+ * an allocation costs one fence and one store. The swapper marks
+ * the bank as recycling and then waits only for the records which
+ * still point to it. */
+#ifdef FRAME_EPOCH
+#include <stdatomic.h>
+#ifndef FRAME_EPOCH_YIELD
+#include <sched.h>
+#define FRAME_EPOCH_YIELD() sched_yield()
+#endif
+
+/* Per thread epoch record. The bank being allocated from is in
+ * 'active' and the bank pinned by a reader in 'pinned'. The record
+ * fills a cache line so that threads do not share them. */
+typedef struct frame_epoch {
+    frame_allocator_t* volatile active;
+    frame_allocator_t* volatile pinned;
+    void* in_use;
+    struct frame_epoch* next;
+    int depth;
+    unsigned char _pad[CACHE_LINE_SIZE - 4 * sizeof(void*) - sizeof(int)];
+} frame_epoch_t;
+
+/* Use DECLARE_FRAME_EPOCH() to declare the epoch records in one
+ * source file */
+#define DECLARE_FRAME_EPOCH()                                  \
+    THREAD_LOCAL frame_epoch_t* _frame_epoch;                  \
+    frame_epoch_t* _frame_epoch_list
+
+extern THREAD_LOCAL frame_epoch_t* _frame_epoch;
+extern frame_epoch_t* _frame_epoch_list;
+
+/* Get the epoch record of the calling thread. A record released
+ * by an exited thread is reused if there is one. Returns NULL, if
+ * a new record cannot be allocated. */
+static inline frame_epoch_t*
+frame_epoch_record(void)
+{
+    frame_epoch_t* e = _frame_epoch;
+    void* expected;
+
+    if (e)
+        return e;
+
+    for (e = _frame_epoch_list; e; e = e->next) {
+        expected = NULL;
+        if (!e->in_use && CAS(&e->in_use, &expected, e))
+            return _frame_epoch = e;
+    }
+
+    e = MALLOC(sizeof(frame_epoch_t));
+    if (!e)
+        return NULL;
+
+    e->active = NULL;
+    e->pinned = NULL;
+    e->in_use = e;
+    e->depth = 0;
+    do {
+        e->next = _frame_epoch_list;
+    } while (!CAS(&_frame_epoch_list, &e->next, e));
+
+    return _frame_epoch = e;
+}
+
+/* Release the epoch record of the calling thread for reuse. Call
+ * this before a thread which has used the allocator exits. The
+ * records themselves are never freed. */
+static inline void
+frame_epoch_thread_exit(void)
+{
+    frame_epoch_t* e = _frame_epoch;
+
+    if (!e)
+        return;
+
+    e->active = NULL;
+    e->pinned = NULL;
+    e->depth = 0;
+    FENCE();
+    e->in_use = NULL;
+    _frame_epoch = NULL;
+}
+
+/* Publish the bank to the slot of the epoch record. Returns 1 and
+ * clears the slot, if the bank is being cleared or has been
+ * cleared after 'generation' was read from it. */
+static inline int
+frame_epoch_publish(frame_allocator_t* volatile* slot,
+                    frame_allocator_t* allocator, unsigned long generation)
+{
+    *slot = allocator;
+    FENCE();
+    if (allocator->recycling || allocator->generation != generation) {
+        *slot = NULL;
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Enter an allocation critical section. Returns the bank to
+ * allocate from. It is not cleared before frame_epoch_exit is
+ * called. Sections can be nested. Returns NULL, if the thread has
+ * no epoch record or, with FRAME_WITH_CONTEXT, if the given bank
+ * is no longer current. */
+static inline frame_allocator_t*
+frame_epoch_enter(frame_allocator_t* allocator)
+{
+    frame_epoch_t* e = frame_epoch_record();
+
+    if (!e)
+        return NULL;
+
+    if (e->depth++)
+        return e->active;
+
+#ifdef FRAME_WITH_CONTEXT
+    if (frame_epoch_publish(&e->active, allocator, allocator->generation))
+        return NULL;
+#else
+    while (frame_epoch_publish(&e->active, allocator, allocator->generation))
+        allocator = _frame_allocator;
+#endif
+
+    return allocator;
+}
+
+/* Leave an allocation critical section. */
+static inline void
+frame_epoch_exit(void)
+{
+    frame_epoch_t* e = _frame_epoch;
+
+    if (e && !--e->depth) {
+        RELEASE_FENCE();
+        e->active = NULL;
+    }
+}
+
+/* Wait until no thread allocates from or has pinned the bank.
+ * Threads entering after the bank has been marked as recycling
+ * back off, so the wait ends once the threads in flight are done. */
+static inline void
+frame_epoch_wait(frame_allocator_t* allocator)
+{
+    allocator->recycling = 1;
+    FENCE();
+    for (frame_epoch_t* e = _frame_epoch_list; e; e = e->next)
+        while (e->active == allocator || e->pinned == allocator)
+            FRAME_EPOCH_YIELD();
+}
+
+# define FRAME_EPOCH_ENTER(allocator)   frame_epoch_enter(allocator)
+# define FRAME_EPOCH_EXIT()             frame_epoch_exit()
+#else
+# define FRAME_EPOCH_ENTER(allocator)   (allocator)
+# define FRAME_EPOCH_EXIT()             do {} while (0)
+#endif
+
+
+/* Get memory for the banks. Returns NULL, if out of memory. */
+static inline unsigned char*
+frame_area_alloc(size_t size)
+{
+#ifdef FRAME_MMAP
+    void* area = MAP_FAILED;
+
+    size = ROUND_UP(size, FRAME_PAGE_SIZE);
+#if defined(FRAME_HUGETLB) && defined(MAP_HUGETLB)
+    area = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (area == MAP_FAILED) {
+        area = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (area == MAP_FAILED)
+            return NULL;
+#if (defined(FRAME_HUGEPAGE) || defined(FRAME_HUGETLB)) && defined(MADV_HUGEPAGE)
+        madvise(area, size, MADV_HUGEPAGE);
+#endif
+    }
+
+    return area;
+#else
+    unsigned char* area = MALLOC(size);
+
+#ifdef FRAME_PREZERO
+    if (area)
+        BZERO(area, size);
+#endif
+
+    return area;
+#endif
+}
+
+#ifdef FRAME_REALLOC
+/* Get the first table of the keep set, stored after it */
+static inline frame_keep_slot_t*
+frame_keep_first(frame_keep_set_t* set)
+{
+    return (frame_keep_slot_t*) ((unsigned char*) set + CACHE_LINE_SIZE);
+}
+
+/* Get the chunks of the keep set stored after the first table */
+static inline frame_keep_chunk_t*
+frame_keep_pool(frame_keep_set_t* set)
+{
+    return (frame_keep_chunk_t*) (frame_keep_first(set) + FRAME_KEEP_SLOTS);
+}
+#endif
+
+/* Get the size of the area holding the banks and, with
+ * FRAME_REALLOC, the keep set. */
+static inline size_t
+frame_area_size(size_t frame_size)
+{
+#ifdef FRAME_REALLOC
+    return frame_size * FRAME_BANKS + 2 * CACHE_LINE_SIZE +
+            sizeof(frame_keep_slot_t) * FRAME_KEEP_SLOTS +
+            sizeof(frame_keep_chunk_t) * FRAME_KEEP_CHUNKS;
+#else
+    return frame_size * FRAME_BANKS;
+#endif
+}
+
+/* Release memory of the banks */
+static inline void
+frame_area_free(unsigned char* area, size_t size)
+{
+#ifdef FRAME_MMAP
+    munmap(area, ROUND_UP(size, FRAME_PAGE_SIZE));
+#else
+    (void) size;
+    FREE(area);
+#endif
+}
+
+/* Get the address of the frame allocator structure of the given
+ * bank. It is placed at the end of the bank aligned to a cache line,
+ * or at the start of it with FRAME_GROW_UP. */
+static inline frame_allocator_t*
+frame_allocator_at(unsigned char* area, size_t frame_size, int bank)
+{
+#ifdef FRAME_GROW_UP
+    return (frame_allocator_t*)
+            ALIGN_UP(area + frame_size * bank, CACHE_LINE_SIZE);
+#else
+    return (frame_allocator_t*)
+            ((uintptr_t) (area + frame_size * (bank + 1) -
+                          sizeof(frame_allocator_t)) &
+             ~((uintptr_t) CACHE_LINE_SIZE - 1));
+#endif
+}
+
+/* Get the initial frame pointer of a bank. */
+static inline unsigned char*
+frame_bank_base(frame_allocator_t* allocator)
+{
+#ifdef FRAME_GROW_UP
+    return ALIGN_UP(allocator + 1, FRAME_MIN_ALIGN);
+#else
+    return (unsigned char*) allocator;
+#endif
+}
+
+/* Get the end of the bank the frame pointer moves towards. */
+static inline unsigned char*
+frame_bank_end(frame_allocator_t* allocator)
+{
+#ifdef FRAME_GROW_UP
+    return allocator->start + allocator->size * (allocator->bank + 1);
+#else
+    return allocator->start + allocator->size * allocator->bank;
+#endif
+}
+
+/* Get the address the frame pointer may move to. With FRAME_ADAPTIVE
+ * it is 'capacity' bytes from the initial frame pointer, else the end
+ * of the bank. */
+static inline unsigned char*
+frame_bank_limit(frame_allocator_t* allocator)
+{
+#if defined(FRAME_ADAPTIVE) && defined(FRAME_GROW_UP)
+    return frame_bank_base(allocator) + allocator->capacity;
+#elif defined(FRAME_ADAPTIVE)
+    return frame_bank_base(allocator) - allocator->capacity;
+#else
+    return frame_bank_end(allocator);
+#endif
+}
+
+/* Move the frame pointer 'fp' by 'size' bytes towards 'limit'. The
+ * object is aligned to 'align' and preceded by 'header' bytes, which
+ * are taken from the space the alignment skips where possible.
+ * Returns the object and stores the new frame pointer to 'newfp', or
+ * returns NULL, if there is not enough space left. */
+static inline unsigned char*
+frame_bump(unsigned char* fp, unsigned char* limit, size_t size, size_t align,
+           size_t header, unsigned char** newfp)
+{
+#ifdef FRAME_GROW_UP
+    if (fp > limit || (size_t) (limit - fp) < header)
+        return NULL;
+
+    unsigned char* p = ALIGN_UP(fp + header, align);
+
+    if (p > limit || (size_t) (limit - p) < size)
+        return NULL;
+    *newfp = p + size;
+
+    return p;
+#else
+    if (fp < limit || (size_t) (fp - limit) < size)
+        return NULL;
+
+    unsigned char* p = ALIGN_DOWN(fp - size, align);
+
+    if (p < limit || (size_t) (p - limit) < header)
+        return NULL;
+    *newfp = p - header;
+
+    return p;
+#endif
+}
+
+#ifdef FRAME_ADAPTIVE
+/* Get the most bytes the bank can hand out */
+static inline size_t
+frame_bank_capacity_max(frame_allocator_t* allocator)
+{
+#ifdef FRAME_GROW_UP
+    return (size_t) (frame_bank_end(allocator) - frame_bank_base(allocator));
+#else
+    return (size_t) (frame_bank_base(allocator) - frame_bank_end(allocator));
+#endif
+}
+
+/* Get the 'i'th range of the table, adding a part to the table if
+ * needed. Returns NULL, if out of memory. */
+static inline frame_spill_range_t*
+frame_spill_range(frame_spill_table_t* table, size_t i)
+{
+    frame_spill_ranges_t* ranges = &table->first;
+
+    for (; i >= FRAME_SPILL_BLOCKS; i -= FRAME_SPILL_BLOCKS) {
+        if (!ranges->next) {
+            frame_spill_ranges_t* next = MALLOC(sizeof(frame_spill_ranges_t));
+
+            if (!next)
+                return NULL;
+            BZERO(next, sizeof(frame_spill_ranges_t));
+            RELEASE_FENCE();
+            ranges->next = next;
+        }
+        ranges = ranges->next;
+    }
+
+    return &ranges->ranges[i];
+}
+
+/* Map a new spill block after 'full' has run out of space. The block
+ * is large enough to hold 'size' bytes. Only one of the threads
+ * racing to grow the bank links its block, others unmap theirs and
+ * retry with the winner's block. The block is linked with no space
+ * to hand out, so that no object is allocated from it before its
+ * range is in the table of the bank and found by frame_bank_of.
+ * Returns zero, if out of memory. */
+static inline int
+frame_spill_grow(frame_allocator_t* allocator, frame_spill_t* full, size_t size)
+{
+    frame_spill_table_t* table = &allocator->spill_table;
+    size_t block_size = ROUND_UP(size + sizeof(frame_spill_t) + FRAME_MIN_ALIGN,
+                                 FRAME_PAGE_SIZE);
+
+    if (allocator->spill != full)
+        return 1;
+    if (block_size < FRAME_SPILL_SIZE)
+        block_size = FRAME_SPILL_SIZE;
+    if (block_size < table->size)
+        block_size = table->size;
+
+    unsigned char* area = frame_area_alloc(block_size);
+    if (!area)
+        return 0;
+
+    frame_spill_t* block = (frame_spill_t*) area;
+#ifdef FRAME_GROW_UP
+    block->base = ALIGN_UP(block + 1, FRAME_MIN_ALIGN);
+    block->limit = area + block_size;
+#else
+    block->base = area + block_size;
+    block->limit = ALIGN_UP(block + 1, FRAME_MIN_ALIGN);
+#endif
+    block->fp = NULL;
+    block->size = block_size;
+    block->next = full;
+
+    if (!CAS(&allocator->spill, &full, block)) {
+        frame_area_free(area, block_size);
+        return 1;
+    }
+
+    /* No other thread grows the bank until the block has space */
+    size_t i = table->count;
+    frame_spill_range_t* range = frame_spill_range(table, i);
+
+    if (!range) {
+        allocator->spill = block->next;
+        frame_area_free(area, block_size);
+        return 0;
+    }
+    range->size = block_size;
+    RELEASE_FENCE();
+    range->start = area;
+    table->size += block_size;
+    RELEASE_FENCE();
+    table->count = i + 1;
+    RELEASE_FENCE();
+    block->fp = block->base;
+
+    return 1;
+}
+
+/* Reserve space from the spill blocks of the bank. Returns NULL, if
+ * out of memory. */
+static inline unsigned char*
+frame_reserve_spill(frame_allocator_t* allocator, size_t size, size_t align,
+                    size_t header)
+{
+    for (;;) {
+        frame_spill_t* block = allocator->spill;
+        unsigned char* orig;
+        unsigned char* newfp;
+        unsigned char* p;
+
+        while (block) {
+            orig = block->fp;
+            if (!orig)
+                break;
+            ACQUIRE_FENCE();
+            p = frame_bump(orig, block->limit, size, align, header, &newfp);
+            if (!p)
+                break;
+            if (CAS(&block->fp, &orig, newfp))
+                return p;
+            FRAME_STATS_ADD(allocator, cas_retries, 1);
+        }
+        /* The block is being linked in by another thread */
+        if (block && !orig)
+            continue;
+        if (!frame_spill_grow(allocator, block, size + header + align))
+            return NULL;
+    }
+}
+
+/* Get the number of bytes used from the spill blocks of the bank */
+static inline size_t
+frame_spill_used(frame_allocator_t* allocator)
+{
+    size_t used = 0;
+
+    for (frame_spill_t* block = allocator->spill; block; block = block->next)
+        if (block->fp)
+#ifdef FRAME_GROW_UP
+            used += (size_t) (block->fp - block->base);
+#else
+            used += (size_t) (block->base - block->fp);
+#endif
+
+    return used;
+}
+
+/* Unmap the spill blocks of the bank being cleared. The ranges are
+ * removed from the table first, while its generation is odd, so
+ * that the lookups racing with the clear skip the bank. The parts of
+ * the table are kept. Called by the swapping thread or by the clean
+ * up task. */
+static inline void
+frame_spill_free(frame_allocator_t* allocator)
+{
+    frame_spill_table_t* table = &allocator->spill_table;
+    frame_spill_t* block = allocator->spill;
+    frame_spill_t* next;
+
+    if (!block && !table->count)
+        return;
+
+    allocator->spill = NULL;
+    table->generation++;
+    RELEASE_FENCE();
+    for (frame_spill_ranges_t* ranges = &table->first; ranges; ranges = ranges->next)
+        for (int i = 0; i < FRAME_SPILL_BLOCKS; i++)
+            ranges->ranges[i].start = NULL;
+    table->count = 0;
+    table->size = 0;
+    RELEASE_FENCE();
+    table->generation++;
+
+    for (; block; block = next) {
+        next = block->next;
+        frame_area_free((unsigned char*) block, block->size);
+    }
+}
+
+/* Check if the pointer is in a spill block of the bank. Only the
+ * table of the bank is read. A bank which is being cleared holds no
+ * valid pointers, so a range found while its generation changed is
+ * not trusted. */
+static inline int
+frame_spill_has(frame_allocator_t* allocator, unsigned char* p)
+{
+    frame_spill_table_t* table = &allocator->spill_table;
+    unsigned long generation = table->generation;
+    int found = 0;
+
+    ACQUIRE_FENCE();
+
+    frame_spill_ranges_t* ranges = &table->first;
+    size_t count = table->count;
+
+    for (size_t i = 0; i < count && ranges && !found; i++) {
+        frame_spill_range_t* range = &ranges->ranges[i % FRAME_SPILL_BLOCKS];
+        unsigned char* start = range->start;
+
+        if (i % FRAME_SPILL_BLOCKS == FRAME_SPILL_BLOCKS - 1)
+            ranges = ranges->next;
+        if (!start)
+            continue;
+        ACQUIRE_FENCE();
+        found = p >= start && p < start + range->size;
+    }
+    ACQUIRE_FENCE();
+
+    return found && !(generation & 1) && table->generation == generation;
+}
+
+/* Free the parts chained to the table of spill block ranges. Called
+ * by frame_allocator_destroy, after the blocks have been unmapped. */
+static inline void
+frame_spill_ranges_free(frame_allocator_t* allocator)
+{
+    frame_spill_ranges_t* ranges = allocator->spill_table.first.next;
+    frame_spill_ranges_t* next;
+
+    for (; ranges; ranges = next) {
+        next = ranges->next;
+        FREE(ranges);
+    }
+}
+#endif
+
+/* Get the bank the pointer has been allocated from, or -1, if it is
+ * not from the frame. With FRAME_ADAPTIVE the spill blocks of the
+ * banks are searched, if the pointer is outside the banks. */
+static inline int
+frame_bank_of(frame_allocator_t* allocator, void* ptr)
+{
+    unsigned char* _p = (unsigned char*) ptr;
+
+    if (_p >= allocator->start &&
+        _p < allocator->start + allocator->size * FRAME_BANKS)
+        return (int) ((size_t) (_p - allocator->start) / allocator->size);
+
+#ifdef FRAME_ADAPTIVE
+    for (int bank = 0; bank < FRAME_BANKS; bank++)
+        if (frame_spill_has(frame_allocator_at(allocator->start,
+                                               allocator->size, bank), _p))
+            return bank;
+#endif
+
+    return -1;
+}
+
+/* Get the frame allocator structure from the given bank.
+ * Bank must be between 0 and FRAME_BANKS - 1. */
+static inline frame_allocator_t*
+frame_allocator_get(FRAME_CONTEXT_DECLARE int bank)
+{
+    return frame_allocator_at(_frame_allocator->start,
+                              _frame_allocator->size, bank);
+}
+
+/* Returns the bank identifier (from zero to FRAME_BANKS - 1)
+ * from which bank the pointer has been allocated. If the pointer
+ * is not allocated using the frame allocator, -1 is
+ * returned.
+ */
+static inline int
+frame_get_bank_by_ptr(FRAME_CONTEXT_DECLARE void* ptr)
+{
+    return frame_bank_of(_frame_allocator, ptr);
+}
+
+/* Returns the generation of the pointer, that is the number of
+ * swaps done before the bank of the pointer was activated. If the
+ * pointer is not allocated using the frame allocator, -1 is
+ * returned.
+ */
+static inline long
+frame_get_generation_by_ptr(FRAME_CONTEXT_DECLARE void* ptr)
+{
+    int bank = frame_get_bank_by_ptr(FRAME_CONTEXT ptr);
+
+    if (bank < 0)
+        return -1;
+
+    return (long) frame_allocator_get(FRAME_CONTEXT bank)->generation;
+}
+
+#ifdef FRAME_EPOCH
+/* Pin the bank holding the given generation. Objects allocated in
+ * the generation stay valid until frame_unpin is called, even if
+ * the bank is due to be cleared. A thread can pin one generation
+ * at a time. Returns 1, if the generation has already been
+ * cleared. */
+static inline int
+frame_pin_generation(FRAME_CONTEXT_DECLARE long generation)
+{
+    frame_epoch_t* e = frame_epoch_record();
+
+    if (!e)
+        return 1;
+
+    for (int bank = 0; bank < FRAME_BANKS; bank++) {
+        frame_allocator_t* allocator = frame_allocator_get(FRAME_CONTEXT bank);
+
+        if ((long) allocator->generation == generation)
+            return frame_epoch_publish(&e->pinned, allocator,
+                                       (unsigned long) generation);
+    }
+
+    return 1;
+}
+
+/* Pin the current generation. Returns the pinned generation or -1,
+ * if the thread has no epoch record. */
+static inline long
+frame_pin(FRAME_CONTEXT_DECLAREV)
+{
+    frame_allocator_t* allocator = FRAME_EPOCH_ENTER(_frame_allocator);
+    long generation = allocator ? (long) allocator->generation : -1;
+
+    if (allocator)
+        _frame_epoch->pinned = allocator;
+    FRAME_EPOCH_EXIT();
+
+    return generation;
+}
+
+/* Release the generation pinned by the calling thread. */
+static inline void
+frame_unpin(void)
+{
+    if (_frame_epoch) {
+        RELEASE_FENCE();
+        _frame_epoch->pinned = NULL;
+    }
+}
+#endif
+
+/* Initialize frame allocator with the given size.
+ * Note that the actual space needed is FRAME_BANKS
+ * times the frame size. In addition, each bank needs
+ * to have space for the frame structure. */
+static inline int
+frame_allocator_init(FRAME_CONTEXT_DECLAREP size_t frame_size)
+{
+    frame_allocator_t* allocator;
+
+    if (frame_size < sizeof(frame_allocator_t) + CACHE_LINE_SIZE)
+        return 1;
+
+    unsigned char* area = frame_area_alloc(frame_area_size(frame_size));
+
+    if (!area)
+        return 1;
+
+#ifdef FRAME_REALLOC
+    frame_keep_set_t* keepset = (frame_keep_set_t*)
+            ALIGN_UP(area + frame_size * FRAME_BANKS, CACHE_LINE_SIZE);
+
+    keepset->slots = frame_keep_first(keepset);
+    keepset->mask = FRAME_KEEP_SLOTS - 1;
+    keepset->overflow = NULL;
+    keepset->pooled = 0;
+#ifndef FRAME_MMAP
+    BZERO(keepset->slots, sizeof(frame_keep_slot_t) * FRAME_KEEP_SLOTS);
+#endif
+#endif
+
+#ifdef FRAME_EVACUATE
+    frame_evacuation_t* evacuation = MALLOC(sizeof(frame_evacuation_t));
+    if (!evacuation) {
+        frame_area_free(area, frame_area_size(frame_size));
+        return 1;
+    }
+    evacuation->objects = NULL;
+    evacuation->count = 0;
+    evacuation->capacity = 0;
+    evacuation->index = NULL;
+#endif
+
+#ifdef FRAME_SWAP_TIMING
+    frame_swap_log_t* swap_log = MALLOC(sizeof(frame_swap_log_t));
+    if (!swap_log) {
+#ifdef FRAME_EVACUATE
+        FREE(evacuation);
+#endif
+        frame_area_free(area, frame_area_size(frame_size));
+        return 1;
+    }
+    BZERO(swap_log, sizeof(frame_swap_log_t));
+#endif
+
+#ifdef FRAME_ADAPTIVE
+    frame_adaptive_t* adaptive = MALLOC(sizeof(frame_adaptive_t));
+    if (!adaptive) {
+#ifdef FRAME_EVACUATE
+        FREE(evacuation);
+#endif
+#ifdef FRAME_SWAP_TIMING
+        FREE(swap_log);
+#endif
+        frame_area_free(area, frame_area_size(frame_size));
+        return 1;
+    }
+    BZERO(adaptive, sizeof(frame_adaptive_t));
+    adaptive->capacity = ROUND_UP(FRAME_MMAP_KEEP, FRAME_PAGE_SIZE);
+#endif
+
+#ifdef FRAME_STATS
+    void* stats_area = MALLOC(sizeof(frame_stats_shard_t) * (FRAME_STATS_SHARDS + 1) +
+                              sizeof(frame_stats_history_t));
+    if (!stats_area) {
+#ifdef FRAME_EVACUATE
+        FREE(evacuation);
+#endif
+#ifdef FRAME_SWAP_TIMING
+        FREE(swap_log);
+#endif
+#ifdef FRAME_ADAPTIVE
+        FREE(adaptive);
+#endif
+        frame_area_free(area, frame_area_size(frame_size));
+        return 1;
+    }
+    frame_stats_shard_t* stats = (frame_stats_shard_t*)
+            ALIGN_UP(stats_area, CACHE_LINE_SIZE);
+    BZERO(stats, sizeof(frame_stats_shard_t) * FRAME_STATS_SHARDS +
+                 sizeof(frame_stats_history_t));
+#endif
+
+    for (int bank = 0; bank < FRAME_BANKS; bank++) {
+        allocator = frame_allocator_at(area, frame_size, bank);
+        allocator->start = area;
+        allocator->size = frame_size;
+        allocator->bank = bank;
+#ifdef FRAME_ADAPTIVE
+        allocator->capacity = adaptive->capacity;
+        if (allocator->capacity > frame_bank_capacity_max(allocator))
+            allocator->capacity = frame_bank_capacity_max(allocator);
+        allocator->spill = NULL;
+        BZERO(&allocator->spill_table, sizeof(frame_spill_table_t));
+        allocator->adaptive = adaptive;
+#endif
+        allocator->fp = frame_bank_base(allocator);
+        allocator->generation = 0;
+        allocator->cleanups = NULL;
+#ifdef FRAME_REALLOC
+        allocator->keepset = keepset;
+#endif
+#ifdef FRAME_EVACUATE
+        allocator->evacuation = evacuation;
+#endif
+#ifdef FRAME_PARALLEL_KEEP
+        allocator->keep_threads = FRAME_KEEP_THREADS;
+#endif
+#ifdef FRAME_KEEP_RUN_THREADS
+        allocator->keep_pool = NULL;
+#endif
+#ifdef FRAME_TLAB
+        allocator->tlab_generation = frame_tlab_next_generation();
+#endif
+#ifdef FRAME_EPOCH
+        allocator->recycling = 0;
+#endif
+#ifdef FRAME_ASYNC_CLEAN_UP
+        allocator->clean_up_pending = 0;
+#endif
+#ifdef FRAME_CLEAN_UP_THREADS
+        allocator->clean_up_worker = NULL;
+#endif
+#ifdef FRAME_STATS
+        allocator->stats = stats;
+        allocator->stats_area = stats_area;
+        allocator->high_water = 0;
+#endif
+#ifdef FRAME_SWAP_TIMING
+        allocator->swap_log = swap_log;
+#endif
+    }
+
+    /* Activate bank 0 */
+#ifdef FRAME_WITH_CONTEXT
+    *
+#endif
+    _frame_allocator = frame_allocator_at(area, frame_size, 0);
+
+    return 0;
+}
+
+/* Run the clean up callbacks of the list starting from 'elem'.
+ * The lists of the threads are run where they are linked in. */
+static inline void
+frame_clean_up_run(frame_allocator_t* allocator, frame_clean_up_cb_list_t* elem)
+{
+    (void) allocator;
+
+    for (; elem; elem = elem->next) {
+#ifdef FRAME_TLAB
+        if (elem->cb == frame_clean_up_thread_list) {
+            frame_clean_up_run(allocator, elem->data);
+            continue;
+        }
+#endif
+        if (elem->cb) {
+            elem->cb(elem->data);
+            FRAME_STATS_ADD(allocator, cleanups, 1);
+        }
+    }
+}
+
+/* Run the clean up callbacks registered for the frame
+ */
+static inline void
+frame_allocator_clean_up(frame_allocator_t* allocator)
+{
+    frame_clean_up_run(allocator, allocator->cleanups);
+    allocator->cleanups = NULL;
+}
+
+#ifdef FRAME_PREZERO
+/* Clear the memory from 'low' to 'high' except for the pages from
+ * 'skip_low' to 'skip_high', which have been decommitted. */
+static inline void
+frame_zero_range(unsigned char* low, unsigned char* high,
+                 unsigned char* skip_low, unsigned char* skip_high)
+{
+    if (skip_low >= skip_high) {
+        if (low < high)
+            BZERO(low, high - low);
+        return;
+    }
+    if (low < skip_low)
+        BZERO(low, (skip_low < high ? skip_low : high) - low);
+    if (skip_high < high) {
+        if (skip_high > low)
+            low = skip_high;
+        BZERO(low, high - low);
+    }
+}
+#endif
+
+#ifdef FRAME_MMAP
+/* Get the number of bytes from the initial frame pointer which stay
+ * committed, when the bank is cleared. */
+static inline size_t
+frame_bank_keep(frame_allocator_t* allocator)
+{
+#ifdef FRAME_ADAPTIVE
+    return allocator->capacity;
+#else
+    (void) allocator;
+    return FRAME_MMAP_KEEP;
+#endif
+}
+#endif
+
+/* Return the pages of the bank used since it was last cleared to
+ * the system, except for the first FRAME_MMAP_KEEP bytes from the
+ * initial frame pointer, or the capacity with FRAME_ADAPTIVE. Pages
+ * shared with the neighbouring bank are kept. With FRAME_PREZERO the
+ * rest of the memory used is cleared. Must be called before the
+ * frame pointer is reset. */
+static inline void
+frame_bank_decommit(frame_allocator_t* allocator)
+{
+#if defined(FRAME_MMAP) && defined(FRAME_GROW_UP)
+    size_t keep = frame_bank_keep(allocator);
+    unsigned char* base = frame_bank_base(allocator);
+    unsigned char* end = frame_bank_end(allocator);
+    unsigned char* high = allocator->fp;
+    unsigned char* low = ALIGN_UP(base + keep, FRAME_PAGE_SIZE);
+
+    if (high > end)
+        high = end;
+#ifdef FRAME_PREZERO
+    unsigned char* used = high;
+#endif
+    high = ALIGN_UP(high, FRAME_PAGE_SIZE);
+    if (high > ALIGN_DOWN(end, FRAME_PAGE_SIZE))
+        high = ALIGN_DOWN(end, FRAME_PAGE_SIZE);
+    if ((size_t) (end - base) > keep && low < high)
+        madvise(low, high - low, FRAME_MMAP_DECOMMIT);
+    else
+        low = high = NULL;
+#ifdef FRAME_PREZERO
+    frame_zero_range(base, used, low, high);
+#endif
+#elif defined(FRAME_MMAP)
+    size_t keep = frame_bank_keep(allocator);
+    unsigned char* bottom = frame_bank_end(allocator);
+    unsigned char* top = (unsigned char*) allocator;
+    unsigned char* low = allocator->fp;
+    unsigned char* high = ALIGN_DOWN(top - keep, FRAME_PAGE_SIZE);
+
+    if (low < bottom)
+        low = bottom;
+#ifdef FRAME_PREZERO
+    unsigned char* used = low;
+#endif
+    low = ALIGN_DOWN(low, FRAME_PAGE_SIZE);
+    if (low < ALIGN_UP(bottom, FRAME_PAGE_SIZE))
+        low = ALIGN_UP(bottom, FRAME_PAGE_SIZE);
+    if ((size_t) (top - bottom) > keep && low < high)
+        madvise(low, high - low, FRAME_MMAP_DECOMMIT);
+    else
+        low = high = NULL;
+#ifdef FRAME_PREZERO
+    frame_zero_range(used, top, low, high);
+#endif
+#elif defined(FRAME_PREZERO)
+    unsigned char* fp = allocator->fp;
+    unsigned char* limit = frame_bank_limit(allocator);
+
+#ifdef FRAME_GROW_UP
+    frame_zero_range(frame_bank_base(allocator), fp < limit ? fp : limit,
+                     NULL, NULL);
+#else
+    frame_zero_range(fp > limit ? fp : limit, frame_bank_base(allocator),
+                     NULL, NULL);
+#endif
+#else
+    (void) allocator;
+#endif
+}
+
+#ifdef FRAME_ASYNC_CLEAN_UP
+/* Run the clean ups of a retired bank. This is the task handed to
+ * the executor. With FRAME_EPOCH it first waits for the threads
+ * which still have the bank pinned. With FRAME_PREZERO the bank is
+ * cleared as well, so that the swap into it has nothing left to do. */
+static inline void
+frame_clean_up_task(void* arg)
+{
+    frame_allocator_t* allocator = (frame_allocator_t*) arg;
+
+#ifdef FRAME_EPOCH
+    frame_epoch_wait(allocator);
+#endif
+    frame_allocator_clean_up(allocator);
+#ifdef FRAME_ADAPTIVE
+    frame_spill_free(allocator);
+#endif
+#ifdef FRAME_PREZERO
+    frame_bank_decommit(allocator);
+    allocator->fp = frame_bank_base(allocator);
+#endif
+    RELEASE_FENCE();
+    allocator->clean_up_pending = 0;
+}
+
+#ifdef FRAME_CLEAN_UP_THREADS
+/* The default executor. One thread runs the batches of all banks in
+ * the order they were handed over. A bank has at most one batch
+ * pending, so the queue never holds more than FRAME_BANKS. */
+typedef struct frame_clean_up_worker {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+    frame_allocator_t* queue[FRAME_BANKS];
+    int head;
+    int count;
+    int stop;
+} frame_clean_up_worker_t;
+
+static inline void*
+frame_clean_up_thread(void* arg)
+{
+    frame_clean_up_worker_t* worker = (frame_clean_up_worker_t*) arg;
+    frame_allocator_t* allocator;
+
+    pthread_mutex_lock(&worker->lock);
+    for (;;) {
+        while (!worker->count && !worker->stop)
+            pthread_cond_wait(&worker->wake, &worker->lock);
+        if (!worker->count)
+            break;
+
+        allocator = worker->queue[worker->head];
+        worker->head = (worker->head + 1) % FRAME_BANKS;
+        worker->count--;
+        pthread_mutex_unlock(&worker->lock);
+        frame_clean_up_task(allocator);
+        pthread_mutex_lock(&worker->lock);
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return NULL;
+}
+
+/* Start the worker thread and hand it to all banks. Returns NULL,
+ * if the thread could not be created. */
+static inline frame_clean_up_worker_t*
+frame_clean_up_worker_start(frame_allocator_t* allocator)
+{
+    frame_clean_up_worker_t* worker = MALLOC(sizeof(frame_clean_up_worker_t));
+
+    if (!worker)
+        return NULL;
+
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->wake, NULL);
+    worker->head = 0;
+    worker->count = 0;
+    worker->stop = 0;
+    if (pthread_create(&worker->thread, NULL, frame_clean_up_thread, worker)) {
+        pthread_cond_destroy(&worker->wake);
+        pthread_mutex_destroy(&worker->lock);
+        FREE(worker);
+        return NULL;
+    }
+
+    for (int bank = 0; bank < FRAME_BANKS; bank++)
+        frame_allocator_at(allocator->start, allocator->size, bank)->clean_up_worker = worker;
+
+    return worker;
+}
+
+/* Queue the clean ups of the bank for the worker. Returns nonzero,
+ * if the worker could not be started. */
+static inline int
+frame_clean_up_submit(frame_allocator_t* allocator)
+{
+    frame_clean_up_worker_t* worker = allocator->clean_up_worker;
+    int full;
+
+    if (!worker && !(worker = frame_clean_up_worker_start(allocator)))
+        return 1;
+
+    pthread_mutex_lock(&worker->lock);
+    full = worker->count == FRAME_BANKS;
+    if (!full) {
+        worker->queue[(worker->head + worker->count) % FRAME_BANKS] = allocator;
+        worker->count++;
+        pthread_cond_signal(&worker->wake);
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return full;
+}
+
+/* Let the worker run the batches still queued, then join it */
+static inline void
+frame_clean_up_worker_stop(frame_clean_up_worker_t* worker)
+{
+    pthread_mutex_lock(&worker->lock);
+    worker->stop = 1;
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->lock);
+    pthread_join(worker->thread, NULL);
+    pthread_cond_destroy(&worker->wake);
+    pthread_mutex_destroy(&worker->lock);
+    FREE(worker);
+}
+#endif
+
+/* Check if a retired bank leaves anything to the executor: clean up
+ * callbacks, with FRAME_PREZERO memory to be cleared and with
+ * FRAME_ADAPTIVE spill blocks to be unmapped. */
+static inline int
+frame_clean_up_has_work(frame_allocator_t* allocator)
+{
+    int work = allocator->cleanups != NULL;
+
+#ifdef FRAME_PREZERO
+    work = work || allocator->fp != frame_bank_base(allocator);
+#endif
+#ifdef FRAME_ADAPTIVE
+    work = work || allocator->spill != NULL;
+#endif
+
+    return work;
+}
+
+/* Retire the bank and hand its clean ups to the executor. They are
+ * run synchronously, if the executor refuses the task. */
+static inline void
+frame_clean_up_start(frame_allocator_t* allocator)
+{
+    if (!frame_clean_up_has_work(allocator))
+        return;
+
+    allocator->clean_up_pending = 1;
+#ifdef FRAME_CLEAN_UP_THREADS
+    if (frame_clean_up_submit(allocator))
+#else
+    if (FRAME_CLEAN_UP_SUBMIT(frame_clean_up_task, allocator))
+#endif
+        frame_clean_up_task(allocator);
+}
+
+/* Wait until the clean ups of the bank handed to the executor have
+ * completed. */
+static inline void
+frame_clean_up_wait_bank(frame_allocator_t* allocator)
+{
+    while (allocator->clean_up_pending)
+        FRAME_CLEAN_UP_YIELD();
+    ACQUIRE_FENCE();
+}
+
+/* Wait until all clean ups handed to the executor have completed.
+ * Called by frame_allocator_destroy. */
+static inline void
+frame_clean_up_wait(FRAME_CONTEXT_DECLAREV)
+{
+    for (int bank = 0; bank < FRAME_BANKS; bank++)
+        frame_clean_up_wait_bank(frame_allocator_get(FRAME_CONTEXT bank));
+}
+#endif
+
+#ifdef FRAME_KEEP_RUN_THREADS
+static inline void frame_keep_pool_destroy(struct frame_keep_pool* pool);
+#endif
+#ifdef FRAME_REALLOC
+static inline void frame_keep_table_free(frame_keep_set_t* set);
+static inline void frame_keep_chunks_free(frame_keep_set_t* set);
+#endif
+
+/* Destroy frame allocator. No more allocations are allowed
+ * once this function is called.
+ */
+static inline void
+frame_allocator_destroy(FRAME_CONTEXT_DECLAREV)
+{
+#ifdef FRAME_ASYNC_CLEAN_UP
+    frame_clean_up_wait(FRAME_CONTEXTV);
+#endif
+#ifdef FRAME_CLEAN_UP_THREADS
+    if (_frame_allocator->clean_up_worker)
+        frame_clean_up_worker_stop(_frame_allocator->clean_up_worker);
+#endif
+#ifdef FRAME_KEEP_RUN_THREADS
+    if (_frame_allocator->keep_pool)
+        frame_keep_pool_destroy(_frame_allocator->keep_pool);
+#endif
+
+    /* Clean up from the oldest bank to the current one */
+    for (int i = 1; i <= FRAME_BANKS; i++) {
+        int bank = (_frame_allocator->bank + i) % FRAME_BANKS;
+        frame_allocator_clean_up(frame_allocator_get(FRAME_CONTEXT bank));
+    }
+
+#ifdef FRAME_REALLOC
+    frame_keep_table_free(_frame_allocator->keepset);
+    frame_keep_chunks_free(_frame_allocator->keepset);
+#endif
+#ifdef FRAME_ADAPTIVE
+    for (int bank = 0; bank < FRAME_BANKS; bank++) {
+        frame_spill_free(frame_allocator_get(FRAME_CONTEXT bank));
+        frame_spill_ranges_free(frame_allocator_get(FRAME_CONTEXT bank));
+    }
+    FREE(_frame_allocator->adaptive);
+#endif
+#ifdef FRAME_EVACUATE
+    FREE(_frame_allocator->evacuation->objects);
+    FREE(_frame_allocator->evacuation->index);
+    FREE(_frame_allocator->evacuation);
+#endif
+#ifdef FRAME_STATS
+    FREE(_frame_allocator->stats_area);
+#endif
+#ifdef FRAME_SWAP_TIMING
+    FREE(_frame_allocator->swap_log);
+#endif
+    frame_area_free(_frame_allocator->start, frame_area_size(_frame_allocator->size));
+}
+
+/* Reserve space directly from the shared frame pointer of
+ * the bank. The returned address is aligned to 'align'.
+ * Returns NULL, if the bank is full.
+ *
+ * With FRAME_WAIT_FREE the frame pointer is moved with a single
+ * fetch and subtract instead of a CAS loop. The size and the header
+ * are rounded up to FRAME_MIN_ALIGN so that the frame pointer stays
+ * aligned. Larger alignments are handled by reserving extra space. Requests
+ * larger than the space left fail without moving the pointer.
+ * Requests which find the pointer past the limit undo their own
+ * move. The thread which took it past the limit tries once to move
+ * it back. If others have moved it meanwhile, the bank is left
+ * full until it is cleared, which wastes less than that request.
+ */
+static inline unsigned char*
+frame_reserve_shared(frame_allocator_t* allocator, size_t size, size_t align,
+                     size_t header)
+{
+    unsigned char* limit = frame_bank_limit(allocator);
+
+#if defined(FRAME_WAIT_FREE) && defined(FRAME_GROW_UP)
+    unsigned char* orig = allocator->fp;
+
+    if (orig > limit || size > (size_t) (limit - orig) ||
+        header > (size_t) (limit - orig) || align > (size_t) (limit - orig))
+        return NULL;
+    size = ROUND_UP(size, FRAME_MIN_ALIGN) + ROUND_UP(header, FRAME_MIN_ALIGN) +
+           align - FRAME_MIN_ALIGN;
+    if (size > (size_t) (limit - orig))
+        return NULL;
+
+    orig = FETCH_ADD(&allocator->fp, size);
+    unsigned char* newp = orig + size;
+
+    if (orig > limit) {
+        /* Another thread is past the limit */
+        FETCH_SUB(&allocator->fp, size);
+        return NULL;
+    }
+    if ((size_t) (limit - orig) < size) {
+        /* Retry only if the CAS failed spuriously */
+        while (!CAS(&allocator->fp, &newp, orig) && newp == orig + size)
+            ;
+        return NULL;
+    }
+
+    return ALIGN_UP(orig + header, align);
+#elif defined(FRAME_WAIT_FREE)
+    unsigned char* orig = allocator->fp;
+
+    if (orig < limit || size > (size_t) (orig - limit) ||
+        header > (size_t) (orig - limit) || align > (size_t) (orig - limit))
+        return NULL;
+    size = ROUND_UP(size, FRAME_MIN_ALIGN) + ROUND_UP(header, FRAME_MIN_ALIGN) +
+           align - FRAME_MIN_ALIGN;
+    if (size > (size_t) (orig - limit))
+        return NULL;
+
+    orig = FETCH_SUB(&allocator->fp, size);
+    unsigned char* newp = orig - size;
+
+    if (orig < limit) {
+        /* Another thread is past the limit */
+        FETCH_ADD(&allocator->fp, size);
+        return NULL;
+    }
+    if ((size_t) (orig - limit) < size) {
+        /* Retry only if the CAS failed spuriously */
+        while (!CAS(&allocator->fp, &newp, orig) && newp == orig - size)
+            ;
+        return NULL;
+    }
+
+    return ALIGN_UP(newp + header, align);
+#else
+    unsigned char* orig;
+    unsigned char* newfp;
+    unsigned char* p;
+
+    for (;;) {
+        orig = allocator->fp;
+        p = frame_bump(orig, limit, size, align, header, &newfp);
+        if (!p)
+            return NULL;
+        if (CAS(&allocator->fp, &orig, newfp))
+            break;
+        FRAME_STATS_ADD(allocator, cas_retries, 1);
+    }
+
+    return p;
+#endif
+}
+
+/* Reserve space from the bank. With FRAME_ADAPTIVE the space is
+ * taken from the spill blocks, when the capacity of the bank has
+ * been used up. Returns NULL, if the bank is full. */
+static inline unsigned char*
+frame_reserve_chained(frame_allocator_t* allocator, size_t size, size_t align,
+                      size_t header)
+{
+    unsigned char* p = frame_reserve_shared(allocator, size, align, header);
+
+#ifdef FRAME_ADAPTIVE
+    if (!p)
+        p = frame_reserve_spill(allocator, size, align, header);
+#endif
+
+    return p;
+}
+
+/* Reserve space from the bank. The returned address is aligned
+ * to 'align'. With FRAME_TLAB the space is taken from the thread
+ * local buffer, which is refilled from the bank when it runs out.
+ * Large requests bypass the buffer. Returns NULL, if the bank is
+ * full. */
+static inline unsigned char*
+frame_reserve(frame_allocator_t* allocator, size_t size, size_t align, size_t header)
+{
+#ifdef FRAME_TLAB
+    frame_tlab_t* tlab = &_frame_tlab;
+    unsigned char* p;
+
+    if (tlab->owner != allocator ||
+        tlab->generation != allocator->tlab_generation ||
+        !(p = frame_bump(tlab->fp, tlab->limit, size, align, header, &tlab->fp))) {
+        if (size + header + align > (FRAME_TLAB_SIZE >> 2))
+            return frame_reserve_chained(allocator, size, align, header);
+
+        unsigned char* chunk = frame_reserve_chained(allocator, FRAME_TLAB_SIZE,
+                                                     FRAME_MIN_ALIGN, 0);
+        if (!chunk)
+            return frame_reserve_chained(allocator, size, align, header);
+
+        tlab->owner = allocator;
+        tlab->generation = allocator->tlab_generation;
+#ifdef FRAME_GROW_UP
+        tlab->fp = chunk;
+        tlab->limit = chunk + FRAME_TLAB_SIZE;
+#else
+        tlab->fp = chunk + FRAME_TLAB_SIZE;
+        tlab->limit = chunk;
+#endif
+        p = frame_bump(tlab->fp, tlab->limit, size, align, header, &tlab->fp);
+    }
+
+    return p;
+#else
+    return frame_reserve_chained(allocator, size, align, header);
+#endif
+}
+
+/* Allocate space aligned to 'align' from the current frame.
+ * The alignment must be a power of two. Returns NULL, if the
+ * frame is full. */
+static inline void*
+frame_malloc_aligned(FRAME_CONTEXT_DECLARE size_t size, size_t align)
+{
+    if (align < FRAME_MIN_ALIGN)
+        align = FRAME_MIN_ALIGN;
+
+    frame_allocator_t* allocator = FRAME_EPOCH_ENTER(_frame_allocator);
+    unsigned char* newp = allocator ?
+            frame_reserve(allocator, size, align, REALLOC_HEADER_SIZE) : NULL;
+
+    if (newp) {
+        FRAME_STATS_ADD(_frame_allocator, allocations, 1);
+        FRAME_STATS_ADD(_frame_allocator, bytes, size);
+        SET_REALLOC_SIZE(newp - REALLOC_HEADER_SIZE, size);
+    } else {
+        FRAME_STATS_ADD(_frame_allocator, failures, 1);
+    }
+    FRAME_EPOCH_EXIT();
+
+    return newp;
+}
+
+/* Allocate space from the current frame. Returns NULL,
+ * if the frame is full. */
+static inline void*
+frame_malloc(FRAME_CONTEXT_DECLARE size_t size)
+{
+    return frame_malloc_aligned(FRAME_CONTEXT size, FRAME_MIN_ALIGN);
+}
+
+/* Allocate space from the current frame. Returns NULL,
+ * if the frame is full. The memory is cleared. */
+static inline void*
+frame_malloc0(FRAME_CONTEXT_DECLARE size_t size)
+{
+    (void) FRAME_EPOCH_ENTER(_frame_allocator);
+
+    void* p = frame_malloc(FRAME_CONTEXT size);
+
+#ifndef FRAME_PREZERO
+    if (p)
+        BZERO(p, size);
+#endif
+    FRAME_EPOCH_EXIT();
+
+    return p;
+}
+
+#ifdef FRAME_REALLOC
+
+/* Resize the object at 'ptr' in place, if it is the most recent
+ * allocation at the frame pointer at 'fpp'. With FRAME_GROW_UP the
+ * object simply ends at a new address. Otherwise the end of the
+ * object stays where it is and its start moves down to grow and up
+ * to shrink, so the content is moved with memmove but no space is
+ * wasted. The frame pointer is moved with a CAS, so another thread
+ * allocating in between makes the resize fail. Returns NULL, if the
+ * object could not be resized in place. */
+static inline unsigned char*
+frame_resize_at(unsigned char** fpp, unsigned char* limit, unsigned char* ptr,
+                size_t old_size, size_t size, size_t align)
+{
+#ifdef FRAME_GROW_UP
+    unsigned char* orig = *fpp;
+    unsigned char* expected = orig;
+    unsigned char* end = ptr + old_size;
+    unsigned char* newfp;
+
+    /* With FRAME_WAIT_FREE the frame pointer is rounded up */
+    if (orig != end && orig != ALIGN_UP(end, FRAME_MIN_ALIGN))
+        return NULL;
+    if (((uintptr_t) ptr & (align - 1)) != 0 || ptr > limit ||
+        (size_t) (limit - ptr) < size)
+        return NULL;
+    newfp = ALIGN_UP(ptr + size, FRAME_MIN_ALIGN);
+    if (newfp > limit)
+        return NULL;
+#ifdef FRAME_PREZERO
+    /* The memory released would have to be cleared */
+    if (newfp < orig)
+        return NULL;
+#endif
+
+    while (!CAS(fpp, &expected, newfp))
+        if (expected != orig)
+            return NULL;
+    SET_REALLOC_SIZE(ptr - REALLOC_HEADER_SIZE, size);
+
+    return ptr;
+#else
+    unsigned char* orig = *fpp;
+    unsigned char* expected = orig;
+    unsigned char* end = ptr + old_size;
+    unsigned char* newp;
+    unsigned char* newfp;
+
+    /* With FRAME_WAIT_FREE the frame pointer is rounded down */
+    if (orig != ptr - REALLOC_HEADER_SIZE &&
+        orig != ALIGN_DOWN(ptr - REALLOC_HEADER_SIZE, FRAME_MIN_ALIGN))
+        return NULL;
+    if (orig < limit || (size_t) (end - limit) < size)
+        return NULL;
+    newp = ALIGN_DOWN(end - size, align);
+    if (newp < limit || (size_t) (newp - limit) < REALLOC_HEADER_SIZE)
+        return NULL;
+    newfp = newp - REALLOC_HEADER_SIZE;
+    if (orig != ptr - REALLOC_HEADER_SIZE)
+        newfp = ALIGN_DOWN(newfp, FRAME_MIN_ALIGN);
+#ifdef FRAME_PREZERO
+    /* The memory released would have to be cleared */
+    if (newp > ptr)
+        return NULL;
+#endif
+
+    if (newp < ptr) {
+        while (!CAS(fpp, &expected, newfp))
+            if (expected != orig)
+                return NULL;
+        memmove(newp, ptr, old_size);
+    } else if (newp > ptr) {
+        memmove(newp, ptr, size);
+        while (!CAS(fpp, &expected, newfp)) {
+            if (expected != orig) {
+                memmove(ptr, newp, size);
+                return NULL;
+            }
+        }
+    }
+    SET_REALLOC_SIZE(newp - REALLOC_HEADER_SIZE, size);
+
+    return newp;
+#endif
+}
+
+/* Resize the object at 'ptr' in place, if it is the most recent
+ * allocation of the thread local buffer or of the bank. Objects
+ * with a clean up record are never resized in place, as the record
+ * follows the object. */
+static inline void*
+frame_resize(frame_allocator_t* allocator, void* ptr, size_t old_size,
+             size_t size, size_t align)
+{
+    if (HAS_REALLOC_CLEAN_UP(ptr))
+        return NULL;
+
+#ifdef FRAME_TLAB
+    frame_tlab_t* tlab = &_frame_tlab;
+    unsigned char* p;
+
+    if (tlab->owner == allocator &&
+        tlab->generation == allocator->tlab_generation &&
+        (p = frame_resize_at(&tlab->fp, tlab->limit, ptr, old_size, size, align)))
+        return p;
+#endif
+
+    return frame_resize_at(&allocator->fp, frame_bank_limit(allocator), ptr,
+                           old_size, size, align);
+}
+
+/* Reallocate space aligned to 'align' from the current frame.
+ * Returns NULL, if the frame is full. The most recent allocation
+ * is resized in place and other objects of the current bank are
+ * shrunk in place. Else the old content is copied to new location.
+ * Note that if you have registered a clean up callback use
+ * frame_realloc_aligned_with_cleanup instead.
+ */
+static inline void*
+frame_realloc_aligned(FRAME_CONTEXT_DECLARE void* ptr, size_t size, size_t align)
+{
+    size_t old_size = GET_REALLOC_SIZE(ptr);
+    frame_allocator_t* allocator = FRAME_EPOCH_ENTER(_frame_allocator);
+    void* newp = NULL;
+
+    if (align < FRAME_MIN_ALIGN)
+        align = FRAME_MIN_ALIGN;
+
+    if (allocator && !(newp = frame_resize(allocator, ptr, old_size, size, align))) {
+        if (frame_get_bank_by_ptr(FRAME_CONTEXT ptr) == allocator->bank &&
+            old_size >= size && ((uintptr_t) ptr & (align - 1)) == 0) {
+            if (!HAS_REALLOC_CLEAN_UP(ptr))
+                SET_REALLOC_SIZE((unsigned char*) ptr - REALLOC_HEADER_SIZE, size);
+            newp = ptr;
+        } else if ((newp = frame_malloc_aligned(FRAME_CONTEXT size, align)))
+            memcpy(newp, ptr, old_size < size ? old_size : size);
+    }
+    FRAME_EPOCH_EXIT();
+
+    return newp;
+}
+
+/* Reallocate space from the current frame. Returns NULL,
+ * if the frame is full. The old content is copied to new
+ * location. Note that if you have registered a clean up
+ * callback use fraem_realloc_with_cleanup instead.
+ */
+static inline void*
+frame_realloc(FRAME_CONTEXT_DECLARE void* ptr, size_t size)
+{
+    return frame_realloc_aligned(FRAME_CONTEXT ptr, size, FRAME_MIN_ALIGN);
+}
+
+#endif
+
+/* Link a clean up record to the bank. With FRAME_TLAB the record
+ * is pushed to the list of the calling thread without atomic
+ * operations. Only the first record of the thread after the bank
+ * has been activated links the list to the bank with a CAS. */
+static inline void
+frame_clean_up_push(frame_allocator_t* allocator, frame_clean_up_cb_list_t* elem)
+{
+    frame_clean_up_cb_list_t** cleanups = &allocator->cleanups;
+
+#ifdef FRAME_TLAB
+    frame_tlab_t* tlab = &_frame_tlab;
+
+    if (tlab->cleanups_generation != allocator->tlab_generation) {
+        frame_clean_up_cb_list_t* list = (frame_clean_up_cb_list_t*)
+                frame_reserve(allocator, sizeof(frame_clean_up_cb_list_t),
+                              FRAME_MIN_ALIGN, 0);
+
+        if (list) {
+            list->cb = frame_clean_up_thread_list;
+            list->data = NULL;
+            list->next = *cleanups;
+            while (!CAS(cleanups, &list->next, list))
+                FRAME_STATS_ADD(allocator, cas_retries, 1);
+            tlab->cleanups = list;
+            tlab->cleanups_generation = allocator->tlab_generation;
+        }
+    }
+    if (tlab->cleanups_generation == allocator->tlab_generation) {
+        elem->next = tlab->cleanups->data;
+        tlab->cleanups->data = elem;
+        return;
+    }
+#endif
+
+    elem->next = *cleanups;
+    while (!CAS(cleanups, &elem->next, elem))
+        FRAME_STATS_ADD(allocator, cas_retries, 1);
+}
+
+/* Allocate space aligned to 'align' from the current frame and
+ * register a callback for clean up. Returns NULL, if the frame
+ * is full. The clean up record is placed after the object. */
+static inline void*
+frame_malloc_aligned_with_cleanup(FRAME_CONTEXT_DECLARE size_t size, size_t align,
+                                  void (*cleanup)(void*))
+{
+    if (align < FRAME_MIN_ALIGN)
+        align = FRAME_MIN_ALIGN;
+
+    frame_allocator_t* allocator = FRAME_EPOCH_ENTER(_frame_allocator);
+
+    if (!allocator) {
+        FRAME_STATS_ADD(_frame_allocator, failures, 1);
+        FRAME_EPOCH_EXIT();
+        return NULL;
+    }
+
+    size_t elem_offset = ROUND_UP(size, _Alignof(frame_clean_up_cb_list_t));
+    /* The record would wrap around with sizes this large */
+    unsigned char* newp = size > SIZE_MAX / 2 ? NULL :
+            frame_reserve(allocator,
+                          elem_offset + sizeof(frame_clean_up_cb_list_t),
+                          align, REALLOC_HEADER_SIZE);
+
+    if (!newp) {
+        FRAME_STATS_ADD(allocator, failures, 1);
+        FRAME_EPOCH_EXIT();
+        return NULL;
+    }
+
+    FRAME_STATS_ADD(allocator, allocations, 1);
+    FRAME_STATS_ADD(allocator, bytes, size);
+    frame_clean_up_cb_list_t* elem =
+            (frame_clean_up_cb_list_t*) (newp + elem_offset);
+    elem->cb = cleanup;
+    elem->data = newp;
+#ifndef FRAME_PREZERO
+    BZERO(newp, size);
+#endif
+    frame_clean_up_push(allocator, elem);
+
+    SET_REALLOC_SIZE_WITH_CLEAN_UP(newp - REALLOC_HEADER_SIZE, size);
+    FRAME_EPOCH_EXIT();
+
+    return newp;
+}
+
+/* Allocate space from the current frame and register
+ * a callback for clean up. Returns NULL, if the frame
+ * is full. */
+static inline void*
+frame_malloc_with_cleanup(FRAME_CONTEXT_DECLARE size_t size, void (*cleanup)(void*))
+{
+    return frame_malloc_aligned_with_cleanup(FRAME_CONTEXT size, FRAME_MIN_ALIGN,
+                                             cleanup);
+}
+
+#ifdef FRAME_REALLOC
+/* Get the clean up record of an object. The record follows the
+ * object, so it is found from the size of the object. Returns NULL,
+ * if the object was allocated without a clean up callback. */
+static inline frame_clean_up_cb_list_t*
+frame_clean_up_record(void* ptr)
+{
+    if (!HAS_REALLOC_CLEAN_UP(ptr))
+        return NULL;
+
+    return (frame_clean_up_cb_list_t*) ((unsigned char*) ptr +
+            ROUND_UP(GET_REALLOC_SIZE(ptr), _Alignof(frame_clean_up_cb_list_t)));
+}
+
+/* Rellocate space aligned to 'align' from the current frame and
+ * register a callback for clean up. Returns NULL, if the frame
+ * is full. */
+static inline void*
+frame_realloc_aligned_with_cleanup(FRAME_CONTEXT_DECLARE void* ptr, size_t size,
+                                   size_t align)
+{
+    int bank = frame_get_bank_by_ptr(FRAME_CONTEXT ptr);
+    size_t old_size = GET_REALLOC_SIZE(ptr);
+    frame_clean_up_cb_list_t* e = NULL;
+    void* newp = NULL;
+
+    if (bank < 0)
+        return NULL;
+
+    frame_allocator_t* current = FRAME_EPOCH_ENTER(_frame_allocator);
+
+    if (!current) {
+        FRAME_EPOCH_EXIT();
+        return NULL;
+    }
+
+    if (bank == current->bank &&
+        old_size >= size && ((uintptr_t) ptr & (align - 1)) == 0) {
+        FRAME_EPOCH_EXIT();
+        return ptr;
+    }
+
+    e = frame_clean_up_record(ptr);
+    if (e && e->data == ptr && (newp = frame_malloc_aligned_with_cleanup(FRAME_CONTEXT size, align,
+                                                       e->cb))) {
+        memcpy(newp, ptr, old_size < size ? old_size : size);
+        e->cb = NULL;
+        e->data = NULL;
+    }
+    FRAME_EPOCH_EXIT();
+
+    return newp;
+}
+
+/* Rellocate space from the current frame and register
+ * a callback for clean up. Returns NULL, if the frame
+ * is full. */
+static inline void*
+frame_realloc_with_cleanup(FRAME_CONTEXT_DECLARE void* ptr, size_t size)
+{
+    return frame_realloc_aligned_with_cleanup(FRAME_CONTEXT ptr, size,
+                                              FRAME_MIN_ALIGN);
+}
+
+#endif
+
+/* Get the number of bytes in use in the bank. With FRAME_TLAB
+ * this includes the unused parts of the thread local buffers. */
+static inline size_t
+frame_bank_used(frame_allocator_t* allocator)
+{
+    unsigned char* fp = allocator->fp;
+    unsigned char* limit = frame_bank_limit(allocator);
+
+#ifdef FRAME_GROW_UP
+    if (fp > limit)
+        fp = limit;
+    return (size_t) (fp - frame_bank_base(allocator));
+#else
+    if (fp < limit)
+        fp = limit;
+    return (size_t) (frame_bank_base(allocator) - fp);
+#endif
+}
+
+#ifdef FRAME_ADAPTIVE
+/* Record the bytes used by the frame which ends on this swap,
+ * including the spill blocks */
+static inline void
+frame_adaptive_record(frame_allocator_t* current)
+{
+    frame_adaptive_t* adaptive = current->adaptive;
+
+    adaptive->used[adaptive->frames++ % FRAME_ADAPTIVE_HISTORY] =
+            frame_bank_used(current) + frame_spill_used(current);
+}
+
+/* Set the capacity of the bank being cleared from the recent frames.
+ * The capacity follows the target up at once and down only when the
+ * target is less than half of it. */
+static inline void
+frame_adaptive_resize(frame_allocator_t* allocator)
+{
+    frame_adaptive_t* adaptive = allocator->adaptive;
+    size_t peak = 0;
+
+    for (int i = 0; i < FRAME_ADAPTIVE_HISTORY; i++)
+        if (adaptive->used[i] > peak)
+            peak = adaptive->used[i];
+
+    size_t target = ROUND_UP(peak + peak / 100 * FRAME_ADAPTIVE_HEADROOM,
+                             FRAME_PAGE_SIZE);
+
+    if (target < FRAME_MMAP_KEEP)
+        target = ROUND_UP(FRAME_MMAP_KEEP, FRAME_PAGE_SIZE);
+    if (target > adaptive->capacity || target < adaptive->capacity / 2)
+        adaptive->capacity = target;
+
+    allocator->capacity = adaptive->capacity;
+    if (allocator->capacity > frame_bank_capacity_max(allocator))
+        allocator->capacity = frame_bank_capacity_max(allocator);
+}
+
+/* Get the number of bytes the current bank can hand out before
+ * allocations spill */
+static inline size_t
+frame_allocator_capacity(FRAME_CONTEXT_DECLAREV)
+{
+    return _frame_allocator->capacity;
+}
+
+/* Get the number of bytes allocated from the spill blocks of the
+ * current bank */
+static inline size_t
+frame_allocator_spilled(FRAME_CONTEXT_DECLAREV)
+{
+    return frame_spill_used(_frame_allocator);
+}
 #endif
-} frame_allocator_t;
 
+#ifdef FRAME_STATS
+/* Get a snapshot of the statistics of the frame allocator. The
+ * counters are read without stopping the allocating threads, so
+ * the snapshot is not atomic. */
+static inline frame_stats_t
+frame_allocator_stats(FRAME_CONTEXT_DECLAREV)
+{
+    frame_stats_t stats;
+
+    BZERO(&stats, sizeof(stats));
+    for (int i = 0; i < FRAME_STATS_SHARDS; i++) {
+        frame_stats_shard_t* shard = &_frame_allocator->stats[i];
+        stats.allocations += shard->allocations;
+        stats.bytes += shard->bytes;
+        stats.failures += shard->failures;
+        stats.cas_retries += shard->cas_retries;
+        stats.cleanups += shard->cleanups;
+        stats.keep_copies += shard->keep_copies;
+    }
+    for (int bank = 0; bank < FRAME_BANKS; bank++) {
+        frame_allocator_t* allocator = frame_allocator_get(FRAME_CONTEXT bank);
+        if (allocator->high_water > stats.high_water)
+            stats.high_water = allocator->high_water;
+    }
+    stats.swaps = _frame_allocator->generation;
+    stats.used = frame_bank_used(_frame_allocator);
 
-#ifndef FRAME_WITH_CONTEXT
-/* Use DECLARE_FRAME_ALLOCATOR() to declare frame allocator
- * in the source file */
-#define DECLARE_FRAME_ALLOCATOR()                              \
-    frame_allocator_t* _frame_allocator
+    frame_stats_history_t* history = (frame_stats_history_t*)
+            (_frame_allocator->stats + FRAME_STATS_SHARDS);
 
-extern DECLARE_FRAME_ALLOCATOR();
+    for (size_t i = 0; i < FRAME_STATS_HISTORY && i < history->count; i++)
+        stats.recent_used[i] =
+                history->used[(history->count - 1 - i) % FRAME_STATS_HISTORY];
+    stats.last_used = stats.recent_used[0];
+
+    return stats;
+}
 #endif
 
+#ifdef FRAME_REALLOC
+/* Hash of a pointer. Taken from the high bits of a multiplicative
+ * hash, so that aligned pointers spread evenly. */
+static inline size_t
+frame_ptr_hash(void* ptr)
+{
+    uint64_t h = (uint64_t) (uintptr_t) ptr * 0x9e3779b97f4a7c15ull;
 
-/* Get the frame allocator structure from the given bank.
- * Bank must be 0 or 1. */
-static inline frame_allocator_t*
-frame_allocator_get(FRAME_CONTEXT_DECLARE int bank)
+    return (size_t) (h >> 32);
+}
+
+/* Get the home slot of a pointer in the keep set */
+static inline size_t
+frame_keep_hash(frame_keep_set_t* set, void** ptrp)
 {
-    return (frame_allocator_t*)
-            (_frame_allocator->start +
-            (_frame_allocator->size << bank) -
-            sizeof(frame_allocator_t));
+    return frame_ptr_hash(ptrp) & set->mask;
 }
+#endif
 
-/* Returns the bank identifier (zero or one) from which
- * bank the pointer has been allocated. If the pointer
- * is not allocated using the frame allocator, -1 is
- * returned.
- */
+#ifdef FRAME_EVACUATE
+/* Visitor of the objects kept with frame_keep_graph without one */
+static inline void
+frame_visit_none(frame_evacuation_t* ev, void* obj)
+{
+    (void) ev;
+    (void) obj;
+}
+
+/* Double the room for copied objects and rebuild the index, which
+ * has twice as many slots as there is room for objects. Returns
+ * nonzero, if out of memory. */
 static inline int
-frame_get_bank_by_ptr(FRAME_CONTEXT_DECLARE void* ptr)
+frame_evacuation_grow(frame_evacuation_t* ev)
 {
-    unsigned char* _p = (unsigned char*) ptr;
+    size_t capacity = ev->capacity ? 2 * ev->capacity : 1024;
+    frame_forward_t* objects = MALLOC(sizeof(frame_forward_t) * capacity);
+    size_t* index = MALLOC(sizeof(size_t) * 2 * capacity);
 
-    if (_p < _frame_allocator->start ||
-        _p >= _frame_allocator->start + (_frame_allocator->size << 1))
-        return -1;
+    if (!objects || !index) {
+        FREE(objects);
+        FREE(index);
+        return 1;
+    }
 
-    if (_p < _frame_allocator->start + _frame_allocator->size)
-        return 0;
+    if (ev->count)
+        memcpy(objects, ev->objects, sizeof(frame_forward_t) * ev->count);
+    BZERO(index, sizeof(size_t) * 2 * capacity);
+    for (size_t i = 0; i < ev->count; i++) {
+        size_t slot = frame_ptr_hash(objects[i].from) & (2 * capacity - 1);
 
-    return 1;
+        while (index[slot])
+            slot = (slot + 1) & (2 * capacity - 1);
+        index[slot] = i + 1;
+    }
+
+    FREE(ev->objects);
+    FREE(ev->index);
+    ev->objects = objects;
+    ev->index = index;
+    ev->capacity = capacity;
+
+    return 0;
 }
 
-/* Initialize frame allocator with the given size.
- * Note that the actual space needed is twice the
- * size of the frame size. In addition, frame needs
- * to have space for the frame structure. */
-static inline int
-frame_allocator_init(FRAME_CONTEXT_DECLAREP size_t frame_size)
+/* Copy the object '*ptrp' points to into the new bank, unless it has
+ * been copied already, and update '*ptrp' to point to the copy. The
+ * pointers of the copy are visited later on with 'visit', or not at
+ * all if 'visit' is NULL. Only objects in the other banks of the
+ * frame are copied. '*ptrp' must point to the start of an object
+ * allocated from the frame or to memory outside the frame. It is set
+ * to NULL, if the object could not be copied. Called by the
+ * visitors while frame_swap evacuates the kept objects. */
+static inline void
+frame_evacuate(frame_evacuation_t* ev, void** ptrp, frame_visit_func_t visit)
 {
-    frame_allocator_t* allocator;
-    unsigned char* area = MALLOC(frame_size << 1);
+    frame_allocator_t* allocator = ev->allocator;
+    unsigned char* obj = *ptrp;
+    int bank = frame_bank_of(allocator, obj);
 
-    if (!area)
-        return 1;
+    if (bank < 0 || bank == allocator->bank)
+        return;
 
-    /* Initialize bank 0 */
-    allocator = (frame_allocator_t*)
-            (area + frame_size - sizeof(frame_allocator_t));
-    allocator->fp = (unsigned char*) allocator;
-    allocator->start = area;
-    allocator->size = frame_size;
-    allocator->cleanups = NULL;
-#ifdef FRAME_REALLOC
-    allocator->keeplist = NULL;
-#endif
+    size_t mask = 2 * ev->capacity - 1;
+    size_t slot = frame_ptr_hash(obj) & mask;
 
-    /* Initialize bank 1 */
-    allocator = (frame_allocator_t*)
-            (area + (frame_size << 1) - sizeof(frame_allocator_t));
-    allocator->fp = (unsigned char*) allocator;
-    allocator->start = area;
-    allocator->size = frame_size;
-    allocator->cleanups = NULL;
-#ifdef FRAME_REALLOC
-    allocator->keeplist = NULL;
-#endif
+    for (; ev->capacity && ev->index[slot]; slot = (slot + 1) & mask) {
+        if (ev->objects[ev->index[slot] - 1].from == obj) {
+            *ptrp = ev->objects[ev->index[slot] - 1].to;
+            return;
+        }
+    }
 
-    /* Activate bank 0 */
+    if (ev->count == ev->capacity) {
+        if (frame_evacuation_grow(ev)) {
+            *ptrp = NULL;
+            return;
+        }
+        mask = 2 * ev->capacity - 1;
+        slot = frame_ptr_hash(obj) & mask;
+        while (ev->index[slot])
+            slot = (slot + 1) & mask;
+    }
+
+    void* copy =
 #ifdef FRAME_WITH_CONTEXT
-    *
+            HAS_REALLOC_CLEAN_UP(obj) ?
+            frame_realloc_with_cleanup(allocator, obj, GET_REALLOC_SIZE(obj)) :
+            frame_realloc(allocator, obj, GET_REALLOC_SIZE(obj));
+#else
+            HAS_REALLOC_CLEAN_UP(obj) ?
+            frame_realloc_with_cleanup(obj, GET_REALLOC_SIZE(obj)) :
+            frame_realloc(obj, GET_REALLOC_SIZE(obj));
 #endif
-    _frame_allocator = (frame_allocator_t*)
-            (area + frame_size - sizeof(frame_allocator_t));
 
-    return 0;
+    *ptrp = copy;
+    if (!copy)
+        return;
+
+    ev->objects[ev->count].from = obj;
+    ev->objects[ev->count].to = copy;
+    ev->objects[ev->count].visit = visit;
+    ev->index[slot] = ++ev->count;
+    FRAME_STATS_ADD(allocator, keep_copies, 1);
 }
 
-/* Run the clean up callbacks registered for the frame
- */
+/* Visit the pointers of the objects copied so far. The objects they
+ * point to are appended to the objects to visit, so the loop ends
+ * once the whole graph reachable from the roots has been copied. */
 static inline void
-frame_allocator_clean_up(frame_allocator_t* allocator)
+frame_evacuation_scan(frame_evacuation_t* ev)
 {
-    for (frame_clean_up_cb_list_t* elem = allocator->cleanups;
-         elem; elem = elem->next)
-        if (elem->cb)
-            elem->cb(elem->data);
-
-    allocator->cleanups = NULL;
+    for (size_t i = 0; i < ev->count; i++)
+        if (ev->objects[i].visit)
+            ev->objects[i].visit(ev, ev->objects[i].to);
 }
 
-/* Destroy frame allocator. No more allocations are allowed
- * once this function is called.
- */
+/* Forget the objects copied on the previous swap */
 static inline void
-frame_allocator_destroy(FRAME_CONTEXT_DECLAREV)
+frame_evacuation_reset(frame_evacuation_t* ev, frame_allocator_t* allocator)
 {
-    int bank = !GETBANK(_frame_allocator->fp);
+    ev->allocator = allocator;
+    if (ev->count)
+        BZERO(ev->index, sizeof(size_t) * 2 * ev->capacity);
+    ev->count = 0;
+}
 
-    frame_allocator_t* allocator = frame_allocator_get(FRAME_CONTEXT bank);
-    frame_allocator_clean_up(allocator);
-    allocator = frame_allocator_get(FRAME_CONTEXT !bank);
-    frame_allocator_clean_up(allocator);
+/* Evacuate the object graphs kept with frame_keep_graph in the 'n'
+ * slots at 'slots' */
+static inline void
+frame_keep_evacuate(frame_evacuation_t* ev, frame_keep_slot_t* slots, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        if (slots[i].visit && slots[i].ptrp && slots[i].ptrp != FRAME_KEEP_DISCARDED)
+            frame_evacuate(ev, slots[i].ptrp, slots[i].visit);
+}
+#endif
 
 #ifdef FRAME_REALLOC
-    for (frame_keep_list_t *next, *e = _frame_allocator->keeplist; e; e = next) {
-        next = e->next;
-        FREE(e);
+/* Empty the discarded slots which are followed by an empty slot, so
+ * that discarded pointers do not lengthen the probe sequences. Sets
+ * '*kept' to the number of kept pointers and returns the number of
+ * slots still in use. */
+static inline size_t
+frame_keep_purge(frame_keep_set_t* set, size_t* kept)
+{
+    frame_keep_slot_t* slots = set->slots;
+    size_t used = 0;
+    size_t i = 0;
+
+    *kept = 0;
+    while (i <= set->mask && slots[i].ptrp)
+        i++;
+    if (i > set->mask) {
+        for (i = 0; i <= set->mask; i++)
+            *kept += slots[i].ptrp != FRAME_KEEP_DISCARDED;
+        return set->mask + 1;
     }
-#endif
 
-    FREE(_frame_allocator->start);
+    for (size_t n = 1; n <= set->mask; n++) {
+        size_t j = (i - n) & set->mask;
+
+        if (slots[j].ptrp == FRAME_KEEP_DISCARDED &&
+            !slots[(j + 1) & set->mask].ptrp)
+            slots[j].ptrp = NULL;
+        if (slots[j].ptrp)
+            used++;
+        if (slots[j].ptrp && slots[j].ptrp != FRAME_KEEP_DISCARDED)
+            (*kept)++;
+    }
+
+    return used;
 }
 
-/* Allocate space from the current frame. Returns NULL,
- * if the frame is full. */
-static inline void*
-frame_malloc(FRAME_CONTEXT_DECLARE size_t size)
+/* Get the number of slots in use in an overflow chunk */
+static inline size_t
+frame_keep_chunk_count(frame_keep_chunk_t* chunk)
 {
-    unsigned char* orig;
-    unsigned char* newp;
+    return chunk->count < FRAME_KEEP_CHUNK_SLOTS ? chunk->count : FRAME_KEEP_CHUNK_SLOTS;
+}
 
-    do {
-        orig = _frame_allocator->fp;
-        newp = UNTAG(orig) - size - REALLOC_HEADER_SIZE;
-        if (newp < _frame_allocator->start)
-            return NULL;
-    } while (!CAS(&_frame_allocator->fp,
-                  &orig,
-                  SETBANK(newp, GETBANK(orig))));
+/* Get a chunk for the pointers which find no free slot near their
+ * home slot. The chunks stored after the first table are taken
+ * first. Returns NULL, if out of memory. */
+static inline frame_keep_chunk_t*
+frame_keep_chunk_alloc(frame_keep_set_t* set)
+{
+    frame_keep_chunk_t* chunk;
+    size_t i = set->pooled < FRAME_KEEP_CHUNKS ? FETCH_ADD(&set->pooled, 1) :
+                                                 FRAME_KEEP_CHUNKS;
 
-    SET_REALLOC_SIZE(newp, size);
+    if (i < FRAME_KEEP_CHUNKS)
+        chunk = &frame_keep_pool(set)[i];
+    else if (!(chunk = (frame_keep_chunk_t*) frame_area_alloc(sizeof(frame_keep_chunk_t))))
+        return NULL;
+    BZERO(chunk, sizeof(frame_keep_chunk_t));
 
-    return newp + REALLOC_HEADER_SIZE;
+    return chunk;
 }
 
-/* Allocate space from the current frame. Returns NULL,
- * if the frame is full. The memory is cleared. */
-static inline void*
-frame_malloc0(FRAME_CONTEXT_DECLARE size_t size)
+/* Release the overflow chunks of the keep set */
+static inline void
+frame_keep_chunks_free(frame_keep_set_t* set)
 {
-    void* p = frame_malloc(FRAME_CONTEXT size);
+    frame_keep_chunk_t* pool = frame_keep_pool(set);
+    frame_keep_chunk_t* next;
 
-    if (!p)
-        return NULL;
-
-    BZERO(p, size);
+    for (frame_keep_chunk_t* chunk = set->overflow; chunk; chunk = next) {
+        next = chunk->next;
+        if (chunk < pool || chunk >= pool + FRAME_KEEP_CHUNKS)
+            frame_area_free((unsigned char*) chunk, sizeof(frame_keep_chunk_t));
+    }
+    set->overflow = NULL;
+    set->pooled = 0;
+}
 
-    return p;
+/* Release the table of the keep set, unless it is the first one */
+static inline void
+frame_keep_table_free(frame_keep_set_t* set)
+{
+    if (set->slots != frame_keep_first(set))
+        frame_area_free((unsigned char*) set->slots,
+                        sizeof(frame_keep_slot_t) * (set->mask + 1));
 }
 
-#ifdef FRAME_REALLOC
+/* Store the kept pointer of 'slot' in the table 'slots' of 'size'
+ * slots. Returns 1, if it would be stored too far from its home
+ * slot. */
+static inline int
+frame_keep_place(frame_keep_slot_t* slots, size_t size, frame_keep_slot_t* slot)
+{
+    size_t j = frame_ptr_hash(slot->ptrp) & (size - 1);
+
+    for (size_t n = 0; n < FRAME_KEEP_PROBES; n++) {
+        if (!slots[j].ptrp) {
+            slots[j] = *slot;
+            slots[j].more = NULL;
+            return 0;
+        }
+        j = (j + 1) & (size - 1);
+    }
 
-/* Reallocate space from the current frame. Returns NULL,
- * if the frame is full. The old content is copied to new
- * location. Note that if you have registered a clean up
- * callback use fraem_realloc_with_cleanup instead.
- */
-static inline void*
-frame_realloc(FRAME_CONTEXT_DECLARE void* ptr, size_t size)
+    return 1;
+}
+
+/* Move the kept pointers of the table and of the overflow chunks to
+ * the new table 'slots' of 'size' slots, leaving the discarded ones
+ * out. Returns 1, if some pointer would be stored too far from its
+ * home slot. */
+static inline int
+frame_keep_fill(frame_keep_set_t* set, frame_keep_slot_t* slots, size_t size)
 {
-    unsigned old_size = GET_REALLOC_SIZE(ptr);
+    BZERO(slots, sizeof(frame_keep_slot_t) * size);
 
-    if (frame_get_bank_by_ptr(FRAME_CONTEXT ptr) == (int) GETBANK(_frame_allocator->fp) &&
-        old_size >= size)
-        return ptr;
+    for (size_t i = 0; i <= set->mask; i++) {
+        void** ptrp = set->slots[i].ptrp;
 
-    void* newp = frame_malloc(FRAME_CONTEXT size);
-    if (!newp)
-        return NULL;
+        if (ptrp && ptrp != FRAME_KEEP_DISCARDED &&
+            frame_keep_place(slots, size, &set->slots[i]))
+            return 1;
+    }
+    for (frame_keep_chunk_t* chunk = set->overflow; chunk; chunk = chunk->next) {
+        for (size_t i = 0; i < frame_keep_chunk_count(chunk); i++) {
+            void** ptrp = chunk->slots[i].ptrp;
+
+            if (ptrp && ptrp != FRAME_KEEP_DISCARDED &&
+                frame_keep_place(slots, size, &chunk->slots[i]))
+                return 1;
+        }
+    }
 
-    memcpy(newp, ptr, old_size);
+    return 0;
+}
 
-    return newp;
+/* Purge the keep set and, if there are pointers in the overflow
+ * chunks or the table is three quarters full, move the pointers to
+ * a new table. The table is grown until all kept pointers take at
+ * most half of it, and doubled until each of them is stored near
+ * its home slot, but at most to eight slots per kept pointer or
+ * twice its size. If that is not enough or out of memory, the table
+ * and the chunks are left as they are. Run by frame_swap, while no
+ * pointers are being kept. */
+static inline void
+frame_keep_tidy(frame_keep_set_t* set)
+{
+    size_t kept;
+    size_t size = set->mask + 1;
+    size_t used = frame_keep_purge(set, &kept);
+
+    if (!set->overflow && used <= size / 4 * 3)
+        return;
+
+    for (frame_keep_chunk_t* chunk = set->overflow; chunk; chunk = chunk->next)
+        kept += frame_keep_chunk_count(chunk);
+
+    size_t max = 8 * kept > 2 * size ? 8 * kept : 2 * size;
+
+    if (max > SIZE_MAX / sizeof(frame_keep_slot_t))
+        max = SIZE_MAX / sizeof(frame_keep_slot_t);
+    while (size / 2 < kept)
+        size *= 2;
+
+    for (; size <= max; size *= 2) {
+        frame_keep_slot_t* slots = (frame_keep_slot_t*)
+                frame_area_alloc(sizeof(frame_keep_slot_t) * size);
+
+        if (!slots)
+            return;
+        if (!frame_keep_fill(set, slots, size)) {
+            frame_keep_table_free(set);
+            set->slots = slots;
+            set->mask = size - 1;
+            frame_keep_chunks_free(set);
+            return;
+        }
+        frame_area_free((unsigned char*) slots, sizeof(frame_keep_slot_t) * size);
+    }
 }
+#endif
+
+#ifdef FRAME_REALLOC
+/* Copy the objects kept with frame_keep_ptr in 'slots' from 'first'
+ * to 'last' to the bank 'allocator'. */
+static inline void
+frame_keep_copy(frame_allocator_t* allocator, frame_keep_slot_t* slots,
+                size_t first, size_t last)
+{
+    (void) allocator;
 
+    for (size_t i = first; i < last; i++) {
+        void** ptrp = slots[i].ptrp;
+
+        if (!ptrp || ptrp == FRAME_KEEP_DISCARDED)
+            continue;
+#ifdef FRAME_EVACUATE
+        if (slots[i].visit)
+            continue;
+#endif
+        *ptrp = slots[i].copy_func ?
+                slots[i].copy_func(*ptrp) :
+#ifdef FRAME_WITH_CONTEXT
+                frame_realloc(allocator, *ptrp, GET_REALLOC_SIZE(*ptrp));
+#else
+                frame_realloc(*ptrp, GET_REALLOC_SIZE(*ptrp));
+#endif
+        FRAME_STATS_ADD(allocator, keep_copies, 1);
+    }
+}
 #endif
 
-/* Allocate space from the current frame and register
- * a callback for clean up. Returns NULL, if the frame
- * is full. */
-static inline void*
-frame_malloc_with_cleanup(FRAME_CONTEXT_DECLARE size_t size, void (*cleanup)(void*))
+#ifdef FRAME_PARALLEL_KEEP
+/* A part of the keep set copied by one thread */
+typedef struct {
+    frame_allocator_t* allocator;
+    size_t first;
+    size_t last;
+} frame_keep_part_t;
+
+/* Copy the objects of a part of the keep set. This is the task run
+ * by FRAME_KEEP_RUN. */
+static inline void
+frame_keep_copy_part(void* arg)
 {
-    unsigned char* orig;
-    unsigned char* newp;
-    frame_clean_up_cb_list_t** cleanups;
+    frame_keep_part_t* part = (frame_keep_part_t*) arg;
 
-    do {
-        cleanups = &_frame_allocator->cleanups;
-        orig = (unsigned char*) _frame_allocator->fp;
-        newp = UNTAG(orig) - size - sizeof(frame_clean_up_cb_list_t)
-               - REALLOC_HEADER_SIZE;
-        if (newp < _frame_allocator->start)
-            return NULL;
-    } while (!CAS(&_frame_allocator->fp,
-                  &orig,
-                  SETBANK(newp, GETBANK(orig))));
+    frame_keep_copy(part->allocator, part->allocator->keepset->slots,
+                    part->first, part->last);
+}
 
-    frame_clean_up_cb_list_t* elem =
-            (frame_clean_up_cb_list_t*) (newp + size + REALLOC_HEADER_SIZE);
-    elem->cb = cleanup;
-    elem->data = newp + REALLOC_HEADER_SIZE;
-    BZERO(newp + REALLOC_HEADER_SIZE, size);
-    do {
-        elem->next = *cleanups;
-    } while (!CAS(cleanups, &elem->next, elem));
+#ifdef FRAME_KEEP_RUN_THREADS
+/* The worker threads of the default FRAME_KEEP_RUN. The parts of a
+ * swap are taken in turn by the swapping thread and the workers,
+ * and the swap returns once the last one has been copied. */
+typedef struct frame_keep_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    frame_keep_part_t* parts;
+    int n;
+    int next;
+    int remaining;
+    int stop;
+    int threads;
+    pthread_t thread[FRAME_KEEP_MAX_THREADS];
+} frame_keep_pool_t;
+
+/* Take the next part not yet taken and copy it. Returns zero, if
+ * there was none. Called with the lock held. */
+static inline int
+frame_keep_pool_step(frame_keep_pool_t* pool)
+{
+    frame_keep_part_t* part;
 
-    SET_REALLOC_SIZE(newp, size);
+    if (pool->next >= pool->n)
+        return 0;
+
+    part = &pool->parts[pool->next++];
+    pthread_mutex_unlock(&pool->lock);
+    frame_keep_copy_part(part);
+    pthread_mutex_lock(&pool->lock);
+    if (!--pool->remaining)
+        pthread_cond_signal(&pool->done);
 
-    return newp + REALLOC_HEADER_SIZE;
+    return 1;
 }
 
-#ifdef FRAME_REALLOC
-/* Rellocate space from the current frame and register
- * a callback for clean up. Returns NULL, if the frame
- * is full. */
 static inline void*
-frame_realloc_with_cleanup(FRAME_CONTEXT_DECLARE void* ptr, size_t size)
+frame_keep_thread(void* arg)
 {
-    int bank = GETBANK(_frame_allocator->fp);
-    unsigned old_size = GET_REALLOC_SIZE(ptr);
-    frame_clean_up_cb_list_t* e = NULL;
-
-    if (frame_get_bank_by_ptr(FRAME_CONTEXT ptr) == bank) {
-        if (old_size >= size)
-            return ptr;
-    } else
-        bank = !bank;
+    frame_keep_pool_t* pool = (frame_keep_pool_t*) arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stop)
+        if (!frame_keep_pool_step(pool))
+            pthread_cond_wait(&pool->start, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+#ifdef FRAME_EPOCH
+    frame_epoch_thread_exit();
+#endif
 
-    frame_allocator_t* allocator = frame_allocator_get(FRAME_CONTEXT bank);
+    return NULL;
+}
 
-    for (e = allocator->cleanups; e; e = e->next) {
-        if (e->data == ptr)
-            break;
-    }
+/* Create the pool and hand it to all banks. Returns NULL, if there
+ * is no memory for it. */
+static inline frame_keep_pool_t*
+frame_keep_pool_create(frame_allocator_t* allocator)
+{
+    frame_keep_pool_t* pool = MALLOC(sizeof(frame_keep_pool_t));
 
-    if (!e)
+    if (!pool)
         return NULL;
 
-    void* newp = frame_malloc_with_cleanup(FRAME_CONTEXT size, e->cb);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->parts = NULL;
+    pool->n = 0;
+    pool->next = 0;
+    pool->remaining = 0;
+    pool->stop = 0;
+    pool->threads = 0;
+    for (int bank = 0; bank < FRAME_BANKS; bank++)
+        frame_allocator_at(allocator->start, allocator->size, bank)->keep_pool = pool;
+
+    return pool;
+}
 
-    if (!newp)
-        return NULL;
+/* Stop the workers and free the pool */
+static inline void
+frame_keep_pool_destroy(frame_keep_pool_t* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->threads; i++)
+        pthread_join(pool->thread[i], NULL);
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    FREE(pool);
+}
 
-    memcpy(newp, ptr, old_size);
-    e->cb = NULL;
-    e->data = NULL;
+/* The default way to run the parts. The swapping thread and up to
+ * n - 1 workers copy them. The workers are started on the first swap
+ * which needs them and then wait for the next one. Without workers
+ * the swapping thread copies all parts itself. */
+static inline void
+frame_keep_run(void (*task)(void*), frame_keep_part_t* parts, int n)
+{
+    frame_allocator_t* allocator = parts[0].allocator;
+    frame_keep_pool_t* pool = allocator->keep_pool;
+
+    (void) task;
+    if (!pool && !(pool = frame_keep_pool_create(allocator))) {
+        for (int i = 0; i < n; i++)
+            frame_keep_copy_part(&parts[i]);
+        return;
+    }
 
-    return newp;
+    while (pool->threads < n - 1 &&
+           !pthread_create(&pool->thread[pool->threads], NULL, frame_keep_thread, pool))
+        pool->threads++;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->parts = parts;
+    pool->n = n;
+    pool->next = 0;
+    pool->remaining = n;
+    pthread_cond_broadcast(&pool->start);
+    while (frame_keep_pool_step(pool))
+        ;
+    while (pool->remaining)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pool->n = 0;
+    pthread_mutex_unlock(&pool->lock);
 }
+#endif
 
+/* Set the number of threads which copy the kept objects on
+ * frame_swap. One copies them in the swapping thread only. */
+static inline void
+frame_set_keep_threads(FRAME_CONTEXT_DECLARE int threads)
+{
+    if (threads < 1)
+        threads = 1;
+    if (threads > FRAME_KEEP_MAX_THREADS)
+        threads = FRAME_KEEP_MAX_THREADS;
+    for (int bank = 0; bank < FRAME_BANKS; bank++)
+        frame_allocator_get(FRAME_CONTEXT bank)->keep_threads = threads;
+}
 #endif
 
-/* Swaps the current frame. Clears the frame which
- * will become the current frame if 'clear' is true.
- * Note that there needs to be some time between
+/* Swaps the current frame. Advances to the next bank
+ * in the ring and clears it if 'clear' is true.
+ * Without FRAME_EPOCH there needs to be some time between
  * frame swaps to ensure that all threads have
  * been scheduled to finish frame_malloc_with_cleanup
  * if the thread's time slice happed to run out
- * between the two CAS operations. Typically this is
- * not an issue, however.
+ * between the allocation and the registration of the
+ * clean up. With FRAME_EPOCH the
+ * swap waits for the threads still allocating from or
+ * pinning the bank to be cleared.
  *
  * Use just one thread to master frame swapping.
- * The memory area allocated before two
+ * The memory area allocated before FRAME_BANKS
  * previous swaps must no longer be accessed. For
- * example,
+ * example, with two banks
  *
  * frame_swap(true);
  * int* a = frame_malloc(sizeof(int));
@@ -415,80 +3241,339 @@ frame_realloc_with_cleanup(FRAME_CONTEXT_DECLARE void* ptr, size_t size)
  * *c = 4; // ok
  * *b = 5; // ok
  * *a = 6; // NOT OK, var 'a' is "freed"
+ *
+ * With FRAME_ASYNC_CLEAN_UP the bank to be cleared on the next
+ * swap is retired here and its clean ups are run in the background,
+ * so the memory is valid for FRAME_BANKS - 2 previous swaps only.
  */
 static inline void
 frame_swap(FRAME_CONTEXT_DECLAREP bool clear)
 {
 #ifdef FRAME_WITH_CONTEXT
-    int bank = !GETBANK((*_frame_allocator)->fp);
-    frame_allocator_t* allocator = frame_allocator_get(*_frame_allocator, bank);
+    frame_allocator_t* current = *_frame_allocator;
 #else
-    int bank = !GETBANK(_frame_allocator->fp);
-    frame_allocator_t* allocator = frame_allocator_get(FRAME_CONTEXT bank);
+    frame_allocator_t* current = _frame_allocator;
 #endif
+    int bank = (current->bank + 1) % FRAME_BANKS;
+    frame_allocator_t* allocator = frame_allocator_at(current->start,
+                                                      current->size, bank);
 
     LOGGER_DEBUG("Using bank: %d\n", bank);
 
-#ifdef FRAME_REALLOC
-    allocator->keeplist = frame_allocator_get(FRAME_CONTEXT !bank)->keeplist;
-    /* Take copy of objects marked to be kept */
-    frame_keep_list_t** prev = NULL;
-    frame_keep_list_t* next;
-    for (frame_keep_list_t* e = allocator->keeplist; e; e = next) {
-        next = e->next;
-        if (!e->ptrp) {
-            if (prev == NULL)
-                allocator->keeplist = next;
-            else
-                *prev = next;
-            FREE(e);
-        } else {
-            *e->ptrp = e->copy_func ?
-                    e->copy_func(*e->ptrp) :
-                    frame_realloc(*e->ptrp, GET_REALLOC_SIZE(*e->ptrp));
-           prev = &e->next;
-       }
-    }
+#ifdef FRAME_STATS
+    size_t used = frame_bank_used(current);
+    frame_stats_history_t* history = (frame_stats_history_t*)
+            (current->stats + FRAME_STATS_SHARDS);
+
+    if (used > current->high_water)
+        current->high_water = used;
+    history->used[history->count++ % FRAME_STATS_HISTORY] = used;
+#endif
+
+#ifdef FRAME_ADAPTIVE
+    frame_adaptive_record(current);
+#endif
+
+#ifdef FRAME_SWAP_TIMING
+    frame_swap_timer_t timer;
+    frame_swap_timer_start(&timer, current->generation + 1);
 #endif
 
+#ifdef FRAME_ASYNC_CLEAN_UP
+    frame_clean_up_wait_bank(allocator);
+#endif
+    FRAME_SWAP_PHASE(&timer, FRAME_SWAP_WAIT);
     if (clear) {
+#ifdef FRAME_EPOCH
+        frame_epoch_wait(allocator);
+        FRAME_SWAP_PHASE(&timer, FRAME_SWAP_WAIT);
+#endif
         frame_allocator_clean_up(allocator);
-        allocator->fp = SETBANK(allocator, bank);
+        FRAME_SWAP_PHASE(&timer, FRAME_SWAP_CLEAN_UP);
+#ifdef FRAME_ADAPTIVE
+        frame_spill_free(allocator);
+        frame_adaptive_resize(allocator);
+#endif
+        frame_bank_decommit(allocator);
+        allocator->fp = frame_bank_base(allocator);
+#ifdef FRAME_TLAB
+        allocator->tlab_generation = frame_tlab_next_generation();
+#endif
+        FRAME_SWAP_PHASE(&timer, FRAME_SWAP_RESET);
     }
+    allocator->generation = current->generation + 1;
+#ifdef FRAME_EPOCH
+    FENCE();
+    allocator->recycling = 0;
+#endif
 
 #ifdef FRAME_WITH_CONTEXT
     *
 #endif
     _frame_allocator = allocator;
+    FRAME_SWAP_PHASE(&timer, FRAME_SWAP_PUBLISH);
+
+#ifdef FRAME_ASYNC_CLEAN_UP
+    if (clear)
+        frame_clean_up_start(frame_allocator_at(current->start, current->size,
+                                                (bank + 1) % FRAME_BANKS));
+    FRAME_SWAP_PHASE(&timer, FRAME_SWAP_CLEAN_UP);
+#endif
+
+#ifdef FRAME_REALLOC
+    /* Take copy of objects marked to be kept to the new bank */
+#ifdef FRAME_PARALLEL_KEEP
+    frame_keep_part_t parts[FRAME_KEEP_MAX_THREADS];
+    size_t slots = allocator->keepset->mask + 1;
+    int n = allocator->keep_threads;
+
+    for (int i = 0; i < n; i++) {
+        parts[i].allocator = allocator;
+        parts[i].first = slots / n * i;
+        parts[i].last = i == n - 1 ? slots : slots / n * (i + 1);
+    }
+    if (n > 1)
+        FRAME_KEEP_RUN(frame_keep_copy_part, parts, n);
+    else
+        frame_keep_copy_part(&parts[0]);
+#else
+    frame_keep_copy(allocator, allocator->keepset->slots, 0,
+                    allocator->keepset->mask + 1);
+#endif
+    for (frame_keep_chunk_t* chunk = allocator->keepset->overflow; chunk; chunk = chunk->next)
+        frame_keep_copy(allocator, chunk->slots, 0, frame_keep_chunk_count(chunk));
+#ifdef FRAME_EVACUATE
+    frame_evacuation_reset(allocator->evacuation, allocator);
+    frame_keep_evacuate(allocator->evacuation, allocator->keepset->slots,
+                        allocator->keepset->mask + 1);
+    for (frame_keep_chunk_t* chunk = allocator->keepset->overflow; chunk; chunk = chunk->next)
+        frame_keep_evacuate(allocator->evacuation, chunk->slots,
+                            frame_keep_chunk_count(chunk));
+    frame_evacuation_scan(allocator->evacuation);
+#endif
+    frame_keep_tidy(allocator->keepset);
+    FRAME_SWAP_PHASE(&timer, FRAME_SWAP_KEEP);
+#endif
+
+#ifdef FRAME_SWAP_TIMING
+    frame_swap_timer_stop(allocator->swap_log, &timer);
+#endif
+}
+
+#ifdef FRAME_SWAP_TIMING
+/* Copy the records of up to 'n' most recent swaps to 'records', the
+ * oldest first. Can be called while the frame is being swapped; the
+ * records overwritten during the copy are left out. Returns the
+ * number of records copied. */
+static inline size_t
+frame_swap_log(FRAME_CONTEXT_DECLARE frame_swap_record_t* records, size_t n)
+{
+    frame_swap_log_t* log = _frame_allocator->swap_log;
+    size_t head = log->head;
+
+    ACQUIRE_FENCE();
+    if (n > head)
+        n = head;
+    if (n > FRAME_SWAP_LOG_SIZE)
+        n = FRAME_SWAP_LOG_SIZE;
+    for (size_t i = 0; i < n; i++)
+        records[i] = log->records[(head - n + i) & (FRAME_SWAP_LOG_SIZE - 1)];
+    ACQUIRE_FENCE();
+
+    /* The swap in progress may be overwriting one more record */
+    size_t written = log->head + 1;
+    size_t first = written > FRAME_SWAP_LOG_SIZE ? written - FRAME_SWAP_LOG_SIZE : 0;
+    size_t lost = first > head - n ? first - (head - n) : 0;
+
+    if (lost >= n)
+        return 0;
+    for (size_t i = lost; i < n; i++)
+        records[i - lost] = records[i];
+
+    return n - lost;
+}
+
+/* Summarize the durations of a phase of all swaps so far. The
+ * histogram is read without stopping the swapping thread, so the
+ * summary is not atomic. */
+static inline frame_swap_timing_t
+frame_swap_timing(FRAME_CONTEXT_DECLARE frame_swap_phase_t phase)
+{
+    frame_swap_log_t* log = _frame_allocator->swap_log;
+    static const double percentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    uint64_t* values[4];
+    frame_swap_timing_t timing;
+    size_t seen = 0;
+    int p = 0;
+
+    BZERO(&timing, sizeof(timing));
+    timing.count = log->count[phase];
+    if (!timing.count)
+        return timing;
+    timing.min_ns = log->min[phase];
+    timing.max_ns = log->max[phase];
+    timing.mean_ns = log->sum[phase] / timing.count;
+
+    values[0] = &timing.p50_ns;
+    values[1] = &timing.p90_ns;
+    values[2] = &timing.p99_ns;
+    values[3] = &timing.p999_ns;
+    for (int b = 0; b < FRAME_SWAP_HIST_BUCKETS && p < 4; b++) {
+        seen += log->buckets[phase][b];
+        while (p < 4 && seen >= percentiles[p] * timing.count) {
+            uint64_t value = frame_swap_hist_value(b);
+            *values[p++] = value < timing.max_ns ? value : timing.max_ns;
+        }
+    }
+    while (p < 4)
+        *values[p++] = timing.max_ns;
+
+    return timing;
 }
+#endif
 
 #ifdef FRAME_REALLOC
+/* Claim a slot of an overflow chunk for 'ptrp' and link it to the
+ * home slot 'home'. A new chunk is pushed, when the first one is
+ * used up. Returns NULL, if out of memory. */
+static inline frame_keep_slot_t*
+frame_keep_overflow(frame_keep_set_t* set, frame_keep_slot_t* home, void** ptrp)
+{
+    for (;;) {
+        frame_keep_chunk_t* chunk = set->overflow;
+
+        if (chunk) {
+            size_t i = FETCH_ADD(&chunk->count, 1);
+
+            if (i < FRAME_KEEP_CHUNK_SLOTS) {
+                frame_keep_slot_t* slot = &chunk->slots[i];
+
+                slot->ptrp = ptrp;
+                slot->more = home->more;
+                while (!CAS(&home->more, &slot->more, slot))
+                    ;
+                return slot;
+            }
+        }
+
+        frame_keep_chunk_t* next = frame_keep_chunk_alloc(set);
+
+        if (!next)
+            return NULL;
+        next->next = chunk;
+        while (!CAS(&set->overflow, &next->next, next))
+            ;
+    }
+}
+
+/* Find the slot of 'ptrp', if it is kept, or claim a free slot near
+ * its home slot, or a slot of an overflow chunk, if there is none.
+ * A pointer kept again gets the slot it has. The same pointer must
+ * not be kept by two threads at the same time, as it could then get
+ * two slots. Returns NULL, if out of memory. */
+static inline frame_keep_slot_t*
+frame_keep_slot(frame_allocator_t* allocator, void** ptrp)
+{
+    frame_keep_set_t* set = allocator->keepset;
+    frame_keep_slot_t* slots = set->slots;
+    size_t home = frame_keep_hash(set, ptrp);
+
+    for (;;) {
+        frame_keep_slot_t* empty = NULL;
+        size_t i = home;
+
+        for (size_t n = 0; n < FRAME_KEEP_PROBES && n <= set->mask; n++) {
+            void** p = slots[i].ptrp;
+
+            if (p == ptrp)
+                return &slots[i];
+            if (!empty && (!p || p == FRAME_KEEP_DISCARDED))
+                empty = &slots[i];
+            if (!p)
+                break;
+            i = (i + 1) & set->mask;
+        }
+        for (frame_keep_slot_t* slot = slots[home].more; slot; slot = slot->more)
+            if (slot->ptrp == ptrp)
+                return slot;
+        if (!empty)
+            return frame_keep_overflow(set, &slots[home], ptrp);
+
+        void** expected = empty->ptrp;
+
+        if ((!expected || expected == FRAME_KEEP_DISCARDED) &&
+            CAS(&empty->ptrp, &expected, ptrp))
+            return empty;
+    }
+}
+
+/* Register the object at '*ptrp' to be copied to the new bank on
+ * each frame_swap. '*ptrp' is updated to point to the copy. The copy
+ * is taken with 'copy_func', or with frame_realloc if it is NULL.
+ * Safe to call concurrently from several threads, but not while the
+ * frame is being swapped. Returns 1, if out of memory. */
 static inline int
-frame_keep_ptr(void** ptrp, void* (*copy_func)(void*))
+frame_keep_ptr(FRAME_CONTEXT_DECLARE void** ptrp, void* (*copy_func)(void*))
 {
-    frame_keep_list_t* elem = MALLOC(sizeof(frame_keep_list_t));
-    frame_keep_list_t* list;
+    frame_keep_slot_t* slot = frame_keep_slot(_frame_allocator, ptrp);
 
-    if (!elem)
+    if (!slot)
         return 1;
 
-    elem->ptrp = ptrp;
-    elem->copy_func = copy_func;
-    do {
-        list = _frame_allocator->keeplist;
-        elem->next = list;
-    } while (!CAS(&_frame_allocator->keeplist, &list, elem));
+    slot->copy_func = copy_func;
+#ifdef FRAME_EVACUATE
+    slot->visit = NULL;
+#endif
+
+    return 0;
+}
+
+#ifdef FRAME_EVACUATE
+/* Register the object at '*ptrp' as the root of an object graph to
+ * be copied to the new bank on each frame_swap. 'visit' visits the
+ * pointers of the root object and may be NULL, if it has none. The
+ * objects reachable from the roots through the visitors are copied
+ * once and the pointers to them are updated. Safe to call
+ * concurrently like frame_keep_ptr. Returns 1, if out of memory. */
+static inline int
+frame_keep_graph(FRAME_CONTEXT_DECLARE void** ptrp, frame_visit_func_t visit)
+{
+    frame_keep_slot_t* slot = frame_keep_slot(_frame_allocator, ptrp);
+
+    if (!slot)
+        return 1;
+
+    slot->copy_func = NULL;
+    slot->visit = visit ? visit : frame_visit_none;
 
     return 0;
 }
+#endif
 
+/* Stop copying the object at '*ptrp' to the new bank. The object is
+ * released with its bank later on. Returns 1, if the pointer was not
+ * kept. */
 static inline int
-frame_discard_ptr(void** ptrp)
+frame_discard_ptr(FRAME_CONTEXT_DECLARE void** ptrp)
 {
-    for (frame_keep_list_t* e = _frame_allocator->keeplist; e; e = e->next) {
-        if (e->ptrp == ptrp)
-            e->ptrp = NULL;
-                return 0;
+    frame_keep_set_t* set = _frame_allocator->keepset;
+    frame_keep_slot_t* slots = set->slots;
+    size_t home = frame_keep_hash(set, ptrp);
+    size_t i = home;
+
+    for (size_t n = 0; n < FRAME_KEEP_PROBES && n <= set->mask && slots[i].ptrp; n++) {
+        if (slots[i].ptrp == ptrp) {
+            slots[i].ptrp = FRAME_KEEP_DISCARDED;
+            return 0;
+        }
+        i = (i + 1) & set->mask;
+    }
+
+    for (frame_keep_slot_t* slot = slots[home].more; slot; slot = slot->more) {
+        if (slot->ptrp == ptrp) {
+            slot->ptrp = FRAME_KEEP_DISCARDED;
+            return 0;
+        }
     }
 
     return 1;
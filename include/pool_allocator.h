@@ -0,0 +1,517 @@
+/*
+* MIT License
+*
+* Copyright (c) 2020 Jukka-Pekka Iivonen
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+
+#ifndef __POOL_ALLOCATOR_H
+#define __POOL_ALLOCATOR_H
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#ifndef MALLOC
+#define MALLOC(size) malloc(size)
+#endif
+
+
+#ifndef FREE
+#define FREE(ptr) free(ptr)
+#endif
+
+
+#ifdef POOL_WITH_CONTEXT
+# define POOL_CONTEXT_DECLAREP pool_allocator_t** _pool_allocator,
+# define POOL_CONTEXT_DECLAREV pool_allocator_t* _pool_allocator
+# define POOL_CONTEXT_DECLARE POOL_CONTEXT_DECLAREV,
+# define POOL_CONTEXT _pool_allocator,
+# define POOL_CONTEXTV _pool_allocator
+#else
+# define POOL_CONTEXT_DECLAREP
+# define POOL_CONTEXT_DECLAREV
+# define POOL_CONTEXT_DECLARE
+# define POOL_CONTEXT
+# define POOL_CONTEXTV
+#endif
+
+
+/* Debug logger. Compiled away, if NDEBUG is defined. */
+#ifndef LOGGER_DEBUG
+# ifdef NDEBUG
+#  define LOGGER_DEBUG(...) do {} while (0)
+# else
+#  include <stdio.h>
+#  define LOGGER_DEBUG(...) printf(__VA_ARGS__)
+# endif
+#endif
+
+
+/* Compare and swap method */
+#ifndef CAS
+#include <stdatomic.h>
+#define CAS(destp,origp,newval)                                \
+    atomic_compare_exchange_weak(destp,origp,newval)
+#endif
+
+
+/* Compare and swap method for 64 bit integers. The head of the
+ * free list is swapped with it. */
+#ifndef CAS_U64
+#include <stdatomic.h>
+#define CAS_U64(destp,origp,newval)                            \
+    atomic_compare_exchange_weak(destp,origp,newval)
+#endif
+
+
+/* bzero method */
+#ifndef BZERO
+#include <strings.h>
+#define BZERO(p,size) bzero(p,size)
+#endif
+
+
+/* Thread local storage class */
+#ifndef THREAD_LOCAL
+#define THREAD_LOCAL _Thread_local
+#endif
+
+
+/* Size of a cache line. The contended fields of the allocator
+ * are kept on separate cache lines. */
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+
+/* Minimum alignment of the objects. By default every object is
+ * suitably aligned for any type. */
+#ifndef POOL_MIN_ALIGN
+#include <stddef.h>
+#define POOL_MIN_ALIGN _Alignof(max_align_t)
+#endif
+
+
+/* Alignment helpers. The alignment must be a power of two. */
+#ifndef ROUND_UP
+#define ROUND_UP(n,align)                                      \
+    (((n) + (align) - 1) & ~((size_t) (align) - 1))
+#endif
+#ifndef ALIGN_DOWN
+#define ALIGN_DOWN(ptr,align)                                  \
+    ((unsigned char*) ((uintptr_t) (ptr) & ~((uintptr_t) (align) - 1)))
+#endif
+#ifndef ALIGN_UP
+#define ALIGN_UP(ptr,align)                                    \
+    ALIGN_DOWN(((unsigned char*) (ptr)) + (align) - 1, align)
+#endif
+
+
+/* Define POOL_MAGAZINE if you want each thread to keep a magazine
+ * of up to POOL_MAGAZINE_SIZE free objects. The thread allocates
+ * and frees from its magazine without atomic operations and moves
+ * half a magazine at a time from and to the shared free list. A pool
+ * has POOL_MAGAZINES magazines. Threads beyond that use the shared
+ * free list directly. */
+#ifdef POOL_MAGAZINE
+#ifndef POOL_MAGAZINE_SIZE
+#define POOL_MAGAZINE_SIZE 32
+#endif
+#ifndef POOL_MAGAZINES
+#define POOL_MAGAZINES 64
+#endif
+
+/* Magazine of free objects. It is owned by one thread at a time. */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) void* volatile owner;
+    unsigned count;
+    void* objects[POOL_MAGAZINE_SIZE];
+} pool_magazine_t;
+#endif
+
+
+/* Pool allocator data type. The free objects are linked through
+ * their first four bytes by slot numbers. A slot number is the
+ * offset of the object from the start of the pool in units of
+ * POOL_MIN_ALIGN plus one, and zero ends the list. The head of the
+ * list holds the slot of the first free object in its low half and
+ * a version in its high half. The version is bumped on every change,
+ * so a head which was popped and pushed back in between does not
+ * fool a CAS (the ABA problem). Objects never handed out are carved
+ * from the top of the pool downwards. The head and the frame pointer
+ * are modified concurrently, so each has a cache line of its own. */
+typedef struct {
+    volatile uint64_t head;
+    unsigned char _head_pad[CACHE_LINE_SIZE - sizeof(uint64_t)];
+    unsigned char* fp;
+    unsigned char _fp_pad[CACHE_LINE_SIZE - sizeof(unsigned char*)];
+    unsigned char* start;
+    size_t size;
+    size_t object_size;
+    uint32_t slots;
+#ifdef POOL_MAGAZINE
+    uintptr_t generation;
+    pool_magazine_t* magazines;
+    void* magazines_area;
+#endif
+} pool_allocator_t;
+
+
+#ifndef POOL_WITH_CONTEXT
+/* Use DECLARE_POOL_ALLOCATOR() to declare pool allocator
+ * in the source file */
+#define DECLARE_POOL_ALLOCATOR()                                \
+    pool_allocator_t* _pool_allocator
+
+extern DECLARE_POOL_ALLOCATOR();
+#endif
+
+
+#ifdef POOL_MAGAZINE
+/* Magazine of the calling thread for one pool. A thread keeps
+ * a reference to the magazine of the pool it used last. */
+typedef struct {
+    pool_allocator_t* owner;
+    uintptr_t generation;
+    pool_magazine_t* magazine;
+} pool_magazine_ref_t;
+
+/* Use DECLARE_POOL_MAGAZINE() to declare the magazine references
+ * in one source file */
+#define DECLARE_POOL_MAGAZINE()                                 \
+    THREAD_LOCAL pool_magazine_ref_t _pool_magazine;            \
+    uintptr_t _pool_generation
+
+extern THREAD_LOCAL pool_magazine_ref_t _pool_magazine;
+extern uintptr_t _pool_generation;
+
+/* Get a process wide unique generation number. A magazine reference
+ * is valid only if its generation matches the generation of the
+ * pool. */
+static inline uintptr_t
+pool_next_generation(void)
+{
+    uintptr_t orig;
+
+    do {
+        orig = _pool_generation;
+    } while (!CAS(&_pool_generation, &orig, orig + 1));
+
+    return orig + 1;
+}
+#endif
+
+
+/* Get the object of a slot */
+static inline void*
+pool_object(pool_allocator_t* allocator, uint32_t slot)
+{
+    return allocator->start + (size_t) (slot - 1) * POOL_MIN_ALIGN;
+}
+
+/* Get the slot of an object */
+static inline uint32_t
+pool_slot(pool_allocator_t* allocator, void* ptr)
+{
+    return (uint32_t) (((unsigned char*) ptr - allocator->start) / POOL_MIN_ALIGN) + 1;
+}
+
+/* Initialize pool allocator for objects of 'object_size' bytes
+ * with the given pool size. */
+static inline int
+pool_allocator_init(POOL_CONTEXT_DECLAREP size_t object_size, size_t pool_size)
+{
+    pool_allocator_t* allocator;
+
+    object_size = ROUND_UP(object_size < sizeof(uint32_t) ? sizeof(uint32_t) : object_size,
+                           POOL_MIN_ALIGN);
+    if (pool_size < sizeof(pool_allocator_t) + CACHE_LINE_SIZE + object_size ||
+        pool_size / POOL_MIN_ALIGN >= UINT32_MAX)
+        return 1;
+
+    unsigned char* area = MALLOC(pool_size);
+
+    if (!area)
+        return 1;
+
+    allocator = (pool_allocator_t*)
+            ALIGN_DOWN(area + pool_size - sizeof(pool_allocator_t), CACHE_LINE_SIZE);
+    allocator->head = 0;
+    allocator->fp = (unsigned char*) allocator;
+    allocator->start = area;
+    allocator->size = pool_size;
+    allocator->object_size = object_size;
+    allocator->slots = pool_slot(allocator, allocator);
+#ifdef POOL_MAGAZINE
+    allocator->magazines_area = MALLOC(sizeof(pool_magazine_t) * (POOL_MAGAZINES + 1));
+    if (!allocator->magazines_area) {
+        FREE(area);
+        return 1;
+    }
+    allocator->magazines = (pool_magazine_t*)
+            ALIGN_UP(allocator->magazines_area, CACHE_LINE_SIZE);
+    BZERO(allocator->magazines, sizeof(pool_magazine_t) * POOL_MAGAZINES);
+    allocator->generation = pool_next_generation();
+#endif
+
+#ifdef POOL_WITH_CONTEXT
+    *
+#endif
+    _pool_allocator = allocator;
+
+    return 0;
+}
+
+/* Destroy pool allocator. All objects are released at once. No more
+ * allocations are allowed once this function is called. */
+static inline void
+pool_allocator_destroy(POOL_CONTEXT_DECLAREV)
+{
+#ifdef POOL_MAGAZINE
+    FREE(_pool_allocator->magazines_area);
+#endif
+    FREE(_pool_allocator->start);
+}
+
+/* Pop up to n objects from the shared free list. The chain is read
+ * before the CAS, and the version of the head tells whether it was
+ * changed in between. The slots read from objects which were taken
+ * meanwhile may be garbage, so they are checked to stay in the pool.
+ * Returns the number of objects. */
+static inline unsigned
+pool_pop_shared(pool_allocator_t* allocator, void** objects, unsigned n)
+{
+    uint64_t head = allocator->head;
+    unsigned count;
+
+    for (;;) {
+        uint32_t slot = (uint32_t) head;
+
+        for (count = 0; slot && slot < allocator->slots && count < n; count++) {
+            objects[count] = pool_object(allocator, slot);
+            slot = *(volatile uint32_t*) objects[count];
+        }
+        if (!count)
+            return 0;
+        if (slot >= allocator->slots)
+            head = allocator->head;
+        else if (CAS_U64(&allocator->head, &head,
+                         slot | (((head >> 32) + 1) << 32)))
+            return count;
+    }
+}
+
+/* Push n objects to the shared free list with one CAS */
+static inline void
+pool_push_shared(pool_allocator_t* allocator, void** objects, unsigned n)
+{
+    uint64_t first = pool_slot(allocator, objects[0]);
+    uint64_t head = allocator->head;
+
+    for (unsigned i = 0; i + 1 < n; i++)
+        *(volatile uint32_t*) objects[i] = pool_slot(allocator, objects[i + 1]);
+
+    do {
+        *(volatile uint32_t*) objects[n - 1] = (uint32_t) head;
+    } while (!CAS_U64(&allocator->head, &head,
+                      first | (((head >> 32) + 1) << 32)));
+}
+
+/* Carve up to n objects never handed out from the top of the pool
+ * with one CAS. Returns the number of objects. */
+static inline unsigned
+pool_carve(pool_allocator_t* allocator, void** objects, unsigned n)
+{
+    unsigned char* fp = allocator->fp;
+    size_t count;
+
+    do {
+        count = (size_t) (fp - allocator->start) / allocator->object_size;
+        if (count > n)
+            count = n;
+        if (!count)
+            return 0;
+    } while (!CAS(&allocator->fp, &fp, fp - count * allocator->object_size));
+
+    for (size_t i = 0; i < count; i++)
+        objects[i] = fp - (i + 1) * allocator->object_size;
+
+    return (unsigned) count;
+}
+
+/* Reserve up to n objects from the free list, or from the top of
+ * the pool if the list is empty. Returns the number of objects. */
+static inline unsigned
+pool_reserve(pool_allocator_t* allocator, void** objects, unsigned n)
+{
+    unsigned count = pool_pop_shared(allocator, objects, n);
+
+    if (count)
+        return count;
+
+    return pool_carve(allocator, objects, n);
+}
+
+#ifdef POOL_MAGAZINE
+/* Find the magazine of the calling thread, or claim a free one. The
+ * address of the magazine reference identifies the thread. Returns
+ * NULL, if all magazines are taken. */
+static inline pool_magazine_t*
+pool_magazine_claim(pool_allocator_t* allocator)
+{
+    void* self = &_pool_magazine;
+    pool_magazine_t* magazine = NULL;
+
+    for (unsigned i = 0; i < POOL_MAGAZINES && !magazine; i++)
+        if (allocator->magazines[i].owner == self)
+            magazine = &allocator->magazines[i];
+
+    for (unsigned i = 0; i < POOL_MAGAZINES && !magazine; i++) {
+        void* owner = NULL;
+
+        if (!allocator->magazines[i].owner &&
+            CAS(&allocator->magazines[i].owner, &owner, self))
+            magazine = &allocator->magazines[i];
+    }
+
+    _pool_magazine.owner = allocator;
+    _pool_magazine.generation = allocator->generation;
+    _pool_magazine.magazine = magazine;
+
+    return magazine;
+}
+
+/* Get the magazine of the calling thread */
+static inline pool_magazine_t*
+pool_magazine(pool_allocator_t* allocator)
+{
+    if (_pool_magazine.owner == allocator &&
+        _pool_magazine.generation == allocator->generation)
+        return _pool_magazine.magazine;
+
+    return pool_magazine_claim(allocator);
+}
+
+/* Return the objects in the magazine of the calling thread to the
+ * shared free list and give up the magazine. Call this before a
+ * thread exits, so that its objects can be reused by others. */
+static inline void
+pool_magazine_release(POOL_CONTEXT_DECLAREV)
+{
+    if (_pool_magazine.owner != _pool_allocator ||
+        _pool_magazine.generation != _pool_allocator->generation)
+        return;
+
+    pool_magazine_t* magazine = _pool_magazine.magazine;
+
+    _pool_magazine.owner = NULL;
+    if (!magazine)
+        return;
+
+    if (magazine->count)
+        pool_push_shared(_pool_allocator, magazine->objects, magazine->count);
+    magazine->count = 0;
+    magazine->owner = NULL;
+}
+#endif
+
+/* Allocate an object from the pool. Returns NULL, if the pool is
+ * full. */
+static inline void*
+pool_malloc(POOL_CONTEXT_DECLAREV)
+{
+    void* ptr;
+
+#ifdef POOL_MAGAZINE
+    pool_magazine_t* magazine = pool_magazine(_pool_allocator);
+
+    if (magazine) {
+        if (!magazine->count) {
+            magazine->count = pool_reserve(_pool_allocator, magazine->objects,
+                                           POOL_MAGAZINE_SIZE / 2);
+            if (!magazine->count)
+                return NULL;
+        }
+        return magazine->objects[--magazine->count];
+    }
+#endif
+
+    if (!pool_reserve(_pool_allocator, &ptr, 1))
+        return NULL;
+
+    return ptr;
+}
+
+static inline void*
+pool_malloc0(POOL_CONTEXT_DECLAREV)
+{
+    void* ptr = pool_malloc(POOL_CONTEXTV);
+
+    if (!ptr)
+        return NULL;
+
+    BZERO(ptr, _pool_allocator->object_size);
+
+    return ptr;
+}
+
+/* Return an object to the pool. Any thread may free any object. */
+static inline void
+pool_free(POOL_CONTEXT_DECLARE void* ptr)
+{
+    if (!ptr)
+        return;
+
+#ifdef POOL_MAGAZINE
+    pool_magazine_t* magazine = pool_magazine(_pool_allocator);
+
+    if (magazine) {
+        if (magazine->count == POOL_MAGAZINE_SIZE) {
+            magazine->count -= POOL_MAGAZINE_SIZE / 2;
+            pool_push_shared(_pool_allocator, magazine->objects + magazine->count,
+                             POOL_MAGAZINE_SIZE / 2);
+        }
+        magazine->objects[magazine->count++] = ptr;
+        return;
+    }
+#endif
+
+    pool_push_shared(_pool_allocator, &ptr, 1);
+}
+
+/* Release all objects of the pool at once. No thread may use the
+ * pool at the same time. */
+static inline void
+pool_allocator_clear(POOL_CONTEXT_DECLAREV)
+{
+    _pool_allocator->head = 0;
+    _pool_allocator->fp = (unsigned char*) _pool_allocator;
+#ifdef POOL_MAGAZINE
+    for (unsigned i = 0; i < POOL_MAGAZINES; i++)
+        _pool_allocator->magazines[i].count = 0;
+    _pool_allocator->generation = pool_next_generation();
+#endif
+}
+
+#endif /* guard */
@@ -46,33 +46,49 @@
 # define REGION_CONTEXT_DECLAREV region_allocator_t* _region_allocator
 # define REGION_CONTEXT_DECLARE REGION_CONTEXT_DECLAREV,
 # define REGION_CONTEXT _region_allocator,
+# define REGION_CONTEXTV _region_allocator
 #else
 # define REGION_CONTEXT_DECLAREP
 # define REGION_CONTEXT_DECLAREV
 # define REGION_CONTEXT_DECLARE
 # define REGION_CONTEXT
+# define REGION_CONTEXTV
 #endif
 
 
 /* Define REGION_REALLOC if you want to be able to reallocate
- * objects. */
+ * objects. The size of the object is stored in front of it. The
+ * lowest bit tells whether a clean up record follows the object. */
 #ifdef REGION_REALLOC
 #include <string.h>
 # define REALLOC_HEADER_SIZE                        \
-         (sizeof(unsigned))
+         (sizeof(size_t))
+# define REALLOC_FLAG_CLEAN_UP          1
 # define SET_REALLOC_SIZE(ptr,size)                 \
-         *((unsigned*)(ptr)) = (size)
+         *((size_t*)(ptr)) = (size_t) (size) << 1
+# define SET_REALLOC_SIZE_WITH_CLEAN_UP(ptr,size)   \
+         *((size_t*)(ptr)) = ((size_t) (size) << 1) | REALLOC_FLAG_CLEAN_UP
+# define GET_REALLOC_HEADER(ptr)                    \
+         (*((size_t*)(((unsigned char*) (ptr)) - sizeof(size_t))))
 # define GET_REALLOC_SIZE(ptr)                      \
-         (*((unsigned*)(((unsigned char*) (ptr)) - sizeof(unsigned))))
+         (GET_REALLOC_HEADER(ptr) >> 1)
+# define HAS_REALLOC_CLEAN_UP(ptr)                  \
+         (GET_REALLOC_HEADER(ptr) & REALLOC_FLAG_CLEAN_UP)
 #else
 # define REALLOC_HEADER_SIZE            0
 # define SET_REALLOC_SIZE(ptr,size)     do {} while (0)
+# define SET_REALLOC_SIZE_WITH_CLEAN_UP(ptr,size) do {} while (0)
 #endif
 
 
+/* Debug logger. Compiled away, if NDEBUG is defined. */
 #ifndef LOGGER_DEBUG
-# include <stdio.h>
-# define LOGGER_DEBUG(...) printf(__VA_ARGS__)
+# ifdef NDEBUG
+#  define LOGGER_DEBUG(...) do {} while (0)
+# else
+#  include <stdio.h>
+#  define LOGGER_DEBUG(...) printf(__VA_ARGS__)
+# endif
 #endif
 
 
@@ -84,6 +100,23 @@
 #endif
 
 
+/* Fetch and subtract method. Used only with REGION_WAIT_FREE. */
+#if defined(REGION_WAIT_FREE) && !defined(FETCH_SUB)
+#include <stdatomic.h>
+#define FETCH_SUB(destp,val)                                   \
+    atomic_fetch_sub(destp,val)
+#endif
+
+
+/* Fetch and add method. Used only with REGION_STATS and
+ * REGION_WAIT_FREE. */
+#if (defined(REGION_STATS) || defined(REGION_WAIT_FREE)) && !defined(FETCH_ADD)
+#include <stdatomic.h>
+#define FETCH_ADD(destp,val)                                   \
+    atomic_fetch_add_explicit(destp,val,memory_order_relaxed)
+#endif
+
+
 /* bzero method */
 #ifndef BZERO
 #include <strings.h>
@@ -91,6 +124,42 @@
 #endif
 
 
+/* Thread local storage class */
+#ifndef THREAD_LOCAL
+#define THREAD_LOCAL _Thread_local
+#endif
+
+
+/* Size of a cache line. The contended fields of the allocator
+ * are kept on separate cache lines. */
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+
+/* Minimum alignment of allocations. By default every allocation
+ * is suitably aligned for any type. */
+#ifndef REGION_MIN_ALIGN
+#include <stddef.h>
+#define REGION_MIN_ALIGN _Alignof(max_align_t)
+#endif
+
+
+/* Alignment helpers. The alignment must be a power of two. */
+#ifndef ROUND_UP
+#define ROUND_UP(n,align)                                      \
+    (((n) + (align) - 1) & ~((size_t) (align) - 1))
+#endif
+#ifndef ALIGN_DOWN
+#define ALIGN_DOWN(ptr,align)                                  \
+    ((unsigned char*) ((uintptr_t) (ptr) & ~((uintptr_t) (align) - 1)))
+#endif
+#ifndef ALIGN_UP
+#define ALIGN_UP(ptr,align)                                    \
+    ALIGN_DOWN(((unsigned char*) (ptr)) + (align) - 1, align)
+#endif
+
+
 /* We allow registering clean up callbacks to the region */
 typedef struct region_clean_up_cb_list {
     void (*cb)(void*);
@@ -98,15 +167,176 @@ typedef struct region_clean_up_cb_list {
     struct region_clean_up_cb_list* next;
 } region_clean_up_cb_list_t;
 
-/* Region allocator data type */
+/* Define REGION_STATS if you want the region to count allocations,
+ * failures and CAS retries. The counters are split into
+ * REGION_STATS_SHARDS shards on cache lines of their own, and each
+ * thread updates the shard it is mapped to, so that counting does
+ * not become a contention point itself. The bytes in use at the last
+ * REGION_STATS_HISTORY clears are kept as well. */
+#ifdef REGION_STATS
+#ifndef REGION_STATS_SHARDS
+#define REGION_STATS_SHARDS 8
+#endif
+#ifndef REGION_STATS_HISTORY
+#define REGION_STATS_HISTORY 16
+#endif
+
+typedef struct {
+    size_t allocations;
+    size_t bytes;
+    size_t failures;
+    size_t cas_retries;
+    size_t cleanups;
+    unsigned char _pad[CACHE_LINE_SIZE - 5 * sizeof(size_t)];
+} region_stats_shard_t;
+
+/* Snapshot of the statistics returned by region_allocator_stats */
+typedef struct {
+    size_t allocations;     /* successful allocations */
+    size_t bytes;           /* bytes requested by successful allocations */
+    size_t failures;        /* allocations which returned NULL */
+    size_t cas_retries;     /* failed CAS operations while allocating */
+    size_t cleanups;        /* clean up callbacks run */
+    size_t used;            /* bytes in use now */
+    size_t high_water;      /* most bytes in use when cleared */
+    size_t clears;          /* clears done */
+    size_t last_used;       /* bytes in use at the last clear */
+    size_t recent_used[REGION_STATS_HISTORY];
+                            /* bytes in use at the recent clears,
+                             * the latest first */
+} region_stats_t;
+
+/* Bytes in use at the recent clears. Placed after the shards. */
+typedef struct {
+    size_t used[REGION_STATS_HISTORY];
+    size_t count;
+} region_stats_history_t;
+#endif
+
+/* Region allocator data type. The frame pointer and the clean
+ * up list are modified concurrently by allocating threads, so
+ * each of them has a cache line of its own. The rest of the
+ * fields are read mostly. */
 typedef struct {
     unsigned char* fp;
+    unsigned char _fp_pad[CACHE_LINE_SIZE - sizeof(unsigned char*)];
+    region_clean_up_cb_list_t* cleanups;
+    unsigned char _cleanups_pad[CACHE_LINE_SIZE - sizeof(region_clean_up_cb_list_t*)];
     unsigned char* start;
     size_t size;
-    region_clean_up_cb_list_t* cleanups;
+#ifdef REGION_TLAB
+    uintptr_t generation;
+#endif
+#ifdef REGION_GROWABLE
+    void* current;
+    void* next;
+    size_t total;
+    size_t limit;
+#endif
+#ifdef REGION_STATS
+    region_stats_shard_t* stats;
+    void* stats_area;
+    size_t high_water;
+#endif
 } region_allocator_t;
 
 
+#ifdef REGION_STATS
+/* Get the statistics shard of the calling thread. Threads are
+ * mapped to the shards in the order they first update them. */
+static inline unsigned
+region_stats_shard(void)
+{
+    static THREAD_LOCAL unsigned shard;
+    static uintptr_t next_shard;
+    uintptr_t orig;
+
+    if (!shard) {
+        do {
+            orig = next_shard;
+        } while (!CAS(&next_shard, &orig, orig + 1));
+        shard = (unsigned) (orig % REGION_STATS_SHARDS) + 1;
+    }
+
+    return shard - 1;
+}
+
+# define REGION_STATS_ADD(allocator,field,n)                    \
+         ((void) FETCH_ADD(&(allocator)->stats[region_stats_shard()].field, (n)))
+#else
+# define REGION_STATS_ADD(allocator,field,n)    do {} while (0)
+#endif
+
+
+/* Define REGION_GROW_UP if you want the objects to be laid out in
+ * ascending address order. By default the allocator structure is
+ * placed at the end of each block and the frame pointer moves down,
+ * so objects allocated one after another are walked backwards in
+ * memory. With REGION_GROW_UP the structure is placed at the start
+ * of the block and the frame pointer moves up towards its end, which
+ * suits the hardware prefetchers when objects are traversed in the
+ * order they were allocated. */
+
+
+/* Define REGION_GROWABLE if you want the region to link in a new
+ * block when it gets full instead of failing. Each block is
+ * REGION_GROWTH_FACTOR times larger than the previous one, but
+ * not larger than REGION_MAX_BLOCK_SIZE unless a single allocation
+ * needs more. Zero means that block size is not limited. */
+#ifdef REGION_GROWABLE
+#ifndef REGION_GROWTH_FACTOR
+#define REGION_GROWTH_FACTOR 2
+#endif
+#ifndef REGION_MAX_BLOCK_SIZE
+#define REGION_MAX_BLOCK_SIZE 0
+#endif
+#endif
+
+
+/* Define REGION_MMAP if you want the memory of the region to be
+ * mapped with mmap instead of MALLOC. Only address space is reserved
+ * up front and pages are committed when first touched, so a large
+ * region costs nothing until it is used. When the region is cleared,
+ * the used pages below the top REGION_MMAP_KEEP bytes are returned to
+ * the system with madvise(REGION_MMAP_DECOMMIT). Use MADV_FREE to let
+ * the kernel reclaim them lazily. Define REGION_HUGEPAGE to ask for
+ * transparent huge pages, or REGION_HUGETLB to map the region with
+ * huge pages falling back to transparent huge pages if none are
+ * available. */
+#ifdef REGION_MMAP
+#include <sys/mman.h>
+#ifndef REGION_MMAP_KEEP
+#define REGION_MMAP_KEEP (1024 * 1024)
+#endif
+#ifndef REGION_MMAP_DECOMMIT
+#define REGION_MMAP_DECOMMIT MADV_DONTNEED
+#endif
+#ifndef REGION_PAGE_SIZE
+# ifdef REGION_HUGETLB
+#  define REGION_PAGE_SIZE (2 * 1024 * 1024)
+# else
+#  define REGION_PAGE_SIZE 4096
+# endif
+#endif
+#endif
+
+
+/* Define REGION_PREZERO if you want the memory of the region to be
+ * cleared in bulk when it is released instead of piece by piece when
+ * it is allocated. The memory not yet allocated is then always zero,
+ * so region_malloc0 and region_malloc_with_cleanup need not clear it.
+ * The memory used is cleared when the region is cleared or rolled
+ * back, and new blocks are cleared when they are allocated. With
+ * REGION_MMAP the decommitted pages read as zero and are not touched
+ * again, which requires REGION_MMAP_DECOMMIT to be MADV_DONTNEED. An
+ * object shrunk with region_realloc keeps its space. */
+#if defined(REGION_PREZERO) && defined(REGION_MMAP)
+#if REGION_MMAP_DECOMMIT != MADV_DONTNEED
+#error "REGION_PREZERO needs REGION_MMAP_DECOMMIT to be MADV_DONTNEED"
+#endif
+#endif
+
+
 #ifndef REGION_WITH_CONTEXT
 /* Use DECLARE_REGION_ALLOCATOR() to declare region allocator
  * in the source file */
@@ -117,23 +347,249 @@ extern DECLARE_REGION_ALLOCATOR();
 #endif
 
 
+/* Define REGION_TLAB if you want each thread to reserve a chunk
+ * of REGION_TLAB_SIZE bytes from the region at once and allocate
+ * from it without atomic operations. The chunk is refilled only
+ * when it runs out. Each thread also keeps the clean up records
+ * it registers in a list of its own, which is linked to the region
+ * once per generation. */
+#ifdef REGION_TLAB
+#ifndef REGION_TLAB_SIZE
+#define REGION_TLAB_SIZE 4096
+#endif
+
+/* Thread local allocation buffer */
+typedef struct {
+    region_allocator_t* owner;
+    uintptr_t generation;
+    unsigned char* fp;
+    unsigned char* limit;
+    region_clean_up_cb_list_t* cleanups;
+    uintptr_t cleanups_generation;
+} region_tlab_t;
+
+/* Use DECLARE_REGION_TLAB() to declare the thread local buffers
+ * in one source file */
+#define DECLARE_REGION_TLAB()                                   \
+    THREAD_LOCAL region_tlab_t _region_tlab;                    \
+    uintptr_t _region_tlab_generation
+
+extern THREAD_LOCAL region_tlab_t _region_tlab;
+extern uintptr_t _region_tlab_generation;
+
+/* Get a process wide unique generation number. A thread local
+ * buffer is valid only if its generation matches the generation
+ * of the region. */
+static inline uintptr_t
+region_tlab_next_generation(void)
+{
+    uintptr_t orig;
+
+    do {
+        orig = _region_tlab_generation;
+    } while (!CAS(&_region_tlab_generation, &orig, orig + 1));
+
+    return orig + 1;
+}
+
+/* Marks the record which links the clean up list of a thread to
+ * the region. The data of the record is the head of the list. */
+static inline void
+region_clean_up_thread_list(void* list)
+{
+    (void) list;
+}
+#endif
+
+
+/* Get memory for a block of the region. Returns NULL, if out of
+ * memory. */
+static inline unsigned char*
+region_area_alloc(size_t size)
+{
+#ifdef REGION_MMAP
+    void* area = MAP_FAILED;
+
+    size = ROUND_UP(size, REGION_PAGE_SIZE);
+#if defined(REGION_HUGETLB) && defined(MAP_HUGETLB)
+    area = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (area == MAP_FAILED) {
+        area = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (area == MAP_FAILED)
+            return NULL;
+#if (defined(REGION_HUGEPAGE) || defined(REGION_HUGETLB)) && defined(MADV_HUGEPAGE)
+        madvise(area, size, MADV_HUGEPAGE);
+#endif
+    }
+
+    return area;
+#else
+    unsigned char* area = MALLOC(size);
+
+#ifdef REGION_PREZERO
+    if (area)
+        BZERO(area, size);
+#endif
+
+    return area;
+#endif
+}
+
+/* Release memory of a block of the region */
+static inline void
+region_area_free(unsigned char* area, size_t size)
+{
+#ifdef REGION_MMAP
+    munmap(area, ROUND_UP(size, REGION_PAGE_SIZE));
+#else
+    (void) size;
+    FREE(area);
+#endif
+}
+
+/* Get the initial frame pointer of a block. */
+static inline unsigned char*
+region_block_base(region_allocator_t* block)
+{
+#ifdef REGION_GROW_UP
+    return ALIGN_UP(block + 1, REGION_MIN_ALIGN);
+#else
+    return (unsigned char*) block;
+#endif
+}
+
+/* Get the end of the block the frame pointer moves towards. */
+static inline unsigned char*
+region_block_limit(region_allocator_t* block)
+{
+#ifdef REGION_GROW_UP
+    return block->start + block->size;
+#else
+    return block->start;
+#endif
+}
+
+/* Get the number of bytes used in a block. The frame pointer
+ * may have overrun the limit, if the block is full. */
+static inline size_t
+region_block_used(region_allocator_t* block)
+{
+    unsigned char* fp = block->fp;
+    unsigned char* limit = region_block_limit(block);
+
+#ifdef REGION_GROW_UP
+    if (fp > limit)
+        fp = limit;
+    return (size_t) (fp - region_block_base(block));
+#else
+    if (fp < limit)
+        fp = limit;
+    return (size_t) (region_block_base(block) - fp);
+#endif
+}
+
+/* Move the frame pointer 'fp' by 'size' bytes towards 'limit'. The
+ * object is aligned to 'align' and preceded by 'header' bytes, which
+ * are taken from the space the alignment skips where possible.
+ * Returns the object and stores the new frame pointer to 'newfp', or
+ * returns NULL, if there is not enough space left. */
+static inline unsigned char*
+region_bump(unsigned char* fp, unsigned char* limit, size_t size, size_t align,
+            size_t header, unsigned char** newfp)
+{
+#ifdef REGION_GROW_UP
+    if (fp > limit || (size_t) (limit - fp) < header)
+        return NULL;
+
+    unsigned char* p = ALIGN_UP(fp + header, align);
+
+    if (p > limit || (size_t) (limit - p) < size)
+        return NULL;
+    *newfp = p + size;
+
+    return p;
+#else
+    if (fp < limit || (size_t) (fp - limit) < size)
+        return NULL;
+
+    unsigned char* p = ALIGN_DOWN(fp - size, align);
+
+    if (p < limit || (size_t) (p - limit) < header)
+        return NULL;
+    *newfp = p - header;
+
+    return p;
+#endif
+}
+
+/* Initialize the allocator structure of a memory block. It is
+ * placed at the end of the block aligned to a cache line, or at
+ * the start of it with REGION_GROW_UP. */
+static inline region_allocator_t*
+region_block_init(unsigned char* area, size_t size)
+{
+#ifdef REGION_GROW_UP
+    region_allocator_t* allocator = (region_allocator_t*)
+            ALIGN_UP(area, CACHE_LINE_SIZE);
+#else
+    region_allocator_t* allocator = (region_allocator_t*)
+            ((uintptr_t) (area + size - sizeof(region_allocator_t)) &
+             ~((uintptr_t) CACHE_LINE_SIZE - 1));
+#endif
+
+    allocator->start = area;
+    allocator->size = size;
+    allocator->fp = region_block_base(allocator);
+    allocator->cleanups = NULL;
+#ifdef REGION_GROWABLE
+    allocator->current = allocator;
+    allocator->next = NULL;
+    allocator->total = size;
+    allocator->limit = 0;
+#endif
+#ifdef REGION_STATS
+    allocator->stats = NULL;
+    allocator->stats_area = NULL;
+    allocator->high_water = 0;
+#endif
+
+    return allocator;
+}
+
 /* Initialize region allocator with the given size. */
 static inline int
 region_allocator_init(REGION_CONTEXT_DECLAREP size_t region_size)
 {
     region_allocator_t* allocator;
-    unsigned char* area = MALLOC(region_size);
+
+    if (region_size < sizeof(region_allocator_t) + CACHE_LINE_SIZE)
+        return 1;
+
+    unsigned char* area = region_area_alloc(region_size);
 
     if (!area)
         return 1;
 
-    /* Initialize bank 0 */
-    allocator = (region_allocator_t*)
-            (area + region_size - sizeof(region_allocator_t));
-    allocator->fp = (unsigned char*) allocator;
-    allocator->start = area;
-    allocator->size = region_size;
-    allocator->cleanups = NULL;
+    allocator = region_block_init(area, region_size);
+#ifdef REGION_STATS
+    allocator->stats_area = MALLOC(sizeof(region_stats_shard_t) *
+                                   (REGION_STATS_SHARDS + 1) +
+                                   sizeof(region_stats_history_t));
+    if (!allocator->stats_area) {
+        region_area_free(area, region_size);
+        return 1;
+    }
+    allocator->stats = (region_stats_shard_t*)
+            ALIGN_UP(allocator->stats_area, CACHE_LINE_SIZE);
+    BZERO(allocator->stats, sizeof(region_stats_shard_t) * REGION_STATS_SHARDS +
+                            sizeof(region_stats_history_t));
+#endif
+#ifdef REGION_TLAB
+    allocator->generation = region_tlab_next_generation();
+#endif
 
 #ifdef REGION_WITH_CONTEXT
     *
@@ -143,16 +599,35 @@ region_allocator_init(REGION_CONTEXT_DECLAREP size_t region_size)
     return 0;
 }
 
+/* Run the clean up callbacks of the list from 'elem' up to 'stop'.
+ * The lists of the threads are run where they are linked in. */
+static inline void
+region_clean_up_run(region_allocator_t* allocator,
+                    region_clean_up_cb_list_t* elem,
+                    region_clean_up_cb_list_t* stop)
+{
+    (void) allocator;
+
+    for (; elem != stop; elem = elem->next) {
+#ifdef REGION_TLAB
+        if (elem->cb == region_clean_up_thread_list) {
+            region_clean_up_run(allocator, elem->data, NULL);
+            continue;
+        }
+#endif
+        if (elem->cb) {
+            elem->cb(elem->data);
+            REGION_STATS_ADD(allocator, cleanups, 1);
+        }
+    }
+}
+
 /* Run the clean up callbacks registered for the region
  */
 static inline void
 region_allocator_clean_up(region_allocator_t* allocator)
 {
-    for (region_clean_up_cb_list_t* elem = allocator->cleanups;
-         elem; elem = elem->next)
-        if (elem->cb)
-            elem->cb(elem->data);
-
+    region_clean_up_run(allocator, allocator->cleanups, NULL);
     allocator->cleanups = NULL;
 }
 
@@ -164,29 +639,271 @@ region_allocator_destroy(REGION_CONTEXT_DECLAREV)
 {
     region_allocator_clean_up(_region_allocator);
 
-    FREE(_region_allocator->start);
+#ifdef REGION_GROWABLE
+    region_allocator_t* next;
+    for (region_allocator_t* block = _region_allocator->next; block; block = next) {
+        next = block->next;
+        region_area_free(block->start, block->size);
+    }
+#endif
+
+#ifdef REGION_STATS
+    FREE(_region_allocator->stats_area);
+#endif
+    region_area_free(_region_allocator->start, _region_allocator->size);
 }
 
-/* Allocate space from the current region. Returns NULL,
- * if the region is full. */
-static inline void*
-region_malloc(REGION_CONTEXT_DECLARE size_t size)
+/* Reserve space directly from the shared frame pointer of
+ * the region. The returned address is aligned to 'align'.
+ * Returns NULL, if the region is full.
+ *
+ * With REGION_WAIT_FREE the frame pointer is moved with a single
+ * fetch and subtract instead of a CAS loop. The size and the header
+ * are rounded up to REGION_MIN_ALIGN so that the frame pointer stays
+ * aligned. Larger alignments are handled by reserving extra space. Requests
+ * larger than the space left fail without moving the pointer.
+ * Requests which find the pointer past the limit undo their own
+ * move. The thread which took it past the limit tries once to move
+ * it back. If others have moved it meanwhile, the region is left
+ * full until it is cleared, which wastes less than that request.
+ */
+static inline unsigned char*
+region_reserve_shared(region_allocator_t* allocator, size_t size, size_t align,
+                      size_t header)
 {
+    unsigned char* limit = region_block_limit(allocator);
+
+#if defined(REGION_WAIT_FREE) && defined(REGION_GROW_UP)
+    unsigned char* orig = allocator->fp;
+
+    if (orig > limit || size > (size_t) (limit - orig) ||
+        header > (size_t) (limit - orig) || align > (size_t) (limit - orig))
+        return NULL;
+    size = ROUND_UP(size, REGION_MIN_ALIGN) + ROUND_UP(header, REGION_MIN_ALIGN) +
+           align - REGION_MIN_ALIGN;
+    if (size > (size_t) (limit - orig))
+        return NULL;
+
+    orig = FETCH_ADD(&allocator->fp, size);
+    unsigned char* newp = orig + size;
+
+    if (orig > limit) {
+        /* Another thread is past the limit */
+        FETCH_SUB(&allocator->fp, size);
+        return NULL;
+    }
+    if ((size_t) (limit - orig) < size) {
+        /* Retry only if the CAS failed spuriously */
+        while (!CAS(&allocator->fp, &newp, orig) && newp == orig + size)
+            ;
+        return NULL;
+    }
+
+    return ALIGN_UP(orig + header, align);
+#elif defined(REGION_WAIT_FREE)
+    unsigned char* orig = allocator->fp;
+
+    if (orig < limit || size > (size_t) (orig - limit) ||
+        header > (size_t) (orig - limit) || align > (size_t) (orig - limit))
+        return NULL;
+    size = ROUND_UP(size, REGION_MIN_ALIGN) + ROUND_UP(header, REGION_MIN_ALIGN) +
+           align - REGION_MIN_ALIGN;
+    if (size > (size_t) (orig - limit))
+        return NULL;
+
+    orig = FETCH_SUB(&allocator->fp, size);
+    unsigned char* newp = orig - size;
+
+    if (orig < limit) {
+        /* Another thread is past the limit */
+        FETCH_ADD(&allocator->fp, size);
+        return NULL;
+    }
+    if ((size_t) (orig - limit) < size) {
+        /* Retry only if the CAS failed spuriously */
+        while (!CAS(&allocator->fp, &newp, orig) && newp == orig - size)
+            ;
+        return NULL;
+    }
+
+    return ALIGN_UP(newp + header, align);
+#else
     unsigned char* orig;
-    unsigned char* newp;
+    unsigned char* newfp;
+    unsigned char* p;
+
+    for (;;) {
+        orig = allocator->fp;
+        p = region_bump(orig, limit, size, align, header, &newfp);
+        if (!p)
+            return NULL;
+        if (CAS(&allocator->fp, &orig, newfp))
+            break;
+        REGION_STATS_ADD(allocator, cas_retries, 1);
+    }
+
+    return p;
+#endif
+}
+
+#ifdef REGION_GROWABLE
+/* Link a new block to the region after 'full' has run out of
+ * space. The block is large enough to hold 'size' bytes. Only
+ * one of the threads racing to grow the region succeeds, others
+ * free their block and retry with the winner's block. Returns
+ * zero, if the region could not be grown or no block can hold
+ * 'size' bytes. */
+static inline int
+region_grow(region_allocator_t* allocator, region_allocator_t* full, size_t size)
+{
+    /* The size of the block would wrap around */
+    if (size > SIZE_MAX / 2)
+        return 0;
+
+    size_t needed = ROUND_UP(size + sizeof(region_allocator_t) + CACHE_LINE_SIZE +
+                             REGION_MIN_ALIGN, CACHE_LINE_SIZE);
+    size_t block_size = full->size * REGION_GROWTH_FACTOR;
+    size_t total;
+
+    if (REGION_MAX_BLOCK_SIZE && block_size > REGION_MAX_BLOCK_SIZE)
+        block_size = REGION_MAX_BLOCK_SIZE;
+    if (block_size < needed)
+        block_size = needed;
 
     do {
-        orig = _region_allocator->fp;
-        newp = orig - size - REALLOC_HEADER_SIZE;
-        if (newp < _region_allocator->start)
+        total = allocator->total;
+        if (allocator->limit && total + block_size > allocator->limit) {
+            if (total + needed > allocator->limit)
+                return 0;
+            block_size = allocator->limit - total;
+        }
+    } while (!CAS(&allocator->total, &total, total + block_size));
+
+    unsigned char* area = region_area_alloc(block_size);
+    void* orig = full;
+
+    if (area) {
+        region_allocator_t* block = region_block_init(area, block_size);
+#ifdef REGION_STATS
+        block->stats = allocator->stats;
+#endif
+
+        if (CAS(&allocator->current, &orig, block)) {
+            do {
+                block->next = allocator->next;
+            } while (!CAS(&allocator->next, &block->next, block));
+            return 1;
+        }
+        region_area_free(area, block_size);
+    }
+
+    do {
+        total = allocator->total;
+    } while (!CAS(&allocator->total, &total, total - block_size));
+
+    /* Another thread has linked in a new block */
+    return area && orig != full;
+}
+#endif
+
+/* Reserve space from the current block of the region. With
+ * REGION_GROWABLE a new block is linked in if the current one
+ * is full. Requests too large for any block fail at once. Returns
+ * NULL, if the region is full. */
+static inline unsigned char*
+region_reserve_chained(region_allocator_t* allocator, size_t size, size_t align,
+                       size_t header)
+{
+#ifdef REGION_GROWABLE
+    /* The size of the block needed would wrap around */
+    if (size > SIZE_MAX / 4 || align > SIZE_MAX / 4)
+        return NULL;
+
+    for (;;) {
+        region_allocator_t* block = allocator->current;
+        unsigned char* p = region_reserve_shared(block, size, align, header);
+
+        if (p)
+            return p;
+        if (!region_grow(allocator, block, size + header + align))
             return NULL;
-    } while (!CAS(&_region_allocator->fp,
-                  &orig,
-                  newp));
+    }
+#else
+    return region_reserve_shared(allocator, size, align, header);
+#endif
+}
+
+/* Reserve space from the region. The returned address is aligned
+ * to 'align'. With REGION_TLAB the space is taken from the thread
+ * local buffer, which is refilled from the region when it runs out.
+ * Large requests bypass the buffer. Returns NULL, if the region is
+ * full. */
+static inline unsigned char*
+region_reserve(region_allocator_t* allocator, size_t size, size_t align, size_t header)
+{
+#ifdef REGION_TLAB
+    region_tlab_t* tlab = &_region_tlab;
+    unsigned char* p;
+
+    if (tlab->owner != allocator ||
+        tlab->generation != allocator->generation ||
+        !(p = region_bump(tlab->fp, tlab->limit, size, align, header, &tlab->fp))) {
+        if (size + header + align > (REGION_TLAB_SIZE >> 2))
+            return region_reserve_chained(allocator, size, align, header);
 
-    SET_REALLOC_SIZE(newp, size);
+        unsigned char* chunk = region_reserve_chained(allocator, REGION_TLAB_SIZE,
+                                                     REGION_MIN_ALIGN, 0);
+        if (!chunk)
+            return region_reserve_chained(allocator, size, align, header);
 
-    return newp + REALLOC_HEADER_SIZE;
+        tlab->owner = allocator;
+        tlab->generation = allocator->generation;
+#ifdef REGION_GROW_UP
+        tlab->fp = chunk;
+        tlab->limit = chunk + REGION_TLAB_SIZE;
+#else
+        tlab->fp = chunk + REGION_TLAB_SIZE;
+        tlab->limit = chunk;
+#endif
+        p = region_bump(tlab->fp, tlab->limit, size, align, header, &tlab->fp);
+    }
+
+    return p;
+#else
+    return region_reserve_chained(allocator, size, align, header);
+#endif
+}
+
+/* Allocate space aligned to 'align' from the current region.
+ * The alignment must be a power of two. Returns NULL, if the
+ * region is full. */
+static inline void*
+region_malloc_aligned(REGION_CONTEXT_DECLARE size_t size, size_t align)
+{
+    if (align < REGION_MIN_ALIGN)
+        align = REGION_MIN_ALIGN;
+
+    unsigned char* newp = region_reserve(_region_allocator, size, align,
+                                         REALLOC_HEADER_SIZE);
+
+    if (!newp) {
+        REGION_STATS_ADD(_region_allocator, failures, 1);
+        return NULL;
+    }
+
+    REGION_STATS_ADD(_region_allocator, allocations, 1);
+    REGION_STATS_ADD(_region_allocator, bytes, size);
+    SET_REALLOC_SIZE(newp - REALLOC_HEADER_SIZE, size);
+
+    return newp;
+}
+
+/* Allocate space from the current region. Returns NULL,
+ * if the region is full. */
+static inline void*
+region_malloc(REGION_CONTEXT_DECLARE size_t size)
+{
+    return region_malloc_aligned(REGION_CONTEXT size, REGION_MIN_ALIGN);
 }
 
 /* Allocate space from the current region. Returns NULL,
@@ -199,13 +916,162 @@ region_malloc0(REGION_CONTEXT_DECLARE size_t size)
     if (!p)
         return NULL;
 
+#ifndef REGION_PREZERO
     BZERO(p, size);
+#endif
 
     return p;
 }
 
 #ifdef REGION_REALLOC
 
+/* Resize the object at 'ptr' in place, if it is the most recent
+ * allocation at the frame pointer at 'fpp'. With REGION_GROW_UP the
+ * object simply ends at a new address. Otherwise the end of the
+ * object stays where it is and its start moves down to grow and up
+ * to shrink, so the content is moved with memmove but no space is
+ * wasted. The frame pointer is moved with a CAS, so another thread
+ * allocating in between makes the resize fail. Returns NULL, if the
+ * object could not be resized in place. */
+static inline unsigned char*
+region_resize_at(unsigned char** fpp, unsigned char* limit, unsigned char* ptr,
+                 size_t old_size, size_t size, size_t align)
+{
+#ifdef REGION_GROW_UP
+    unsigned char* orig = *fpp;
+    unsigned char* expected = orig;
+    unsigned char* end = ptr + old_size;
+    unsigned char* newfp;
+
+    /* With REGION_WAIT_FREE the frame pointer is rounded up */
+    if (orig != end && orig != ALIGN_UP(end, REGION_MIN_ALIGN))
+        return NULL;
+    if (((uintptr_t) ptr & (align - 1)) != 0 || ptr > limit ||
+        (size_t) (limit - ptr) < size)
+        return NULL;
+    newfp = ALIGN_UP(ptr + size, REGION_MIN_ALIGN);
+    if (newfp > limit)
+        return NULL;
+#ifdef REGION_PREZERO
+    /* The memory released would have to be cleared */
+    if (newfp < orig)
+        return NULL;
+#endif
+
+    while (!CAS(fpp, &expected, newfp))
+        if (expected != orig)
+            return NULL;
+    SET_REALLOC_SIZE(ptr - REALLOC_HEADER_SIZE, size);
+
+    return ptr;
+#else
+    unsigned char* orig = *fpp;
+    unsigned char* expected = orig;
+    unsigned char* end = ptr + old_size;
+    unsigned char* newp;
+    unsigned char* newfp;
+
+    /* With REGION_WAIT_FREE the frame pointer is rounded down */
+    if (orig != ptr - REALLOC_HEADER_SIZE &&
+        orig != ALIGN_DOWN(ptr - REALLOC_HEADER_SIZE, REGION_MIN_ALIGN))
+        return NULL;
+    if (orig < limit || (size_t) (end - limit) < size)
+        return NULL;
+    newp = ALIGN_DOWN(end - size, align);
+    if (newp < limit || (size_t) (newp - limit) < REALLOC_HEADER_SIZE)
+        return NULL;
+    newfp = newp - REALLOC_HEADER_SIZE;
+    if (orig != ptr - REALLOC_HEADER_SIZE)
+        newfp = ALIGN_DOWN(newfp, REGION_MIN_ALIGN);
+#ifdef REGION_PREZERO
+    /* The memory released would have to be cleared */
+    if (newp > ptr)
+        return NULL;
+#endif
+
+    if (newp < ptr) {
+        while (!CAS(fpp, &expected, newfp))
+            if (expected != orig)
+                return NULL;
+        memmove(newp, ptr, old_size);
+    } else if (newp > ptr) {
+        memmove(newp, ptr, size);
+        while (!CAS(fpp, &expected, newfp)) {
+            if (expected != orig) {
+                memmove(ptr, newp, size);
+                return NULL;
+            }
+        }
+    }
+    SET_REALLOC_SIZE(newp - REALLOC_HEADER_SIZE, size);
+
+    return newp;
+#endif
+}
+
+/* Resize the object at 'ptr' in place, if it is the most recent
+ * allocation of the thread local buffer or of the current block.
+ * Objects with a clean up record are never resized in place, as
+ * the record follows the object. */
+static inline void*
+region_resize(region_allocator_t* allocator, void* ptr, size_t old_size,
+              size_t size, size_t align)
+{
+    if (HAS_REALLOC_CLEAN_UP(ptr))
+        return NULL;
+
+#ifdef REGION_TLAB
+    region_tlab_t* tlab = &_region_tlab;
+    unsigned char* p;
+
+    if (tlab->owner == allocator &&
+        tlab->generation == allocator->generation &&
+        (p = region_resize_at(&tlab->fp, tlab->limit, ptr, old_size, size, align)))
+        return p;
+#endif
+#ifdef REGION_GROWABLE
+    allocator = allocator->current;
+#endif
+
+    return region_resize_at(&allocator->fp, region_block_limit(allocator), ptr,
+                            old_size, size, align);
+}
+
+/* Reallocate space aligned to 'align' from the current region.
+ * Returns NULL, if the region is full. The most recent allocation
+ * is resized in place and other objects are shrunk in place. Else
+ * the old content is copied to new location. Note that if you have
+ * registered a clean up callback use
+ * region_realloc_aligned_with_cleanup instead.
+ */
+static inline void*
+region_realloc_aligned(REGION_CONTEXT_DECLARE void* ptr, size_t size, size_t align)
+{
+    size_t old_size = GET_REALLOC_SIZE(ptr);
+    void* newp;
+
+    if (align < REGION_MIN_ALIGN)
+        align = REGION_MIN_ALIGN;
+
+    newp = region_resize(_region_allocator, ptr, old_size, size, align);
+    if (newp)
+        return newp;
+
+    if (old_size >= size && ((uintptr_t) ptr & (align - 1)) == 0) {
+        if (!HAS_REALLOC_CLEAN_UP(ptr))
+            SET_REALLOC_SIZE((unsigned char*) ptr - REALLOC_HEADER_SIZE, size);
+        return ptr;
+    }
+
+    newp = region_malloc_aligned(REGION_CONTEXT size, align);
+    if (!newp)
+        return NULL;
+
+    memcpy(newp, ptr, old_size < size ? old_size : size);
+
+    return newp;
+}
+
 /* Reallocate space from the current region. Returns NULL,
  * if the region is full. The old content is copied to new
  * location. Note that if you have registered a clean up
@@ -214,94 +1080,444 @@ region_malloc0(REGION_CONTEXT_DECLARE size_t size)
 static inline void*
 region_realloc(REGION_CONTEXT_DECLARE void* ptr, size_t size)
 {
-    unsigned old_size = GET_REALLOC_SIZE(ptr);
+    return region_realloc_aligned(REGION_CONTEXT ptr, size, REGION_MIN_ALIGN);
+}
 
-    void* newp = region_malloc(REGION_CONTEXT size);
-    if (!newp)
-        return NULL;
+#endif
 
-    memcpy(newp, ptr, old_size);
+/* Link a clean up record to the region. With REGION_TLAB the record
+ * is pushed to the list of the calling thread without atomic
+ * operations. Only the first record of the thread after the region
+ * has been cleared or marked links the list to the region with a
+ * CAS. */
+static inline void
+region_clean_up_push(region_allocator_t* allocator, region_clean_up_cb_list_t* elem)
+{
+    region_clean_up_cb_list_t** cleanups = &allocator->cleanups;
 
-    return newp;
-}
+#ifdef REGION_TLAB
+    region_tlab_t* tlab = &_region_tlab;
+
+    if (tlab->cleanups_generation != allocator->generation) {
+        region_clean_up_cb_list_t* list = (region_clean_up_cb_list_t*)
+                region_reserve(allocator, sizeof(region_clean_up_cb_list_t),
+                               REGION_MIN_ALIGN, 0);
 
+        if (list) {
+            list->cb = region_clean_up_thread_list;
+            list->data = NULL;
+            list->next = *cleanups;
+            while (!CAS(cleanups, &list->next, list))
+                REGION_STATS_ADD(allocator, cas_retries, 1);
+            tlab->cleanups = list;
+            tlab->cleanups_generation = allocator->generation;
+        }
+    }
+    if (tlab->cleanups_generation == allocator->generation) {
+        elem->next = tlab->cleanups->data;
+        tlab->cleanups->data = elem;
+        return;
+    }
 #endif
 
-/* Allocate space from the current region and register
- * a callback for clean up. Returns NULL, if the region
- * is full. */
+    elem->next = *cleanups;
+    while (!CAS(cleanups, &elem->next, elem))
+        REGION_STATS_ADD(allocator, cas_retries, 1);
+}
+
+/* Allocate space aligned to 'align' from the current region and
+ * register a callback for clean up. Returns NULL, if the region
+ * is full. The clean up record is placed after the object. */
 static inline void*
-region_malloc_with_cleanup(REGION_CONTEXT_DECLARE size_t size, void (*cleanup)(void*))
+region_malloc_aligned_with_cleanup(REGION_CONTEXT_DECLARE size_t size, size_t align,
+                                   void (*cleanup)(void*))
 {
-    unsigned char* orig;
-    unsigned char* newp;
-    region_clean_up_cb_list_t** cleanups;
+    if (align < REGION_MIN_ALIGN)
+        align = REGION_MIN_ALIGN;
 
-    do {
-        cleanups = &_region_allocator->cleanups;
-        orig = (unsigned char*) _region_allocator->fp;
-        newp = orig - size - sizeof(region_clean_up_cb_list_t)
-               - REALLOC_HEADER_SIZE;
-        if (newp < _region_allocator->start)
-            return NULL;
-    } while (!CAS(&_region_allocator->fp,
-                  &orig,
-                  newp));
+    size_t elem_offset = ROUND_UP(size, _Alignof(region_clean_up_cb_list_t));
+    /* The record would wrap around with sizes this large */
+    unsigned char* newp = size > SIZE_MAX / 2 ? NULL :
+            region_reserve(_region_allocator,
+                           elem_offset + sizeof(region_clean_up_cb_list_t),
+                           align, REALLOC_HEADER_SIZE);
+
+    if (!newp) {
+        REGION_STATS_ADD(_region_allocator, failures, 1);
+        return NULL;
+    }
+
+    REGION_STATS_ADD(_region_allocator, allocations, 1);
+    REGION_STATS_ADD(_region_allocator, bytes, size);
 
     region_clean_up_cb_list_t* elem =
-            (region_clean_up_cb_list_t*) (newp + size + REALLOC_HEADER_SIZE);
+            (region_clean_up_cb_list_t*) (newp + elem_offset);
     elem->cb = cleanup;
-    elem->data = newp + REALLOC_HEADER_SIZE;
-    BZERO(newp + REALLOC_HEADER_SIZE, size);
-    do {
-        elem->next = *cleanups;
-    } while (!CAS(cleanups, &elem->next, elem));
+    elem->data = newp;
+#ifndef REGION_PREZERO
+    BZERO(newp, size);
+#endif
+    region_clean_up_push(_region_allocator, elem);
+
+    SET_REALLOC_SIZE_WITH_CLEAN_UP(newp - REALLOC_HEADER_SIZE, size);
 
-    SET_REALLOC_SIZE(newp, size);
+    return newp;
+}
 
-    return newp + REALLOC_HEADER_SIZE;
+/* Allocate space from the current region and register
+ * a callback for clean up. Returns NULL, if the region
+ * is full. */
+static inline void*
+region_malloc_with_cleanup(REGION_CONTEXT_DECLARE size_t size, void (*cleanup)(void*))
+{
+    return region_malloc_aligned_with_cleanup(REGION_CONTEXT size, REGION_MIN_ALIGN,
+                                              cleanup);
 }
 
 #ifdef REGION_REALLOC
-/* Rellocate space from the current region and register
- * a callback for clean up. Returns NULL, if the region
+/* Get the clean up record of an object. The record follows the
+ * object, so it is found from the size of the object. Returns NULL,
+ * if the object was allocated without a clean up callback. */
+static inline region_clean_up_cb_list_t*
+region_clean_up_record(void* ptr)
+{
+    if (!HAS_REALLOC_CLEAN_UP(ptr))
+        return NULL;
+
+    return (region_clean_up_cb_list_t*) ((unsigned char*) ptr +
+            ROUND_UP(GET_REALLOC_SIZE(ptr), _Alignof(region_clean_up_cb_list_t)));
+}
+
+/* Rellocate space aligned to 'align' from the current region and
+ * register a callback for clean up. Returns NULL, if the region
  * is full. */
 static inline void*
-region_realloc_with_cleanup(REGION_CONTEXT_DECLARE void* ptr, size_t size)
+region_realloc_aligned_with_cleanup(REGION_CONTEXT_DECLARE void* ptr, size_t size,
+                                    size_t align)
 {
-    unsigned old_size = GET_REALLOC_SIZE(ptr);
-    region_clean_up_cb_list_t* e = NULL;
+    size_t old_size = GET_REALLOC_SIZE(ptr);
+    region_clean_up_cb_list_t* e;
 
-    if (old_size >= size)
+    if (old_size >= size && ((uintptr_t) ptr & (align - 1)) == 0)
         return ptr;
 
-    for (e = _region_allocator->cleanups; e; e = e->next) {
-        if (e->data == ptr)
-            break;
-    }
-
-    if (!e)
+    e = region_clean_up_record(ptr);
+    if (!e || e->data != ptr)
         return NULL;
 
-    void* newp = region_malloc_with_cleanup(REGION_CONTEXT size, e->cb);
+    void* newp = region_malloc_aligned_with_cleanup(REGION_CONTEXT size, align, e->cb);
 
     if (!newp)
         return NULL;
 
-    memcpy(newp, ptr, old_size);
+    memcpy(newp, ptr, old_size < size ? old_size : size);
     e->cb = NULL;
     e->data = NULL;
 
     return newp;
 }
 
+/* Rellocate space from the current region and register
+ * a callback for clean up. Returns NULL, if the region
+ * is full. */
+static inline void*
+region_realloc_with_cleanup(REGION_CONTEXT_DECLARE void* ptr, size_t size)
+{
+    return region_realloc_aligned_with_cleanup(REGION_CONTEXT ptr, size,
+                                               REGION_MIN_ALIGN);
+}
+
 #endif
 
+#ifdef REGION_PREZERO
+/* Clear the memory from 'low' to 'high' except for the pages from
+ * 'skip_low' to 'skip_high', which have been decommitted. */
+static inline void
+region_zero_range(unsigned char* low, unsigned char* high,
+                  unsigned char* skip_low, unsigned char* skip_high)
+{
+    if (skip_low >= skip_high) {
+        if (low < high)
+            BZERO(low, high - low);
+        return;
+    }
+    if (low < skip_low)
+        BZERO(low, (skip_low < high ? skip_low : high) - low);
+    if (skip_high < high) {
+        if (skip_high > low)
+            low = skip_high;
+        BZERO(low, high - low);
+    }
+}
+
+/* Clear the memory allocated from the block after the frame pointer
+ * was at 'mark'. */
+static inline void
+region_block_zero(region_allocator_t* block, unsigned char* mark)
+{
+#ifdef REGION_GROW_UP
+    unsigned char* fp = block->fp;
+
+    if (fp > region_block_limit(block))
+        fp = region_block_limit(block);
+    region_zero_range(mark, fp, NULL, NULL);
+#else
+    unsigned char* fp = block->fp;
+
+    if (fp < region_block_limit(block))
+        fp = region_block_limit(block);
+    region_zero_range(fp, mark, NULL, NULL);
+#endif
+}
+#endif
+
+/* Return the pages of the block used since the last clear to the
+ * system, except for the first REGION_MMAP_KEEP bytes from the
+ * initial frame pointer. With REGION_PREZERO the rest of the memory
+ * used is cleared. Must be called before the frame pointer is
+ * reset. */
+static inline void
+region_block_decommit(region_allocator_t* block)
+{
+#if defined(REGION_MMAP) && defined(REGION_GROW_UP)
+    unsigned char* base = region_block_base(block);
+    unsigned char* end = block->start + block->size;
+    unsigned char* high = block->fp;
+    unsigned char* low = ALIGN_UP(base + REGION_MMAP_KEEP, REGION_PAGE_SIZE);
+
+    if (high > end)
+        high = end;
+#ifdef REGION_PREZERO
+    unsigned char* used = high;
+#endif
+    high = ALIGN_UP(high, REGION_PAGE_SIZE);
+    if (high > ALIGN_DOWN(end, REGION_PAGE_SIZE))
+        high = ALIGN_DOWN(end, REGION_PAGE_SIZE);
+    if ((size_t) (end - base) > REGION_MMAP_KEEP && low < high)
+        madvise(low, high - low, REGION_MMAP_DECOMMIT);
+    else
+        low = high = NULL;
+#ifdef REGION_PREZERO
+    region_zero_range(base, used, low, high);
+#endif
+#elif defined(REGION_MMAP)
+    unsigned char* top = (unsigned char*) block;
+    unsigned char* low = block->fp;
+    unsigned char* high = ALIGN_DOWN(top - REGION_MMAP_KEEP, REGION_PAGE_SIZE);
+
+    if (low < block->start)
+        low = block->start;
+#ifdef REGION_PREZERO
+    unsigned char* used = low;
+#endif
+    low = ALIGN_DOWN(low, REGION_PAGE_SIZE);
+    if (low < ALIGN_UP(block->start, REGION_PAGE_SIZE))
+        low = ALIGN_UP(block->start, REGION_PAGE_SIZE);
+    if ((size_t) (top - block->start) > REGION_MMAP_KEEP && low < high)
+        madvise(low, high - low, REGION_MMAP_DECOMMIT);
+    else
+        low = high = NULL;
+#ifdef REGION_PREZERO
+    region_zero_range(used, top, low, high);
+#endif
+#elif defined(REGION_PREZERO)
+    region_block_zero(block, region_block_base(block));
+#else
+    (void) block;
+#endif
+}
+
+#ifdef REGION_GROWABLE
+/* Limit the total memory of a growable region to 'limit' bytes.
+ * Zero means no limit. */
+static inline void
+region_allocator_set_limit(REGION_CONTEXT_DECLARE size_t limit)
+{
+    _region_allocator->limit = limit;
+}
+
+/* Free all blocks but the initial one and the largest one. The
+ * largest block becomes the current block. */
+static inline void
+region_allocator_shrink(region_allocator_t* allocator)
+{
+    region_allocator_t* largest = allocator;
+    region_allocator_t* next;
+
+    for (region_allocator_t* block = allocator->next; block; block = block->next)
+        if (block->size > largest->size)
+            largest = block;
+
+    for (region_allocator_t* block = allocator->next; block; block = next) {
+        next = block->next;
+        if (block != largest)
+            region_area_free(block->start, block->size);
+    }
+
+    allocator->total = allocator->size;
+    allocator->next = NULL;
+    if (largest != allocator) {
+        region_block_decommit(largest);
+        largest->fp = region_block_base(largest);
+        largest->next = NULL;
+        allocator->next = largest;
+        allocator->total += largest->size;
+    }
+    allocator->current = largest;
+}
+#endif
+
+/* Get the number of bytes in use in the region. With REGION_TLAB
+ * this includes the unused parts of the thread local buffers. */
+static inline size_t
+region_allocator_used(REGION_CONTEXT_DECLAREV)
+{
+    region_allocator_t* block = _region_allocator;
+    size_t used = 0;
+
+    while (block) {
+        used += region_block_used(block);
+#ifdef REGION_GROWABLE
+        block = block->next;
+#else
+        block = NULL;
+#endif
+    }
+
+    return used;
+}
+
+#ifdef REGION_STATS
+/* Get a snapshot of the statistics of the region. The counters
+ * are read without stopping the allocating threads, so the
+ * snapshot is not atomic. */
+static inline region_stats_t
+region_allocator_stats(REGION_CONTEXT_DECLAREV)
+{
+    region_stats_t stats;
+
+    BZERO(&stats, sizeof(stats));
+    for (int i = 0; i < REGION_STATS_SHARDS; i++) {
+        region_stats_shard_t* shard = &_region_allocator->stats[i];
+        stats.allocations += shard->allocations;
+        stats.bytes += shard->bytes;
+        stats.failures += shard->failures;
+        stats.cas_retries += shard->cas_retries;
+        stats.cleanups += shard->cleanups;
+    }
+    stats.used = region_allocator_used(REGION_CONTEXTV);
+    stats.high_water = _region_allocator->high_water;
+
+    region_stats_history_t* history = (region_stats_history_t*)
+            (_region_allocator->stats + REGION_STATS_SHARDS);
+
+    stats.clears = history->count;
+    for (size_t i = 0; i < REGION_STATS_HISTORY && i < history->count; i++)
+        stats.recent_used[i] =
+                history->used[(history->count - 1 - i) % REGION_STATS_HISTORY];
+    stats.last_used = stats.recent_used[0];
+
+    return stats;
+}
+#endif
+
+/* Release all allocations of the region. With REGION_GROWABLE
+ * only the initial block and the largest block are kept. With
+ * REGION_MMAP the used pages are decommitted. */
 static inline void
 region_allocator_clear(REGION_CONTEXT_DECLAREV)
 {
+#ifdef REGION_STATS
+    size_t used = region_allocator_used(REGION_CONTEXTV);
+    region_stats_history_t* history = (region_stats_history_t*)
+            (_region_allocator->stats + REGION_STATS_SHARDS);
+
+    if (used > _region_allocator->high_water)
+        _region_allocator->high_water = used;
+    history->used[history->count++ % REGION_STATS_HISTORY] = used;
+#endif
     region_allocator_clean_up(_region_allocator);
-    _region_allocator->fp = _region_allocator->start;
+    region_block_decommit(_region_allocator);
+#ifdef REGION_GROWABLE
+    region_allocator_shrink(_region_allocator);
+#endif
+    _region_allocator->fp = region_block_base(_region_allocator);
+#ifdef REGION_TLAB
+    _region_allocator->generation = region_tlab_next_generation();
+#endif
+}
+
+/* Savepoint of the region returned by region_mark */
+typedef struct {
+    unsigned char* fp;
+    region_clean_up_cb_list_t* cleanups;
+#ifdef REGION_GROWABLE
+    region_allocator_t* current;
+    region_allocator_t* next;
+#endif
+} region_mark_t;
+
+/* Get a savepoint of the region. Allocations made after the mark
+ * can be released with region_rollback. With REGION_TLAB the thread
+ * local buffers are retired so that later allocations are taken
+ * below the mark. */
+static inline region_mark_t
+region_mark(REGION_CONTEXT_DECLAREV)
+{
+    region_mark_t mark;
+
+#ifdef REGION_TLAB
+    _region_allocator->generation = region_tlab_next_generation();
+#endif
+#ifdef REGION_GROWABLE
+    mark.current = _region_allocator->current;
+    mark.next = _region_allocator->next;
+    mark.fp = mark.current->fp;
+#else
+    mark.fp = _region_allocator->fp;
+#endif
+    mark.cleanups = _region_allocator->cleanups;
+
+    return mark;
+}
+
+/* Release all allocations made after the mark and run the clean up
+ * callbacks registered after it in reverse order of registration.
+ * Marks can be nested; rolling back to an outer mark releases the
+ * inner ones as well. With REGION_GROWABLE the blocks linked in after
+ * the mark are freed. The region must not be allocated from while
+ * rolling back, so marks are meant to be used by the thread owning
+ * the region. region_allocator_clear invalidates all marks. */
+static inline void
+region_rollback(REGION_CONTEXT_DECLARE region_mark_t mark)
+{
+    region_clean_up_run(_region_allocator, _region_allocator->cleanups,
+                        mark.cleanups);
+    _region_allocator->cleanups = mark.cleanups;
+
+#ifdef REGION_GROWABLE
+    region_allocator_t* next;
+    for (region_allocator_t* block = _region_allocator->next;
+         block != mark.next; block = next) {
+        next = block->next;
+        _region_allocator->total -= block->size;
+        region_area_free(block->start, block->size);
+    }
+    _region_allocator->next = mark.next;
+    _region_allocator->current = mark.current;
+#ifdef REGION_PREZERO
+    region_block_zero(mark.current, mark.fp);
+#endif
+    mark.current->fp = mark.fp;
+#else
+#ifdef REGION_PREZERO
+    region_block_zero(_region_allocator, mark.fp);
+#endif
+    _region_allocator->fp = mark.fp;
+#endif
+#ifdef REGION_TLAB
+    _region_allocator->generation = region_tlab_next_generation();
+#endif
 }
 
 #endif /* guard */
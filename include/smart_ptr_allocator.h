@@ -42,19 +42,98 @@
 #endif
 
 
+/* Minimum alignment of allocations. By default every allocation
+ * is suitably aligned for any type. MALLOC must return memory
+ * aligned at least to this. */
+#ifndef SMART_PTR_MIN_ALIGN
+#include <stddef.h>
+#define SMART_PTR_MIN_ALIGN _Alignof(max_align_t)
+#endif
+
+
+/* Round up to a multiple of align, which is a power of two */
+#ifndef ROUND_UP
+#define ROUND_UP(n,align)                                      \
+    (((n) + (align) - 1) & ~((size_t) (align) - 1))
+#endif
+
+
+/* Control block of an object which supports weak references. It
+ * outlives the object until the last weak reference is dropped.
+ * The strong references of such an object are counted here instead
+ * of in the object header. The strong references together hold one
+ * weak reference. */
+typedef struct {
+    volatile unsigned strong;
+    volatile unsigned weak;
+    void* object;
+} smart_ptr_weak_t;
+
+
+/* The header in front of the object. The reference count is
+ * always right before the object. Its four lowest bits are flags
+ * and the count is stored above them. If the object has a clean
+ * up callback, it is stored in the pointer sized slot before the
+ * reference count. If the object has been aligned more strictly
+ * than SMART_PTR_MIN_ALIGN, the offset to the start of the memory
+ * block is stored before the clean up slot. An object supporting
+ * weak references has all the slots and a pointer to its control
+ * block before them. Objects allocated from the slabs have the
+ * same header as the objects allocated with MALLOC. With biased
+ * reference counting the reference count is preceded by the biased
+ * count, the link of the merge queue and the owner thread. */
+#define REFCOUNT_FLAG_CLEAN_UP    1
+#define REFCOUNT_FLAG_OFFSET      2
+#define REFCOUNT_FLAG_WEAK        4
+#define REFCOUNT_FLAG_SLAB        8
+#define REFCOUNT_FLAG_MERGED      16
+#define REFCOUNT_FLAG_QUEUED      32
+#define REFCOUNT_SHIFT            6
+#define REFCOUNT_ONE              (1 << REFCOUNT_SHIFT)
+#ifdef SMART_PTR_BIASED
+#define REFCOUNT_HEADER_SIZE                       \
+         (2 * sizeof(volatile unsigned) + 2 * sizeof(void*))
+#define GET_BIASP(ptr)                             \
+         ((unsigned*) (((unsigned char*) (ptr)) - 2 * sizeof(volatile unsigned)))
+#define GET_NEXTP(ptr)                             \
+         ((void**) (((unsigned char*) (ptr)) - 2 * sizeof(volatile unsigned) - sizeof(void*)))
+#define GET_OWNERP(ptr)                            \
+         ((smart_ptr_thread_t**) (((unsigned char*) (ptr)) - REFCOUNT_HEADER_SIZE))
+#else
 #define REFCOUNT_HEADER_SIZE                       \
          (sizeof(volatile unsigned))
+#endif
+#define CLEAN_UP_HEADER_SIZE                       \
+         ROUND_UP(REFCOUNT_HEADER_SIZE + sizeof(void (*)(void*)), \
+                  sizeof(void (*)(void*)))
+#define OFFSET_HEADER_SIZE                         \
+         (CLEAN_UP_HEADER_SIZE + sizeof(size_t))
 #define GET_REFCOUNTP(ptr)                         \
          (((volatile unsigned*)(((unsigned char*) (ptr)) - sizeof(volatile unsigned))))
 #define HAS_CLEAN_UP(ptr)                          \
-    (*GET_REFCOUNTP(ptr) & 1)
+    (*GET_REFCOUNTP(ptr) & REFCOUNT_FLAG_CLEAN_UP)
 #define GET_CLEAN_UP(ptr)                          \
-    ((void (**)(void*)) (((unsigned char*) (ptr)) - sizeof(unsigned) - sizeof(void (*)(void*))))
-
-
+    ((void (**)(void*)) (((unsigned char*) (ptr)) - CLEAN_UP_HEADER_SIZE))
+#define HAS_OFFSET(ptr)                            \
+    (*GET_REFCOUNTP(ptr) & REFCOUNT_FLAG_OFFSET)
+#define GET_OFFSETP(ptr)                           \
+    ((size_t*) (((unsigned char*) (ptr)) - OFFSET_HEADER_SIZE))
+#define WEAK_HEADER_SIZE                           \
+         (OFFSET_HEADER_SIZE + sizeof(smart_ptr_weak_t*))
+#define HAS_WEAK(ptr)                              \
+    (*GET_REFCOUNTP(ptr) & REFCOUNT_FLAG_WEAK)
+#define GET_WEAKP(ptr)                             \
+    ((smart_ptr_weak_t**) (((unsigned char*) (ptr)) - WEAK_HEADER_SIZE))
+
+
+/* Debug logger. Compiled away, if NDEBUG is defined. */
 #ifndef LOGGER_DEBUG
-# include <stdio.h>
-# define LOGGER_DEBUG(...) printf(__VA_ARGS__)
+# ifdef NDEBUG
+#  define LOGGER_DEBUG(...) do {} while (0)
+# else
+#  include <stdio.h>
+#  define LOGGER_DEBUG(...) printf(__VA_ARGS__)
+# endif
 #endif
 
 
@@ -66,6 +145,41 @@
 #endif
 
 
+/* Compare and swap method for pointers */
+#ifndef CAS
+#include <stdatomic.h>
+#define CAS(destp,origp,newval)                                     \
+    atomic_compare_exchange_weak(destp,origp,newval)
+#endif
+
+
+/* Methods to add to and subtract from the reference counts. They
+ * return the previous value. With SMART_PTR_SINGLE_THREADED the
+ * counts are updated without atomic operations. */
+#ifdef SMART_PTR_SINGLE_THREADED
+#define REFCOUNT_ADD(destp,val) ((*(destp) += (val)) - (val))
+#define REFCOUNT_SUB(destp,val) ((*(destp) -= (val)) + (val))
+#else
+#ifndef FETCH_ADD_UINT
+#include <stdatomic.h>
+#define FETCH_ADD_UINT(destp,val)                                   \
+    atomic_fetch_add_explicit(destp,val,memory_order_relaxed)
+#endif
+#ifndef FETCH_SUB_UINT
+#include <stdatomic.h>
+#define FETCH_SUB_UINT(destp,val)                                   \
+    atomic_fetch_sub_explicit(destp,val,memory_order_acq_rel)
+#endif
+#define REFCOUNT_ADD(destp,val) FETCH_ADD_UINT(destp,val)
+#define REFCOUNT_SUB(destp,val) FETCH_SUB_UINT(destp,val)
+#endif
+
+
+#if defined(SMART_PTR_SINGLE_THREADED) && defined(SMART_PTR_BIASED)
+#error "SMART_PTR_BIASED requires atomic reference counts"
+#endif
+
+
 /* bzero method */
 #ifndef BZERO
 #include <strings.h>
@@ -73,17 +187,389 @@
 #endif
 
 
+/* Thread local storage class */
+#ifndef THREAD_LOCAL
+#define THREAD_LOCAL _Thread_local
+#endif
+
+
+/* With SMART_PTR_SLAB_DEFAULT the objects are allocated from the
+ * slabs by default */
+#if defined(SMART_PTR_SLAB_DEFAULT) && !defined(SMART_PTR_SLAB)
+#define SMART_PTR_SLAB
+#endif
+
+
+#ifdef SMART_PTR_SLAB
+
+/* Method to allocate memory aligned to 'align'. Used only for the
+ * slabs, which are never freed, so it needs no matching free method.
+ * Its memory is never passed to FREE either, so it may come from an
+ * allocator FREE cannot release, such as _aligned_malloc. */
+#ifndef ALIGNED_MALLOC
+#define ALIGNED_MALLOC(align,size) aligned_alloc(align,size)
+#endif
+
+
+/* Size of a slab. It must be a power of two. The slabs are aligned
+ * to their size, so the slab of a block is found from its address. */
+#ifndef SMART_PTR_SLAB_SIZE
+#define SMART_PTR_SLAB_SIZE (64 * 1024)
+#endif
+
+
+/* Largest memory block, header included, allocated from the slabs.
+ * Larger objects are allocated with MALLOC. */
+#ifndef SMART_PTR_SLAB_MAX
+#define SMART_PTR_SLAB_MAX 1024
+#endif
+
+
+/* The size classes are the multiples of SMART_PTR_MIN_ALIGN up to
+ * SMART_PTR_SLAB_MAX */
+#define SMART_PTR_SLAB_CLASSES (SMART_PTR_SLAB_MAX / SMART_PTR_MIN_ALIGN)
+
+
+struct smart_ptr_slab_cache;
+
+/* A slab holds the memory blocks of one size class and is owned by
+ * one thread cache. The owner allocates and frees the blocks without
+ * atomic operations. Other threads push the blocks they free to the
+ * remote list of the slab. The owner takes the list over when it
+ * runs out of free blocks. */
+typedef struct smart_ptr_slab {
+    void* volatile remote;               /* blocks freed by other threads */
+    struct smart_ptr_slab_cache* owner;
+    struct smart_ptr_slab* next;         /* next slab of the size class */
+    unsigned char* top;                  /* first block never handed out */
+    size_t block_size;
+} smart_ptr_slab_t;
+
+#define SMART_PTR_SLAB_HEADER_SIZE                 \
+         ROUND_UP(sizeof(smart_ptr_slab_t), SMART_PTR_MIN_ALIGN)
+
+
+/* Thread cache of free blocks. The free blocks of each size class
+ * are linked through their first word. The cache of an exited thread
+ * is adopted by the next new thread. */
+typedef struct smart_ptr_slab_cache {
+    void* free[SMART_PTR_SLAB_CLASSES];
+    smart_ptr_slab_t* slabs[SMART_PTR_SLAB_CLASSES];
+    struct smart_ptr_slab_cache* next;   /* next cache of exited threads */
+} smart_ptr_slab_cache_t;
+
+
+/* Use DECLARE_SMART_PTR_SLAB() to declare the thread caches in one
+ * source file */
+#define DECLARE_SMART_PTR_SLAB()                                    \
+    THREAD_LOCAL smart_ptr_slab_cache_t* _smart_ptr_slab_cache;     \
+    smart_ptr_slab_cache_t* _smart_ptr_slab_orphans;                \
+    volatile unsigned _smart_ptr_slab_lock
+
+extern THREAD_LOCAL smart_ptr_slab_cache_t* _smart_ptr_slab_cache;
+extern smart_ptr_slab_cache_t* _smart_ptr_slab_orphans;
+extern volatile unsigned _smart_ptr_slab_lock;
+
+
+/* The caches of the exited threads are protected by a spin lock.
+ * It is taken only when a thread starts or exits. */
+static inline void
+smart_ptr_slab_lock(void)
+{
+    unsigned unlocked = 0;
+
+    while (!CAS_UINT(&_smart_ptr_slab_lock, &unlocked, 1))
+        unlocked = 0;
+}
+
+static inline void
+smart_ptr_slab_unlock(void)
+{
+    unsigned locked = 1;
+
+    while (!CAS_UINT(&_smart_ptr_slab_lock, &locked, 0))
+        locked = 1;
+}
+
+/* Get the cache of the calling thread. A new thread adopts the cache
+ * of an exited thread or allocates a new one. */
+static inline smart_ptr_slab_cache_t*
+smart_ptr_slab_cache(void)
+{
+    smart_ptr_slab_cache_t* cache = _smart_ptr_slab_cache;
+
+    if (cache)
+        return cache;
+
+    smart_ptr_slab_lock();
+    cache = _smart_ptr_slab_orphans;
+    if (cache)
+        _smart_ptr_slab_orphans = cache->next;
+    smart_ptr_slab_unlock();
+
+    if (!cache) {
+        cache = MALLOC(sizeof(smart_ptr_slab_cache_t));
+        if (!cache)
+            return NULL;
+        BZERO(cache, sizeof(smart_ptr_slab_cache_t));
+    }
+    _smart_ptr_slab_cache = cache;
+
+    return cache;
+}
+
+/* Release the cache of the calling thread. Call this before a thread
+ * exits, otherwise the blocks in its cache are never reused. The
+ * objects of the thread can still be freed by other threads. */
+static inline void
+smart_ptr_slab_thread_exit(void)
+{
+    smart_ptr_slab_cache_t* cache = _smart_ptr_slab_cache;
+
+    if (!cache)
+        return;
+
+    _smart_ptr_slab_cache = NULL;
+    smart_ptr_slab_lock();
+    cache->next = _smart_ptr_slab_orphans;
+    _smart_ptr_slab_orphans = cache;
+    smart_ptr_slab_unlock();
+}
+
+/* Get a block when the free list of the size class is empty. The
+ * newest slab is carved first, then the blocks freed by other threads
+ * are taken over. A new slab is allocated as the last resort. */
 static inline void*
-smart_ptr_malloc(size_t size)
+smart_ptr_slab_refill(smart_ptr_slab_cache_t* cache, unsigned c, size_t size)
 {
-    void* p = MALLOC(size + sizeof(volatile unsigned));
+    smart_ptr_slab_t* slab = cache->slabs[c];
+    unsigned char* block;
 
-    if (!p)
+    if (slab && slab->top + size <= (unsigned char*) slab + SMART_PTR_SLAB_SIZE) {
+        block = slab->top;
+        slab->top += size;
+        return block;
+    }
+
+    for (; slab; slab = slab->next) {
+        void* list = slab->remote;
+
+        if (!list)
+            continue;
+        while (!CAS(&slab->remote, &list, NULL))
+            ;
+        cache->free[c] = *(void**) list;
+        return list;
+    }
+
+    slab = ALIGNED_MALLOC(SMART_PTR_SLAB_SIZE, SMART_PTR_SLAB_SIZE);
+    if (!slab)
+        return NULL;
+
+    slab->remote = NULL;
+    slab->owner = cache;
+    slab->next = cache->slabs[c];
+    slab->top = (unsigned char*) slab + SMART_PTR_SLAB_HEADER_SIZE + size;
+    slab->block_size = size;
+    cache->slabs[c] = slab;
+
+    return (unsigned char*) slab + SMART_PTR_SLAB_HEADER_SIZE;
+}
+
+/* Allocate a memory block of 'size' bytes, which is a multiple of
+ * SMART_PTR_MIN_ALIGN and at most SMART_PTR_SLAB_MAX */
+static inline void*
+smart_ptr_slab_malloc_block(size_t size)
+{
+    smart_ptr_slab_cache_t* cache = smart_ptr_slab_cache();
+    unsigned c = (unsigned) (size / SMART_PTR_MIN_ALIGN) - 1;
+    void* block;
+
+    if (!cache)
+        return NULL;
+
+    block = cache->free[c];
+    if (block) {
+        cache->free[c] = *(void**) block;
+        return block;
+    }
+
+    return smart_ptr_slab_refill(cache, c, size);
+}
+
+/* Free a memory block allocated from the slabs. The block returns
+ * to the free list of the owner directly or through the remote list
+ * of its slab. */
+static inline void
+smart_ptr_slab_free_block(void* block)
+{
+    smart_ptr_slab_t* slab = (smart_ptr_slab_t*)
+        ((uintptr_t) block & ~((uintptr_t) SMART_PTR_SLAB_SIZE - 1));
+    smart_ptr_slab_cache_t* cache = _smart_ptr_slab_cache;
+    void* head;
+
+    if (slab->owner == cache) {
+        unsigned c = (unsigned) (slab->block_size / SMART_PTR_MIN_ALIGN) - 1;
+
+        *(void**) block = cache->free[c];
+        cache->free[c] = block;
+        return;
+    }
+
+    head = slab->remote;
+    do {
+        *(void**) block = head;
+    } while (!CAS(&slab->remote, &head, block));
+}
+
+#endif /* SMART_PTR_SLAB */
+
+
+#ifdef SMART_PTR_BIASED
+
+/* Thread record of biased reference counting. An object is owned by
+ * the thread which allocated it. The owner counts its references in
+ * the biased count without atomic operations, and other threads in
+ * the shared count. The shared count goes below zero when another
+ * thread drops a reference taken by the owner. Such objects are
+ * queued to the owner, which merges the counts. The records are
+ * never freed, since the objects may outlive their owners. They
+ * are kept in a list. */
+typedef struct smart_ptr_thread {
+    void* volatile queue;
+    struct smart_ptr_thread* next;
+} smart_ptr_thread_t;
+
+/* Queue of an exited thread */
+#define SMART_PTR_QUEUE_CLOSED ((void*) 1)
+
+
+/* Use DECLARE_SMART_PTR_BIASED() to declare the thread records in
+ * one source file */
+#define DECLARE_SMART_PTR_BIASED()                                  \
+    THREAD_LOCAL smart_ptr_thread_t* _smart_ptr_thread;             \
+    smart_ptr_thread_t* _smart_ptr_threads
+
+extern THREAD_LOCAL smart_ptr_thread_t* _smart_ptr_thread;
+extern smart_ptr_thread_t* _smart_ptr_threads;
+
+
+/* Get the record of the calling thread */
+static inline smart_ptr_thread_t*
+smart_ptr_thread(void)
+{
+    smart_ptr_thread_t* thread = _smart_ptr_thread;
+
+    if (thread)
+        return thread;
+
+    thread = MALLOC(sizeof(smart_ptr_thread_t));
+    if (!thread)
+        return NULL;
+
+    thread->queue = NULL;
+    thread->next = _smart_ptr_threads;
+    while (!CAS(&_smart_ptr_threads, &thread->next, thread))
+        ;
+    _smart_ptr_thread = thread;
+
+    return thread;
+}
+
+static inline void smart_ptr_biased_collect(void);
+
+#endif /* SMART_PTR_BIASED */
+
+
+/* Whether the objects are allocated from the slabs by default */
+#ifdef SMART_PTR_SLAB_DEFAULT
+#define SMART_PTR_SLAB_BY_DEFAULT true
+#else
+#define SMART_PTR_SLAB_BY_DEFAULT false
+#endif
+
+
+/* Allocate an object aligned to 'align' with an optional clean
+ * up callback. The reference count is set to one. If 'slab' is
+ * true, small objects are allocated from the slabs. */
+static inline void*
+smart_ptr_alloc(size_t size, size_t align, void (*cleanup)(void*), bool slab)
+{
+    unsigned flags = cleanup ? REFCOUNT_FLAG_CLEAN_UP : 0;
+    size_t header = cleanup ? CLEAN_UP_HEADER_SIZE : REFCOUNT_HEADER_SIZE;
+    unsigned char* p;
+    unsigned char* q;
+
+#ifdef SMART_PTR_BIASED
+    smart_ptr_thread_t* thread = smart_ptr_thread();
+
+    if (!thread)
         return NULL;
+    if (thread->queue)
+        smart_ptr_biased_collect();
+#endif
 
-    *((unsigned*) p) = 1 << 1;
+    (void) slab;
+    if (align <= SMART_PTR_MIN_ALIGN) {
+        size_t block = ROUND_UP(header, SMART_PTR_MIN_ALIGN) + size;
+#ifdef SMART_PTR_SLAB
+        if (slab && block <= SMART_PTR_SLAB_MAX) {
+            flags |= REFCOUNT_FLAG_SLAB;
+            p = smart_ptr_slab_malloc_block(ROUND_UP(block, SMART_PTR_MIN_ALIGN));
+        } else
+#endif
+        p = MALLOC(block);
+        if (!p)
+            return NULL;
+        q = p + ROUND_UP(header, SMART_PTR_MIN_ALIGN);
+    } else {
+        flags |= REFCOUNT_FLAG_OFFSET;
+        header = OFFSET_HEADER_SIZE;
+        p = MALLOC(header + align - 1 + size);
+        if (!p)
+            return NULL;
+        q = (unsigned char*) ROUND_UP((uintptr_t) (p + header), align);
+        *GET_OFFSETP(q) = q - p;
+    }
+
+    if (cleanup)
+        *GET_CLEAN_UP(q) = cleanup;
+#ifdef SMART_PTR_BIASED
+    *GET_OWNERP(q) = thread;
+    *GET_BIASP(q) = 1;
+    *((unsigned*) GET_REFCOUNTP(q)) = flags;
+#else
+    *((unsigned*) GET_REFCOUNTP(q)) = REFCOUNT_ONE | flags;
+#endif
+
+    return (void*) q;
+}
+
+/* Get the start of the memory block holding the object */
+static inline void*
+smart_ptr_block(void* p)
+{
+    if (HAS_OFFSET(p))
+        return ((unsigned char*) p) - *GET_OFFSETP(p);
 
-    return (void*) (((unsigned char*) p) + sizeof(volatile unsigned));
+    return ((unsigned char*) p) -
+            ROUND_UP(HAS_CLEAN_UP(p) ? CLEAN_UP_HEADER_SIZE : REFCOUNT_HEADER_SIZE,
+                     SMART_PTR_MIN_ALIGN);
+}
+
+static inline void*
+smart_ptr_malloc(size_t size)
+{
+    return smart_ptr_alloc(size, SMART_PTR_MIN_ALIGN, NULL,
+                           SMART_PTR_SLAB_BY_DEFAULT);
+}
+
+/* Allocate an object aligned to 'align'. The alignment must
+ * be a power of two. */
+static inline void*
+smart_ptr_malloc_aligned(size_t size, size_t align)
+{
+    return smart_ptr_alloc(size, align, NULL, SMART_PTR_SLAB_BY_DEFAULT);
 }
 
 static inline void*
@@ -102,51 +588,302 @@ smart_ptr_malloc0(size_t size)
 static inline void*
 smart_ptr_malloc_with_cleanup(size_t size, void (*cleanup)(void*))
 {
-    void* p = MALLOC(size + sizeof(volatile unsigned) +
-                     sizeof(void (*)(void*)));
+    return smart_ptr_alloc(size, SMART_PTR_MIN_ALIGN, cleanup,
+                           SMART_PTR_SLAB_BY_DEFAULT);
+}
 
-    if (!p)
+/* Allocate an object aligned to 'align' and register a clean
+ * up callback. The alignment must be a power of two. */
+static inline void*
+smart_ptr_malloc_aligned_with_cleanup(size_t size, size_t align,
+                                      void (*cleanup)(void*))
+{
+    return smart_ptr_alloc(size, align, cleanup, SMART_PTR_SLAB_BY_DEFAULT);
+}
+
+#ifdef SMART_PTR_SLAB
+/* Allocate an object from the slabs. Objects larger than the largest
+ * size class are allocated with MALLOC. */
+static inline void*
+smart_ptr_slab_malloc(size_t size)
+{
+    return smart_ptr_alloc(size, SMART_PTR_MIN_ALIGN, NULL, true);
+}
+
+static inline void*
+smart_ptr_slab_malloc_with_cleanup(size_t size, void (*cleanup)(void*))
+{
+    return smart_ptr_alloc(size, SMART_PTR_MIN_ALIGN, cleanup, true);
+}
+#endif
+
+/* Free the memory block of an object */
+static inline void
+smart_ptr_free(void* p)
+{
+#ifdef SMART_PTR_SLAB
+    if (*GET_REFCOUNTP(p) & REFCOUNT_FLAG_SLAB) {
+        smart_ptr_slab_free_block(smart_ptr_block(p));
+        return;
+    }
+#endif
+    FREE(smart_ptr_block(p));
+}
+
+/* Allocate an object which supports weak references. The clean up
+ * callback is optional. The object is freed when the last strong
+ * reference is dropped, and its control block when the last weak
+ * reference is dropped. */
+static inline void*
+smart_ptr_malloc_weakable(size_t size, void (*cleanup)(void*))
+{
+    smart_ptr_weak_t* w = MALLOC(sizeof(smart_ptr_weak_t));
+    size_t header = ROUND_UP(WEAK_HEADER_SIZE, SMART_PTR_MIN_ALIGN);
+
+    if (!w)
+        return NULL;
+
+    unsigned char* p = MALLOC(header + size);
+
+    if (!p) {
+        FREE(w);
+        return NULL;
+    }
+
+    unsigned char* q = p + header;
+    *GET_OFFSETP(q) = header;
+    *GET_CLEAN_UP(q) = cleanup;
+    *GET_WEAKP(q) = w;
+    *((unsigned*) GET_REFCOUNTP(q)) = REFCOUNT_FLAG_WEAK | REFCOUNT_FLAG_OFFSET |
+                                      (cleanup ? REFCOUNT_FLAG_CLEAN_UP : 0);
+    w->strong = 1;
+    w->weak = 1;
+    w->object = q;
+
+    return (void*) q;
+}
+
+/* Drop a weak reference. The control block is freed when the last
+ * one is dropped. */
+static inline void
+smart_ptr_weak_unref(smart_ptr_weak_t* w)
+{
+    if (REFCOUNT_SUB(&w->weak, 1) == 1)
+        FREE(w);
+}
+
+/* Get a weak reference to an object allocated with
+ * smart_ptr_malloc_weakable. Returns NULL for other objects. */
+static inline smart_ptr_weak_t*
+smart_ptr_weak(void* p)
+{
+    smart_ptr_weak_t* w;
+
+    if (!HAS_WEAK(p))
         return NULL;
 
-    *((void (**)(void*)) p) = cleanup;
-    unsigned char* q = ((unsigned char*) p) + sizeof(void (*)(void*));
-    *((unsigned*) q) = (1 << 1) | 1;
+    w = *GET_WEAKP(p);
+    (void) REFCOUNT_ADD(&w->weak, 1);
 
-    return (void*) (((unsigned char*) q) + sizeof(volatile unsigned));
+    return w;
 }
 
+/* Get a strong reference from a weak reference. Returns NULL, if
+ * the object has already been freed. */
 static inline void*
-smart_ptr_ref(void* p)
+smart_ptr_lock(smart_ptr_weak_t* w)
 {
-    unsigned refcount;
+    unsigned strong;
 
     do {
-        refcount = *GET_REFCOUNTP(p);
-        if (!(refcount >> 1))
+        strong = w->strong;
+        if (!strong)
             return NULL;
-    } while (!CAS_UINT(GET_REFCOUNTP(p), &refcount, refcount + (1 << 1)));
+    } while (!CAS_UINT(&w->strong, &strong, strong + 1));
 
-    return p;
+    return w->object;
 }
 
+/* Run the clean up callback of an object and free it */
 static inline void
-smart_ptr_unref(void* p)
+smart_ptr_destroy(void* p)
+{
+    if (HAS_CLEAN_UP(p))
+        (*GET_CLEAN_UP(p))(p);
+    smart_ptr_free(p);
+}
+
+#ifdef SMART_PTR_BIASED
+/* Move the biased count of an object to its shared count and clear
+ * the queued flag if requested. Called by the owner, or by another
+ * thread after the owner has exited. Returns true if no references
+ * are left and the object must be destroyed. */
+static inline bool
+smart_ptr_merge(void* p, bool queued)
 {
-    unsigned refcount;
+    unsigned refcount = *GET_REFCOUNTP(p);
+    unsigned bias = refcount & REFCOUNT_FLAG_MERGED ? 0 : *GET_BIASP(p);
+    unsigned newcount;
 
     do {
-        refcount = *GET_REFCOUNTP(p);
-        if (!(refcount >> 1))
+        newcount = (refcount + bias * REFCOUNT_ONE) | REFCOUNT_FLAG_MERGED;
+        if (queued)
+            newcount &= ~REFCOUNT_FLAG_QUEUED;
+    } while (!CAS_UINT(GET_REFCOUNTP(p), &refcount, newcount));
+
+    return !(newcount >> REFCOUNT_SHIFT) && !(newcount & REFCOUNT_FLAG_QUEUED);
+}
+
+/* Merge the counts of the queued objects */
+static inline void
+smart_ptr_merge_queue(void* list)
+{
+    while (list) {
+        void* p = list;
+
+        list = *GET_NEXTP(p);
+        if (smart_ptr_merge(p, true))
+            smart_ptr_destroy(p);
+    }
+}
+
+/* Merge the objects queued to the calling thread. It is done on
+ * allocation, and can be done explicitly by threads which drop
+ * references without allocating. */
+static inline void
+smart_ptr_biased_collect(void)
+{
+    smart_ptr_thread_t* thread = _smart_ptr_thread;
+    void* list;
+
+    if (!thread || !thread->queue)
+        return;
+
+    list = thread->queue;
+    while (!CAS(&thread->queue, &list, NULL))
+        ;
+    smart_ptr_merge_queue(list);
+}
+
+/* Merge the queued objects and close the queue of the calling
+ * thread. Call this before a thread exits. The objects queued after
+ * that are merged by the threads queuing them. */
+static inline void
+smart_ptr_biased_thread_exit(void)
+{
+    smart_ptr_thread_t* thread = _smart_ptr_thread;
+    void* list = NULL;
+
+    if (!thread)
+        return;
+
+    while (!CAS(&thread->queue, &list, SMART_PTR_QUEUE_CLOSED)) {
+        while (!CAS(&thread->queue, &list, NULL))
+            ;
+        smart_ptr_merge_queue(list);
+        list = NULL;
+    }
+    _smart_ptr_thread = NULL;
+}
+
+/* Queue an object to its owner for merging */
+static inline void
+smart_ptr_queue(void* p)
+{
+    smart_ptr_thread_t* owner = *GET_OWNERP(p);
+    void* head = owner->queue;
+
+    do {
+        if (head == SMART_PTR_QUEUE_CLOSED) {
+            if (smart_ptr_merge(p, true))
+                smart_ptr_destroy(p);
             return;
-    } while (!CAS_UINT(GET_REFCOUNTP(p), &refcount, refcount - (1 << 1)));
+        }
+        *GET_NEXTP(p) = head;
+    } while (!CAS(&owner->queue, &head, p));
+}
 
-    if (((refcount - (1 << 1)) >> 1) == 0) {
-        if (HAS_CLEAN_UP(p)) {
-            (*GET_CLEAN_UP(p))(p);
-            FREE((void*) GET_CLEAN_UP(p));
-        } else
-            FREE((void*) GET_REFCOUNTP(p));
+/* Drop a reference in the shared count */
+static inline void
+smart_ptr_unref_shared(void* p)
+{
+    unsigned refcount = *GET_REFCOUNTP(p);
+    unsigned newcount;
+
+    do {
+        newcount = refcount - REFCOUNT_ONE;
+        if (!(refcount & (REFCOUNT_FLAG_MERGED | REFCOUNT_FLAG_QUEUED)) &&
+            (int) newcount < 0)
+            newcount |= REFCOUNT_FLAG_QUEUED;
+    } while (!CAS_UINT(GET_REFCOUNTP(p), &refcount, newcount));
+
+    if ((newcount & REFCOUNT_FLAG_QUEUED) && !(refcount & REFCOUNT_FLAG_QUEUED))
+        smart_ptr_queue(p);
+    else if ((newcount & REFCOUNT_FLAG_MERGED) &&
+             !(newcount & REFCOUNT_FLAG_QUEUED) &&
+             !(newcount >> REFCOUNT_SHIFT))
+        smart_ptr_destroy(p);
+}
+#endif /* SMART_PTR_BIASED */
+
+/* Increment the reference count of an object. The caller must hold
+ * a reference. */
+static inline void*
+smart_ptr_ref(void* p)
+{
+    unsigned refcount = *GET_REFCOUNTP(p);
+
+    if (refcount & REFCOUNT_FLAG_WEAK) {
+        (void) REFCOUNT_ADD(&(*GET_WEAKP(p))->strong, 1);
+        return p;
+    }
+
+#ifdef SMART_PTR_BIASED
+    if (*GET_OWNERP(p) == _smart_ptr_thread && !(refcount & REFCOUNT_FLAG_MERGED)) {
+        ++*GET_BIASP(p);
+        return p;
+    }
+#endif
+
+    (void) REFCOUNT_ADD(GET_REFCOUNTP(p), REFCOUNT_ONE);
+
+    return p;
+}
+
+/* Drop a strong reference of an object supporting weak references */
+static inline void
+smart_ptr_unref_weakable(void* p)
+{
+    smart_ptr_weak_t* w = *GET_WEAKP(p);
+
+    if (REFCOUNT_SUB(&w->strong, 1) == 1) {
+        smart_ptr_destroy(p);
+        smart_ptr_weak_unref(w);
+    }
+}
+
+static inline void
+smart_ptr_unref(void* p)
+{
+    unsigned refcount = *GET_REFCOUNTP(p);
+
+    if (refcount & REFCOUNT_FLAG_WEAK) {
+        smart_ptr_unref_weakable(p);
+        return;
+    }
+
+#ifdef SMART_PTR_BIASED
+    if (*GET_OWNERP(p) == _smart_ptr_thread && !(refcount & REFCOUNT_FLAG_MERGED)) {
+        if (!--*GET_BIASP(p) && smart_ptr_merge(p, false))
+            smart_ptr_destroy(p);
+        return;
     }
+    smart_ptr_unref_shared(p);
+#else
+    if (((REFCOUNT_SUB(GET_REFCOUNTP(p), REFCOUNT_ONE) - REFCOUNT_ONE) >>
+         REFCOUNT_SHIFT) == 0)
+        smart_ptr_destroy(p);
+#endif
 }
 
 #endif /* guard */
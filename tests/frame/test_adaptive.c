@@ -0,0 +1,100 @@
+#include <stdio.h>
+#define FRAME_MMAP
+#define FRAME_MMAP_KEEP (64 * 1024)
+#define FRAME_ADAPTIVE
+#define FRAME_ADAPTIVE_HISTORY 4
+#define FRAME_REALLOC
+#define LOGGER_DEBUG(...) do {} while (0)
+#include "frame_allocator.h"
+
+
+/* The banks reserve 64 MiB each but start with a capacity of 64 KiB.
+ * A frame using 1 MiB spills to secondary blocks instead of failing,
+ * and the objects spilled are kept, cleaned up and found by
+ * frame_get_bank_by_ptr. After a swap the next bank is grown, so the
+ * same load fits without spilling. A lighter load above half of the
+ * capacity leaves it as it is, while a light load shrinks it once
+ * the heavy frames have left the history.
+ */
+
+#define FRAME_SIZE (64 * 1024 * 1024)
+#define CHUNK 1024
+
+DECLARE_FRAME_ALLOCATOR();
+
+int cleanups;
+
+
+void
+cb(void* p)
+{
+    (void) p;
+    cleanups++;
+}
+
+/* Allocate 'bytes' bytes in chunks. Returns the number of failures. */
+int
+load(size_t bytes)
+{
+    int failures = 0;
+
+    for (size_t i = 0; i < bytes; i += CHUNK)
+        failures += !frame_malloc(CHUNK);
+
+    return failures;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (frame_allocator_init(FRAME_SIZE)) {
+        printf("Unable to reserve enough memory\n");
+        return 1;
+    }
+    printf("  initial capacity %zu: %s\n", frame_allocator_capacity(),
+           frame_allocator_capacity() == FRAME_MMAP_KEEP ? "ok" : "ERROR");
+
+    int failures = load(1024 * 1024);
+    int* spilled = frame_malloc(sizeof(int));
+    int bank = frame_get_bank_by_ptr(spilled);
+    *spilled = 42;
+    frame_keep_ptr((void**) &spilled, NULL);
+    frame_malloc_with_cleanup(CHUNK, cb);
+    printf("  %zu bytes spilled, %d failures, bank %s: %s\n",
+           frame_allocator_spilled(), failures,
+           bank == 0 ? "found" : "ERROR: not found",
+           frame_allocator_spilled() > 900 * 1024 && !failures ? "ok" : "ERROR");
+
+    frame_swap(true);
+    size_t grown = frame_allocator_capacity();
+    printf("  kept object: %s\n", *spilled == 42 ? "ok" : "ERROR");
+    failures = load(1024 * 1024);
+    printf("  grown to %zu, %zu bytes spilled: %s\n", grown,
+           frame_allocator_spilled(),
+           grown >= 1024 * 1024 && !frame_allocator_spilled() && !failures ?
+           "ok" : "ERROR");
+
+    frame_swap(true);
+    printf("  %d of 1 clean ups run: %s\n", cleanups, cleanups == 1 ? "ok" : "ERROR");
+
+    for (int i = 0; i < 2 * FRAME_ADAPTIVE_HISTORY; i++) {
+        failures += load(grown * 6 / 10);
+        frame_swap(true);
+    }
+    printf("  capacity %zu kept at 60%% load: %s\n", frame_allocator_capacity(),
+           frame_allocator_capacity() == grown && !failures ? "ok" : "ERROR");
+
+    for (int i = 0; i < 2 * FRAME_ADAPTIVE_HISTORY; i++) {
+        failures += load(32 * 1024);
+        frame_swap(true);
+    }
+    printf("  capacity %zu after light load: %s\n", frame_allocator_capacity(),
+           frame_allocator_capacity() == FRAME_MMAP_KEEP && !failures ?
+           "ok" : "ERROR");
+
+    frame_allocator_destroy();
+}
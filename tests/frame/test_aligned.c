@@ -0,0 +1,71 @@
+#define FRAME_REALLOC
+#if defined(WIN32) || defined(_WIN32) || defined (__WIN32__)
+# include "config_windows.h"
+#endif
+#include <stdio.h>
+#include "frame_allocator.h"
+
+
+DECLARE_FRAME_ALLOCATOR();
+
+int cleanups = 0;
+
+void cb(void* a)
+{
+    (void) a;
+    cleanups++;
+}
+
+int check(const char* what, void* p, size_t align)
+{
+    if (!p || ((uintptr_t) p & (align - 1))) {
+        printf("  ERROR: %s %p is not aligned to %zu\n", what, p, align);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    frame_allocator_init(256 * 1024);
+
+    int errors = 0;
+    for (size_t size = 1; size < 100; size += 7) {
+        errors += check("frame_malloc", frame_malloc(size), FRAME_MIN_ALIGN);
+        errors += check("frame_malloc_with_cleanup",
+                        frame_malloc_with_cleanup(size, cb), FRAME_MIN_ALIGN);
+    }
+    for (size_t align = 1; align <= 4096; align <<= 1) {
+        errors += check("frame_malloc_aligned",
+                        frame_malloc_aligned(3, align), align);
+        char* p = frame_malloc_aligned_with_cleanup(5, align, cb);
+        errors += check("frame_malloc_aligned_with_cleanup", p, align);
+        strcpy(p, "abcd");
+        p = frame_realloc_aligned_with_cleanup(p, 50, align);
+        errors += check("frame_realloc_aligned_with_cleanup", p, align);
+        if (strcmp(p, "abcd"))
+            printf("  ERROR: content was not copied\n"), errors++;
+        errors += check("frame_realloc_aligned",
+                        frame_realloc_aligned(p, 70, align), align);
+    }
+    printf("  %d errors\n", errors);
+
+    /* The size header is placed in the space skipped for alignment,
+     * so objects of 40 bytes aligned to 64 bytes are packed 64 bytes
+     * apart */
+    unsigned char* a = frame_malloc_aligned(40, 64);
+    unsigned char* b = frame_malloc_aligned(40, 64);
+    size_t gap = a > b ? (size_t) (a - b) : (size_t) (b - a);
+    printf("  %zu bytes between aligned objects, %s\n", gap,
+           gap == 64 ? "ok" : "ERROR");
+
+    frame_swap(true);
+    frame_swap(true);
+    printf("  %d clean ups\n", cleanups);
+    frame_allocator_destroy();
+}
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <dirent.h>
+#define FRAME_BANKS 3
+#define FRAME_ASYNC_CLEAN_UP
+#include "frame_allocator.h"
+
+
+/* The clean up callbacks of a bank are run in the background when
+ * the bank is retired. The callbacks block until we release them, so
+ * frame_swap must return before any of them has completed. Then
+ * frame_clean_up_wait returns only after all of them have been run.
+ * Last, the bank is reused on a later swap. All batches are run by
+ * one worker thread, which frame_allocator_destroy joins.
+ */
+
+#define OBJECTS 1000
+
+DECLARE_FRAME_ALLOCATOR();
+
+volatile int released;
+volatile int calls;
+int timeouts;
+
+
+void
+cb(int* a)
+{
+    (void) a;
+
+    /* Give up after about two seconds */
+    for (int i = 0; !released && i < 2000; i++)
+        usleep(1000);
+    if (!released)
+        timeouts++;
+    calls++;
+}
+
+/* Count the threads of the process */
+int
+threads(void)
+{
+    DIR* dir = opendir("/proc/self/task");
+    struct dirent* entry;
+    int n = 0;
+
+    if (!dir)
+        return -1;
+    while ((entry = readdir(dir)))
+        if (entry->d_name[0] != '.')
+            n++;
+    closedir(dir);
+
+    return n;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (frame_allocator_init(OBJECTS * 64)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < OBJECTS; i++)
+        *(int*) frame_malloc_with_cleanup(sizeof(int), (void (*)(void*)) cb) = i;
+
+    frame_swap(true);
+    printf("  first swap: %d callbacks run\n", calls);
+    frame_swap(true);
+    printf("  second swap returned with %d callbacks run, %s\n", calls,
+           calls ? "ERROR" : "ok");
+
+    released = 1;
+    frame_clean_up_wait();
+    printf("  after wait: %d of %d callbacks run, %s\n", calls, OBJECTS,
+           calls == OBJECTS && !timeouts ? "ok" : "ERROR");
+
+    frame_swap(true);
+    printf("  bank reused: %s\n",
+           frame_malloc_with_cleanup(sizeof(int), (void (*)(void*)) cb) ?
+           "ok" : "ERROR");
+    for (int i = 0; i < 100; i++) {
+        frame_malloc_with_cleanup(sizeof(int), (void (*)(void*)) cb);
+        frame_swap(true);
+    }
+    printf("  threads while swapping: %d, %s\n", threads(),
+           threads() <= 2 ? "ok" : "ERROR");
+    frame_allocator_destroy();
+    printf("  after destroy: %d callbacks run, %s\n", calls,
+           calls == OBJECTS + 101 ? "ok" : "ERROR");
+    printf("  threads after destroy: %d, %s\n", threads(),
+           threads() == 1 ? "ok" : "ERROR");
+}
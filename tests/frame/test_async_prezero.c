@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <string.h>
+#define FRAME_BANKS 3
+#define FRAME_ASYNC_CLEAN_UP
+#define FRAME_PREZERO
+#define FRAME_CLEAN_UP_SUBMIT(task,arg) submit(task,arg)
+static inline int submit(void (*task)(void*), void* arg);
+#include "frame_allocator.h"
+
+
+/* With FRAME_PREZERO a retired bank is cleared by the executor even
+ * if it has no clean up callbacks. The executor of this test only
+ * records the task, so the bank must still be dirty when frame_swap
+ * returns and zero once we have run the task ourselves.
+ */
+
+#define FRAME_SIZE (64 * 1024)
+
+DECLARE_FRAME_ALLOCATOR();
+
+void (*pending_task)(void*);
+void* pending_arg;
+int submitted;
+
+
+static inline int
+submit(void (*task)(void*), void* arg)
+{
+    pending_task = task;
+    pending_arg = arg;
+    submitted++;
+
+    return 0;
+}
+
+int
+is_filled(unsigned char* p, size_t n, unsigned char c)
+{
+    for (size_t i = 0; i < n; i++)
+        if (p[i] != c)
+            return 0;
+
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (frame_allocator_init(FRAME_SIZE)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+
+    unsigned char* p = frame_malloc(FRAME_SIZE / 2);
+    memset(p, 0xff, FRAME_SIZE / 2);
+
+    /* The first swap retires the bank after the next one, which is
+     * still clean. The second one retires the bank we dirtied. */
+    frame_swap(true);
+    printf("  clean bank: %d submitted, %s\n", submitted,
+           submitted == 0 ? "ok" : "ERROR");
+    frame_swap(true);
+    printf("  dirty bank: %d submitted, %s\n", submitted,
+           submitted == 1 ? "ok" : "ERROR");
+    printf("  after swap: %s\n",
+           is_filled(p, FRAME_SIZE / 2, 0xff) ? "ok" : "ERROR");
+
+    pending_task(pending_arg);
+    printf("  after task: %s\n",
+           is_filled(p, FRAME_SIZE / 2, 0) ? "ok" : "ERROR");
+
+    frame_swap(true);
+    unsigned char* q = frame_malloc0(FRAME_SIZE / 2);
+    printf("  bank reused: %s\n",
+           q == p && is_filled(q, FRAME_SIZE / 2, 0) ? "ok" : "ERROR");
+
+    frame_allocator_destroy();
+}
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#define FRAME_EPOCH
+#include "frame_allocator.h"
+
+
+/* Allocating threads register clean ups while the main thread swaps
+ * the frames as fast as it can. Every registered clean up must be run
+ * exactly once. A reader thread pins a generation and checks that
+ * its objects are not overwritten while the swapper tries to clear
+ * the bank.
+ */
+
+#define NBR_OF_SWAPS 1000
+#define NBR_OF_VALUES 64
+
+DECLARE_FRAME_ALLOCATOR();
+DECLARE_FRAME_EPOCH();
+
+atomic_int allocations;
+atomic_int cleanups;
+atomic_int errors;
+atomic_int is_running = 1;
+
+void cb(void* p)
+{
+    (void) p;
+    atomic_fetch_add(&cleanups, 1);
+}
+
+void*
+writer_cb(void* arg)
+{
+    (void) arg;
+
+    while (is_running) {
+        int* a = frame_malloc_with_cleanup(sizeof(int), cb);
+        if (a) {
+            atomic_fetch_add(&allocations, 1);
+            *a = 1;
+        }
+    }
+
+    frame_epoch_thread_exit();
+
+    return NULL;
+}
+
+void*
+reader_cb(void* arg)
+{
+    int* pins = arg;
+
+    while (is_running) {
+        int* values = frame_malloc(sizeof(int) * NBR_OF_VALUES);
+        if (!values ||
+            frame_pin_generation(frame_get_generation_by_ptr(values)))
+            continue;
+
+        for (int i = 0; i < NBR_OF_VALUES; i++)
+            values[i] = i;
+
+        /* Let the swapper move on and block on clearing the bank */
+        usleep(500);
+
+        for (int i = 0; i < NBR_OF_VALUES; i++)
+            if (values[i] != i)
+                atomic_fetch_add(&errors, 1);
+
+        frame_unpin();
+        (*pins)++;
+        usleep(1000);
+    }
+
+    frame_epoch_thread_exit();
+
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    int nbr_of_threads = 2;
+    int pins = 0;
+
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" with %d threads", (nbr_of_threads = atoi(argv[1])));
+    printf("\n");
+
+    if (frame_allocator_init(4096*1024)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+
+    pthread_t id[nbr_of_threads + 1];
+    for (int i=0; i < nbr_of_threads; i++)
+        pthread_create(&id[i], NULL, writer_cb, NULL);
+    pthread_create(&id[nbr_of_threads], NULL, reader_cb, &pins);
+
+    for (int i=0; i < NBR_OF_SWAPS; i++) {
+        usleep(50);
+        frame_swap(true);
+    }
+    is_running = 0;
+
+    for (int i=0; i <= nbr_of_threads; i++)
+        pthread_join(id[i], NULL);
+
+    frame_allocator_destroy();
+
+    printf("  %d swaps, %s pins\n", NBR_OF_SWAPS, pins ? "some" : "no");
+    printf("  %d errors\n", (int) errors);
+    if (cleanups != allocations)
+        printf("  ERROR: %d clean ups (expected %d)\n",
+               (int) cleanups, (int) allocations);
+    else
+        printf("  clean ups ok\n");
+}
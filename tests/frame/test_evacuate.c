@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <string.h>
+#define FRAME_REALLOC
+#define FRAME_EVACUATE
+#define FRAME_STATS
+#include "frame_allocator.h"
+
+
+/* A tree of nodes is kept across swaps as an object graph. The nodes
+ * share a name string, the last node points back to the root and a
+ * second root points into the middle of the tree. After each swap
+ * every node must have been copied once to the current bank, the
+ * links must point to the copies and the shared objects must still
+ * be shared.
+ */
+
+#define NODES 1000
+
+DECLARE_FRAME_ALLOCATOR();
+
+typedef struct node {
+    struct node* left;
+    struct node* right;
+    char* name;
+    int value;
+} node_t;
+
+node_t* root;
+node_t* second;
+
+
+void
+visit_node(frame_evacuation_t* ev, void* obj)
+{
+    node_t* n = obj;
+
+    frame_evacuate(ev, (void**) &n->left, visit_node);
+    frame_evacuate(ev, (void**) &n->right, visit_node);
+    frame_evacuate(ev, (void**) &n->name, NULL);
+}
+
+char*
+new_name(const char* s)
+{
+    char* name = frame_malloc(strlen(s) + 1);
+
+    strcpy(name, s);
+
+    return name;
+}
+
+void
+build(void)
+{
+    node_t* nodes[NODES];
+    char* shared = new_name("shared");
+
+    for (int i = 0; i < NODES; i++) {
+        nodes[i] = frame_malloc(sizeof(node_t));
+        nodes[i]->value = i;
+        nodes[i]->name = i % 2 ? new_name("own") : shared;
+    }
+    for (int i = 0; i < NODES; i++) {
+        nodes[i]->left = 2 * i + 1 < NODES ? nodes[2 * i + 1] : NULL;
+        nodes[i]->right = 2 * i + 2 < NODES ? nodes[2 * i + 2] : NULL;
+    }
+    nodes[NODES - 1]->left = nodes[0];
+    root = nodes[0];
+    second = nodes[5];
+}
+
+/* Walk the graph and count the errors */
+int
+check(void)
+{
+    node_t* seen[NODES] = { NULL };
+    node_t* queue[NODES];
+    int bank = frame_get_bank_by_ptr(frame_malloc(1));
+    char* shared = root->name;
+    int head = 0;
+    int tail = 0;
+    int errors = 0;
+
+    seen[0] = queue[tail++] = root;
+    while (head < tail) {
+        node_t* n = queue[head++];
+        node_t* children[2] = { n->left, n->right };
+
+        if (frame_get_bank_by_ptr(n) != bank ||
+            frame_get_bank_by_ptr(n->name) != bank ||
+            strcmp(n->name, n->value % 2 ? "own" : "shared") ||
+            (n->value % 2 == 0 && n->name != shared))
+            errors++;
+        for (int i = 0; i < 2; i++) {
+            node_t* c = children[i];
+            if (!c)
+                continue;
+            if (!seen[c->value])
+                seen[c->value] = queue[tail++] = c;
+            else if (seen[c->value] != c)
+                errors++;
+        }
+    }
+    if (tail != NODES || second != seen[5])
+        errors++;
+
+    return errors;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (frame_allocator_init(NODES * 256)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+
+    build();
+    frame_keep_graph((void**) &root, visit_node);
+    frame_keep_graph((void**) &second, visit_node);
+
+    for (int round = 0; round < 2 * FRAME_BANKS; round++) {
+        size_t copies = frame_allocator_stats().keep_copies;
+
+        frame_swap(true);
+        copies = frame_allocator_stats().keep_copies - copies;
+        printf("  swap %d: %zu objects copied, %d errors\n", round, copies,
+               check());
+        if (copies != NODES + NODES / 2 + 1)
+            printf("  ERROR: expected %d copies\n", NODES + NODES / 2 + 1);
+    }
+
+    frame_allocator_destroy();
+}
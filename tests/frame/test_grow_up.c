@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <string.h>
+#define FRAME_GROW_UP
+#define FRAME_REALLOC
+#include "frame_allocator.h"
+
+
+/* With FRAME_GROW_UP objects allocated one after another are laid
+ * out in ascending address order in every bank. Each bank is filled
+ * until it is full and then swapped. The most recent allocation grows
+ * in place without being moved, also after a swap.
+ */
+
+#define FRAME_SIZE (64 * 1024)
+#define ALLOC_SIZE 40
+
+DECLARE_FRAME_ALLOCATOR();
+
+unsigned char* ptrs[FRAME_SIZE / ALLOC_SIZE];
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (frame_allocator_init(FRAME_SIZE)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+
+    for (int round = 0; round < 2 * FRAME_BANKS; round++) {
+        int count = 0;
+        int errors = 0;
+
+        while ((ptrs[count] = frame_malloc(ALLOC_SIZE))) {
+            memset(ptrs[count], round + 1, ALLOC_SIZE);
+            if (count > 0 && ptrs[count] < ptrs[count - 1] + ALLOC_SIZE)
+                errors++;
+            count++;
+        }
+        for (int i = 0; i < count; i++)
+            if (ptrs[i][0] != round + 1 || ptrs[i][ALLOC_SIZE - 1] != round + 1)
+                errors++;
+        printf("  Round %d: %d errors, bank %s\n", round, errors,
+               count > FRAME_SIZE / ALLOC_SIZE / 2 ? "filled" : "ERROR");
+        frame_swap(true);
+
+        char* s = frame_malloc(8);
+        strcpy(s, "grow");
+        char* t = frame_realloc(s, 4096);
+        strcat(t, " in place");
+        printf("  %s: %s\n", t, t == s ? "ok" : "ERROR: moved");
+    }
+
+    frame_allocator_destroy();
+}
@@ -1,6 +1,7 @@
 #if defined(WIN32) || defined(_WIN32) || defined (__WIN32__)
 # include "config_windows.h"
 #endif
+#include <stdio.h>
 #define FRAME_REALLOC
 #include "frame_allocator.h"
 
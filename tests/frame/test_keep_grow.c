@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#define FRAME_REALLOC
+#define FRAME_MMAP
+#define FRAME_KEEP_SLOTS 64
+static int mallocs;
+#define MALLOC(size) (mallocs++, malloc(size))
+#include "frame_allocator.h"
+
+
+/* The keep set starts much smaller than the number of objects kept.
+ * Every keep must still succeed before the first swap, as the
+ * pointers which find no free slot near their home slot go to the
+ * overflow chunks. The swaps move them to a table large enough for
+ * them. All objects must be copied to the new bank with their values
+ * intact on every swap, and be discarded, whether they are in the
+ * chunks or in the table. None of this may call MALLOC. Keeping the
+ * same pointer again must not take another slot.
+ */
+
+#define KEPT 20000
+
+DECLARE_FRAME_ALLOCATOR();
+
+int* objects[KEPT];
+
+
+/* Count the kept objects which were not copied to the current bank */
+int
+check(void)
+{
+    int errors = 0;
+    int bank = frame_get_bank_by_ptr(frame_malloc(1));
+
+    for (int i = 0; i < KEPT; i++)
+        if (*objects[i] != i || frame_get_bank_by_ptr(objects[i]) != bank)
+            errors++;
+
+    return errors;
+}
+
+/* Discard every other object and count the failures */
+int
+discard(int first)
+{
+    int failures = 0;
+
+    for (int i = first; i < KEPT; i += 2)
+        failures += frame_discard_ptr((void**) &objects[i]);
+
+    return failures;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (frame_allocator_init(KEPT * 64)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+
+    int failures = 0;
+    for (int i = 0; i < KEPT; i++) {
+        objects[i] = frame_malloc(sizeof(int));
+        *objects[i] = i;
+        failures += frame_keep_ptr((void**) &objects[i], NULL);
+    }
+    printf("  kept %d of %d before the first swap, %s\n", KEPT - failures, KEPT,
+           !failures ? "ok" : "ERROR");
+
+    frame_swap(true);
+    printf("  swap 1: %d errors\n", check());
+    frame_swap(true);
+    printf("  swap 2: %d errors\n", check());
+
+    failures = discard(0);
+    frame_swap(true);
+    failures += discard(1);
+    printf("  discarded with %d failures, %s\n", failures,
+           !failures ? "ok" : "ERROR");
+
+    int bank = frame_get_bank_by_ptr(frame_malloc(1)) == 0 ? 1 : 0;
+    int* again = frame_malloc(sizeof(int));
+    *again = 42;
+    failures = 0;
+    for (int i = 0; i < 100000; i++)
+        failures += frame_keep_ptr((void**) &again, NULL);
+    frame_swap(true);
+    printf("  kept one pointer again: %s\n",
+           !failures && *again == 42 && frame_get_bank_by_ptr(again) == bank &&
+           !frame_discard_ptr((void**) &again) &&
+           frame_discard_ptr((void**) &again) ? "ok" : "ERROR");
+    printf("  %d calls to MALLOC, %s\n", mallocs, !mallocs ? "ok" : "ERROR");
+
+    frame_allocator_destroy();
+}
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <pthread.h>
+#define FRAME_REALLOC
+#define FRAME_KEEP_SLOTS 32768
+#include "frame_allocator.h"
+
+
+/* Threads keep thousands of objects concurrently. On each swap every
+ * kept object must be copied to the new bank with its value intact.
+ * Discarding every other object stops copying it, discarding it again
+ * fails, and the slots freed can be used to keep objects again.
+ */
+
+#define NBR_OF_THREADS 4
+#define KEPT_PER_THREAD 5000
+#define KEPT (NBR_OF_THREADS * KEPT_PER_THREAD)
+
+DECLARE_FRAME_ALLOCATOR();
+
+int* objects[KEPT];
+int failures[NBR_OF_THREADS];
+
+
+void*
+thread_cb(void* arg)
+{
+    int id = (int) (intptr_t) arg;
+
+    for (int i = id * KEPT_PER_THREAD; i < (id + 1) * KEPT_PER_THREAD; i++) {
+        objects[i] = frame_malloc(sizeof(int));
+        *objects[i] = i;
+        failures[id] += frame_keep_ptr((void**) &objects[i], NULL);
+    }
+
+    return NULL;
+}
+
+/* Count the kept objects which were not copied to the current bank */
+int
+check(int first, int step)
+{
+    int errors = 0;
+    int bank = frame_get_bank_by_ptr(frame_malloc(1));
+
+    for (int i = first; i < KEPT; i += step)
+        if (*objects[i] != i || frame_get_bank_by_ptr(objects[i]) != bank)
+            errors++;
+
+    return errors;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (frame_allocator_init(KEPT * 64)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+
+    pthread_t id[NBR_OF_THREADS];
+    for (int i = 0; i < NBR_OF_THREADS; i++)
+        pthread_create(&id[i], NULL, thread_cb, (void*) (intptr_t) i);
+    int total = 0;
+    for (int i = 0; i < NBR_OF_THREADS; i++) {
+        pthread_join(id[i], NULL);
+        total += failures[i];
+    }
+    printf("  kept %d objects, %d failures\n", KEPT, total);
+
+    for (int round = 0; round < 2 * FRAME_BANKS; round++) {
+        frame_swap(true);
+        printf("  swap %d: %d errors\n", round, check(0, 1));
+    }
+
+    int discarded = 0;
+    int again = 0;
+    for (int i = 0; i < KEPT; i += 2) {
+        discarded += !frame_discard_ptr((void**) &objects[i]);
+        again += !frame_discard_ptr((void**) &objects[i]);
+    }
+    printf("  discarded %d of %d, %d twice\n", discarded, KEPT / 2, again);
+    int* kept = objects[0];
+    frame_swap(true);
+    printf("  after discard: %d errors, %s\n", check(1, 2),
+           objects[0] == kept ? "discarded not copied" : "ERROR: discarded copied");
+
+    total = 0;
+    for (int i = 0; i < KEPT; i += 2) {
+        objects[i] = frame_malloc(sizeof(int));
+        *objects[i] = i;
+        total += frame_keep_ptr((void**) &objects[i], NULL);
+    }
+    frame_swap(true);
+    printf("  kept again with %d failures: %d errors\n", total, check(0, 1));
+
+    frame_allocator_destroy();
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#define FRAME_MMAP
+#define FRAME_MMAP_KEEP (64 * 1024)
+#include "frame_allocator.h"
+
+
+/* We reserve large banks, but only the pages we touch are
+ * committed. After a spike in one frame the bank is cleared on a
+ * later swap and the resident memory drops back.
+ */
+
+#define FRAME_SIZE (128 * 1024 * 1024)
+#define SPIKE_SIZE (32 * 1024 * 1024)
+
+DECLARE_FRAME_ALLOCATOR();
+
+/* Resident memory of the process in bytes */
+size_t rss(void)
+{
+    long pages = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        fclose(f);
+    }
+
+    return (size_t) resident * sysconf(_SC_PAGESIZE);
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    size_t base = rss();
+    if (frame_allocator_init(FRAME_SIZE)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+    printf("  lazy commit: %s\n", rss() - base < SPIKE_SIZE / 4 ? "ok" : "ERROR");
+
+    for (size_t n = 0; n < SPIKE_SIZE; n += 4096) {
+        char* p = frame_malloc(4096);
+        if (!p) {
+            printf("ALLOCATION ERROR\n");
+            exit(1);
+        }
+        memset(p, 0xff, 4096);
+    }
+    size_t spike = rss();
+
+    /* The bank of the spike is cleared when it becomes current again */
+    for (int i = 1; i < FRAME_BANKS; i++)
+        frame_swap(true);
+    printf("  still resident: %s\n",
+           (long) (spike - rss()) < SPIKE_SIZE / 2 ? "ok" : "ERROR");
+    frame_swap(true);
+    printf("  decommit: %s\n",
+           (long) (spike - rss()) > SPIKE_SIZE / 2 ? "ok" : "ERROR");
+
+    frame_allocator_destroy();
+}
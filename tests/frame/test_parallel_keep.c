@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <dirent.h>
+#define FRAME_REALLOC
+#define FRAME_PARALLEL_KEEP
+#define FRAME_KEEP_SLOTS 16384
+#include "frame_allocator.h"
+
+
+/* Thousands of objects are kept and copied on each swap by several
+ * threads, half of them with a copy callback. Every object must be
+ * copied to the current bank with its value intact, whatever the
+ * number of threads. The workers are started once and reused by
+ * later swaps, and frame_allocator_destroy joins them.
+ */
+
+#define KEPT 5000
+
+DECLARE_FRAME_ALLOCATOR();
+
+long* objects[KEPT];
+
+
+void*
+copy_long(void* p)
+{
+    long* copy = frame_malloc(sizeof(long));
+
+    if (copy)
+        *copy = *(long*) p;
+
+    return copy;
+}
+
+int
+check(void)
+{
+    int errors = 0;
+    int bank = frame_get_bank_by_ptr(frame_malloc(1));
+
+    for (int i = 0; i < KEPT; i++)
+        if (!objects[i] || *objects[i] != i ||
+            frame_get_bank_by_ptr(objects[i]) != bank)
+            errors++;
+
+    return errors;
+}
+
+/* Count the threads of the process */
+int
+count_threads(void)
+{
+    DIR* dir = opendir("/proc/self/task");
+    struct dirent* entry;
+    int n = 0;
+
+    if (!dir)
+        return -1;
+    while ((entry = readdir(dir)))
+        if (entry->d_name[0] != '.')
+            n++;
+    closedir(dir);
+
+    return n;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (frame_allocator_init(KEPT * 64)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < KEPT; i++) {
+        objects[i] = frame_malloc(sizeof(long));
+        *objects[i] = i;
+        frame_keep_ptr((void**) &objects[i], i % 2 ? copy_long : NULL);
+    }
+
+    static const int threads[] = { 4, 1, 3, 8 };
+    for (int round = 0; round < 4; round++) {
+        frame_set_keep_threads(threads[round]);
+        frame_swap(true);
+        printf("  %d threads: %d errors\n", threads[round], check());
+    }
+
+    for (int round = 0; round < 100; round++)
+        frame_swap(true);
+    printf("  %d errors after reuse, %d threads, %s\n", check(), count_threads(),
+           count_threads() == 8 ? "ok" : "ERROR");
+    frame_allocator_destroy();
+    printf("  threads after destroy: %d, %s\n", count_threads(),
+           count_threads() == 1 ? "ok" : "ERROR");
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <string.h>
+#define FRAME_PREZERO
+#define FRAME_MMAP
+#define FRAME_MMAP_KEEP (64 * 1024)
+#include "frame_allocator.h"
+
+
+/* The banks are cleared when frame_swap clears them, so frame_malloc0
+ * hands out memory without clearing it. We dirty every bank and check
+ * that the memory reads as zero once the bank has been swapped in
+ * again, both in the pages kept and in the pages decommitted.
+ */
+
+#define FRAME_SIZE (4 * 1024 * 1024)
+#define CHUNK_SIZE (256 * 1024)
+
+DECLARE_FRAME_ALLOCATOR();
+
+
+int
+is_zero(unsigned char* p, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        if (p[i])
+            return 0;
+
+    return 1;
+}
+
+void
+cb(void* p)
+{
+    (void) p;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (frame_allocator_init(FRAME_SIZE)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+
+    for (int round = 0; round < 2 * FRAME_BANKS; round++) {
+        int chunks = 0;
+        int zeroed = 0;
+        unsigned char* p;
+
+        while ((p = frame_malloc0(CHUNK_SIZE))) {
+            zeroed += is_zero(p, CHUNK_SIZE);
+            memset(p, 0xff, CHUNK_SIZE);
+            chunks++;
+        }
+        printf("  round %d: %d of %d chunks zero, %s\n", round, zeroed, chunks,
+               chunks && zeroed == chunks ? "ok" : "ERROR");
+        frame_swap(true);
+    }
+
+    unsigned char* a = frame_malloc_with_cleanup(CHUNK_SIZE, cb);
+    printf("  with clean up: %s\n", a && is_zero(a, CHUNK_SIZE) ? "ok" : "ERROR");
+
+    frame_allocator_destroy();
+}
@@ -0,0 +1,47 @@
+#if defined(WIN32) || defined(_WIN32) || defined (__WIN32__)
+# include "config_windows.h"
+#endif
+#include <stdio.h>
+#define FRAME_BANKS 3
+#include "frame_allocator.h"
+
+
+/* With three banks an allocation stays valid for two swaps. Each
+ * frame produces a value, the next frame transforms it and the
+ * frame after that consumes it without copying.
+ */
+
+DECLARE_FRAME_ALLOCATOR();
+
+void cb(int* a)
+{
+    printf("  Destroy: %d\n", *a);
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    frame_allocator_init(4096);
+
+    int* produced = NULL;
+    int* transformed = NULL;
+    for (int frame = 0; frame < 6; frame++) {
+        if (transformed)
+            printf("  frame %d: consume %d (generation %ld)\n", frame, *transformed,
+                   frame_get_generation_by_ptr(transformed));
+        if (produced)
+            *produced *= 10;
+        transformed = produced;
+        produced = frame_malloc_with_cleanup(sizeof(int), (void (*)(void*)) cb);
+        *produced = frame + 1;
+        printf("  frame %d: produce %d in bank %d\n", frame, *produced,
+               frame_get_bank_by_ptr(produced));
+        frame_swap(true);
+    }
+
+    frame_allocator_destroy();
+}
@@ -0,0 +1,106 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#define FRAME_MMAP
+#define FRAME_MMAP_KEEP (64 * 1024)
+#define FRAME_ADAPTIVE
+#define FRAME_SPILL_SIZE (64 * 1024)
+#define LOGGER_DEBUG(...) do {} while (0)
+#include "frame_allocator.h"
+
+
+/* The banks are smaller than the objects, so every object spills.
+ * One thread looks up the objects of the recent frames, most of
+ * which have already been freed, while another thread swaps as fast
+ * as it can and unmaps the spill blocks of the banks it clears. Both
+ * threads run on the same CPU, so the lookups are preempted and held
+ * across many swaps. A lookup must neither touch the unmapped blocks
+ * nor find a bank for a pointer of the current frame other than the
+ * current one.
+ */
+
+#define FRAME_SIZE (64 * 1024)
+#define OBJECT_SIZE (80 * 1024)
+#define OBJECTS 16
+#define ROUNDS 2000
+
+DECLARE_FRAME_ALLOCATOR();
+
+void* volatile objects[OBJECTS];
+volatile int done;
+int lookups;
+int errors;
+
+
+void*
+thread_lookup_cb(void* arg)
+{
+    (void) arg;
+
+    while (!done) {
+        for (int i = 0; i < OBJECTS; i++) {
+            int bank = frame_get_bank_by_ptr(objects[i]);
+
+            if (bank < -1 || bank >= FRAME_BANKS)
+                errors++;
+            lookups++;
+        }
+    }
+
+    return NULL;
+}
+
+/* Run the calling thread on the first CPU */
+void
+pin(pthread_t thread)
+{
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(0, &cpus);
+    pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpus);
+}
+
+int main(int argc, char** argv)
+{
+    pthread_t lookup;
+    int failures = 0;
+
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (frame_allocator_init(FRAME_SIZE)) {
+        printf("Unable to reserve enough memory\n");
+        return 1;
+    }
+
+    pin(pthread_self());
+    pthread_create(&lookup, NULL, thread_lookup_cb, NULL);
+    pin(lookup);
+    for (int round = 0; round < ROUNDS; round++) {
+        int bank = frame_get_bank_by_ptr(frame_malloc(1));
+
+        for (int i = 0; i < OBJECTS; i++) {
+            void* p = frame_malloc(OBJECT_SIZE);
+
+            if (!p) {
+                failures++;
+                continue;
+            }
+            if (frame_get_bank_by_ptr(p) != bank)
+                errors++;
+            objects[i] = p;
+        }
+        frame_swap(true);
+    }
+    done = 1;
+    pthread_join(lookup, NULL);
+
+    printf("  %d lookups, %d errors, %d failures, %s\n", lookups, errors,
+           failures, lookups && !errors && !failures ? "ok" : "ERROR");
+
+    frame_allocator_destroy();
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#define FRAME_BANKS 4
+#define FRAME_MMAP
+#define FRAME_MMAP_KEEP (64 * 1024)
+#define FRAME_ADAPTIVE
+#define FRAME_SPILL_SIZE (64 * 1024)
+#define FRAME_REALLOC
+#define LOGGER_DEBUG(...) do {} while (0)
+#include "frame_allocator.h"
+
+
+/* The banks are smaller than the objects, so every object spills.
+ * One thread reallocates spilled objects, which looks them up in the
+ * spill lists of all banks, while another thread swaps and unmaps
+ * the spill blocks of the banks it clears. The swapper is let run at
+ * most FRAME_BANKS - 2 swaps ahead of each round, so the objects of
+ * the round stay valid, while the lists of older rounds are freed
+ * under the lookups.
+ */
+
+#define FRAME_SIZE (64 * 1024)
+#define OBJECT_SIZE (80 * 1024)
+#define ROUNDS 2000
+#define REALLOCS 8
+
+DECLARE_FRAME_ALLOCATOR();
+
+volatile int swaps;
+volatile int released;
+volatile int done;
+
+
+void*
+thread_swap_cb(void* arg)
+{
+    (void) arg;
+
+    while (!done) {
+        if (swaps < released) {
+            frame_swap(true);
+            swaps++;
+        } else
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    pthread_t swapper;
+    int errors = 0;
+    int failures = 0;
+
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (frame_allocator_init(FRAME_SIZE)) {
+        printf("Unable to reserve enough memory\n");
+        return 1;
+    }
+
+    pthread_create(&swapper, NULL, thread_swap_cb, NULL);
+    for (int round = 0; round < ROUNDS; round++) {
+        released = swaps + FRAME_BANKS - 2;
+
+        unsigned char* p = frame_malloc(OBJECT_SIZE);
+        size_t size = OBJECT_SIZE;
+
+        if (!p) {
+            failures++;
+            continue;
+        }
+        memset(p, round & 0xff, size);
+        for (int i = 0; i < REALLOCS; i++) {
+            unsigned char* q = frame_realloc(p, size + FRAME_MIN_ALIGN);
+
+            if (!q) {
+                failures++;
+                break;
+            }
+            if (q[0] != (round & 0xff) || q[size - 1] != (round & 0xff) ||
+                frame_get_bank_by_ptr(q) < 0)
+                errors++;
+            size += FRAME_MIN_ALIGN;
+            q[size - 1] = round & 0xff;
+            p = q;
+        }
+    }
+    done = 1;
+    pthread_join(swapper, NULL);
+
+    printf("  %d swaps, %d errors, %d failures, %s\n", swaps, errors, failures,
+           swaps && !errors && !failures ? "ok" : "ERROR");
+
+    frame_allocator_destroy();
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#define FRAME_MMAP
+#define FRAME_MMAP_KEEP (64 * 1024)
+#define FRAME_ADAPTIVE
+#define FRAME_SPILL_SIZE (64 * 1024)
+#define FRAME_SPILL_BLOCKS 4
+#define LOGGER_DEBUG(...) do {} while (0)
+#include "frame_allocator.h"
+
+
+/* Many threads overflow the same bank at the same time, so they race
+ * to map its spill blocks. Only one block may be linked per race, so
+ * the memory mapped for the spill blocks must stay within a small
+ * factor of the bytes allocated from them. The table of block ranges
+ * has only FRAME_SPILL_BLOCKS entries and must be chained to more
+ * parts instead of failing. All objects must keep their contents and
+ * be found in the current bank.
+ */
+
+#define NBR_OF_THREADS 8
+#define ALLOCS_PER_THREAD 4000
+#define OBJECT_SIZE 1000
+#define ROUNDS 4
+
+DECLARE_FRAME_ALLOCATOR();
+
+pthread_barrier_t barrier;
+unsigned char* ptrs[NBR_OF_THREADS][ALLOCS_PER_THREAD];
+int failures;
+
+
+void*
+thread_cb(void* arg)
+{
+    int id = (int) (intptr_t) arg;
+
+    pthread_barrier_wait(&barrier);
+    for (int i = 0; i < ALLOCS_PER_THREAD; i++) {
+        unsigned char* p = frame_malloc(OBJECT_SIZE);
+
+        if (!p) {
+            __atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        memset(p, (id * ALLOCS_PER_THREAD + i) & 0xff, OBJECT_SIZE);
+        ptrs[id][i] = p;
+    }
+
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    int errors = 0;
+
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (frame_allocator_init(64 * 1024)) {
+        printf("Unable to reserve enough memory\n");
+        return 1;
+    }
+    pthread_barrier_init(&barrier, NULL, NBR_OF_THREADS);
+
+    for (int round = 0; round < ROUNDS; round++) {
+        pthread_t id[NBR_OF_THREADS];
+        int bank = frame_get_bank_by_ptr(frame_malloc(1));
+
+        memset(ptrs, 0, sizeof(ptrs));
+        for (int i = 0; i < NBR_OF_THREADS; i++)
+            pthread_create(&id[i], NULL, thread_cb, (void*) (intptr_t) i);
+        for (int i = 0; i < NBR_OF_THREADS; i++)
+            pthread_join(id[i], NULL);
+
+        for (int t = 0; t < NBR_OF_THREADS; t++)
+            for (int i = 0; i < ALLOCS_PER_THREAD; i++) {
+                unsigned char* p = ptrs[t][i];
+                unsigned char v = (t * ALLOCS_PER_THREAD + i) & 0xff;
+
+                if (p && (p[0] != v || p[OBJECT_SIZE - 1] != v ||
+                          frame_get_bank_by_ptr(p) != bank))
+                    errors++;
+            }
+
+        size_t spilled = frame_allocator_spilled();
+        frame_spill_table_t* table = &_frame_allocator->spill_table;
+
+        printf("  Round %d: %zu blocks, %zu KB mapped for %zu KB spilled, %s\n",
+               round, table->count, table->size / 1024, spilled / 1024,
+               table->count > FRAME_SPILL_BLOCKS &&
+               table->size <= 4 * spilled + FRAME_SPILL_SIZE ? "ok" : "ERROR");
+        frame_swap(true);
+    }
+
+    printf("  %d errors, %d failures, %s\n", errors, failures,
+           !errors && !failures ? "ok" : "ERROR");
+
+    pthread_barrier_destroy(&barrier);
+    frame_allocator_destroy();
+}
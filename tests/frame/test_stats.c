@@ -0,0 +1,76 @@
+#if defined(WIN32) || defined(_WIN32) || defined (__WIN32__)
+# include "config_windows.h"
+#endif
+#include <stdio.h>
+#define FRAME_REALLOC
+#define FRAME_STATS
+#include "frame_allocator.h"
+
+
+/* We allocate a different amount in each frame and keep one object
+ * alive across the swaps. The statistics must count allocations,
+ * clean ups, keep list copies and the largest frame, and report the
+ * bytes in use at each of the recent swaps.
+ */
+
+#define NBR_OF_FRAMES 5
+
+DECLARE_FRAME_ALLOCATOR();
+
+void cb(void* p)
+{
+    (void) p;
+}
+
+#define CHECK(name,value,expected)                                     \
+    printf("  %s: %zu %s\n", name, (size_t) (value), (value) == (expected) ? "ok" : "ERROR")
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    frame_allocator_init(64*1024);
+
+    int* kept = frame_malloc(sizeof(int));
+    frame_keep_ptr((void**) &kept, NULL);
+
+    size_t allocs = 1;
+    size_t largest = 0;
+    size_t used[NBR_OF_FRAMES];
+    for (int frame = 0; frame < NBR_OF_FRAMES; frame++) {
+        for (int i = 0; i < (frame + 1) * 100; i++)
+            frame_malloc_with_cleanup(sizeof(int), cb);
+        allocs += (frame + 1) * 100;
+        used[frame] = frame_allocator_stats().used;
+        if (used[frame] > largest)
+            largest = used[frame];
+        frame_swap(true);
+        allocs++; /* copy of the kept object */
+    }
+
+    while (frame_malloc(1000))
+        allocs++;
+
+    frame_stats_t stats = frame_allocator_stats();
+    CHECK("allocations", stats.allocations, allocs);
+    CHECK("failures", stats.failures, 1);
+    CHECK("swaps", stats.swaps, NBR_OF_FRAMES);
+    CHECK("keep copies", stats.keep_copies, NBR_OF_FRAMES);
+    CHECK("high water", stats.high_water, largest);
+    CHECK("last used", stats.last_used, used[NBR_OF_FRAMES - 1]);
+    int recent = 1;
+    for (int frame = 0; frame < NBR_OF_FRAMES; frame++)
+        recent &= stats.recent_used[NBR_OF_FRAMES - 1 - frame] == used[frame];
+    recent &= stats.recent_used[NBR_OF_FRAMES] == 0;
+    CHECK("recent swaps", recent, 1);
+    /* The clean ups of the frames still in the banks are run at destroy */
+    size_t cleanups = 0;
+    for (int frame = 0; frame <= NBR_OF_FRAMES - FRAME_BANKS; frame++)
+        cleanups += (frame + 1) * 100;
+    CHECK("cleanups", stats.cleanups, cleanups);
+
+    frame_allocator_destroy();
+}
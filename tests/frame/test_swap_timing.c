@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <unistd.h>
+#define FRAME_REALLOC
+#define FRAME_SWAP_TIMING
+#include "frame_allocator.h"
+
+
+/* Every frame registers a clean up callback which sleeps and keeps
+ * an object, so the clean up and the keep phases of each swap take
+ * some time. The histogram must count every swap with its percentiles
+ * in order, the clean up must not look faster than the sleep, the log
+ * must return the latest swaps oldest first and the phases must add
+ * up to no more than the whole swap.
+ */
+
+#define SWAPS 50
+#define SLEEP_US 200
+
+DECLARE_FRAME_ALLOCATOR();
+
+int* kept;
+
+
+void
+cb(void* p)
+{
+    (void) p;
+    usleep(SLEEP_US);
+}
+
+int
+ordered(frame_swap_timing_t t)
+{
+    return t.min_ns <= t.p50_ns && t.p50_ns <= t.p90_ns &&
+            t.p90_ns <= t.p99_ns && t.p99_ns <= t.p999_ns &&
+            t.p999_ns <= t.max_ns && t.min_ns <= t.mean_ns &&
+            t.mean_ns <= t.max_ns;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    frame_allocator_init(1024 * 1024);
+
+    kept = frame_malloc(sizeof(int));
+    *kept = 42;
+    frame_keep_ptr((void**) &kept, NULL);
+    for (int i = 0; i < SWAPS; i++) {
+        frame_malloc_with_cleanup(sizeof(int), cb);
+        frame_swap(true);
+    }
+
+    int errors = 0;
+    for (int phase = 0; phase < FRAME_SWAP_PHASES; phase++) {
+        frame_swap_timing_t t = frame_swap_timing(phase);
+        errors += t.count != SWAPS || !ordered(t);
+    }
+    printf("  %d swaps counted in every phase, %s\n", SWAPS,
+           errors ? "ERROR" : "ok");
+
+    frame_swap_timing_t clean_up = frame_swap_timing(FRAME_SWAP_CLEAN_UP);
+    frame_swap_timing_t total = frame_swap_timing(FRAME_SWAP_TOTAL);
+    printf("  clean up p50 >= %d us, total p50 >= clean up p50: %s\n",
+           SLEEP_US, clean_up.p50_ns >= SLEEP_US * 1000 &&
+           total.p50_ns >= clean_up.p50_ns ? "ok" : "ERROR");
+
+    frame_swap_record_t records[SWAPS + 10];
+    size_t n = frame_swap_log(records, SWAPS + 10);
+    errors = n != SWAPS;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t sum = 0;
+        for (int phase = 0; phase < FRAME_SWAP_TOTAL; phase++)
+            sum += records[i].ns[phase];
+        errors += sum > records[i].ns[FRAME_SWAP_TOTAL];
+        errors += i && records[i].generation != records[i - 1].generation + 1;
+    }
+    n = frame_swap_log(records, 10);
+    errors += n != 10 || records[9].generation != records[0].generation + 9;
+    printf("  log of %zu swaps in order, %s\n", n, errors ? "ERROR" : "ok");
+    printf("  kept object %s\n", *kept == 42 ? "ok" : "ERROR");
+
+    frame_allocator_destroy();
+}
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <pthread.h>
+#define FRAME_TLAB
+#include "frame_allocator.h"
+
+
+/* We run multiple threads which allocate integers from thread
+ * local allocation buffers. Between the rounds banks are swapped
+ * and we check that no allocation was overwritten by another
+ * thread and that all allocations came from the current bank.
+ */
+
+#define NBR_OF_THREADS 4
+#define ALLOCS_PER_THREAD 10000
+
+DECLARE_FRAME_ALLOCATOR();
+DECLARE_FRAME_TLAB();
+
+int* ptrs[NBR_OF_THREADS][ALLOCS_PER_THREAD];
+
+
+void*
+thread_cb(void* arg)
+{
+    int id = (int) (intptr_t) arg;
+
+    for (int i=0; i < ALLOCS_PER_THREAD; i++) {
+        int* a = frame_malloc(sizeof(int));
+        if (!a) {
+            printf("ALLOCATION ERROR\n");
+            return NULL;
+        }
+        *a = id * ALLOCS_PER_THREAD + i;
+        ptrs[id][i] = a;
+    }
+
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (frame_allocator_init(NBR_OF_THREADS * ALLOCS_PER_THREAD * 64)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+
+    for (int round=0; round < 4; round++) {
+        pthread_t id[NBR_OF_THREADS];
+        for (int i=0; i < NBR_OF_THREADS; i++)
+            pthread_create(&id[i], NULL, thread_cb, (void*) (intptr_t) i);
+        for (int i=0; i < NBR_OF_THREADS; i++)
+            pthread_join(id[i], NULL);
+
+        int errors = 0;
+        int bank = frame_get_bank_by_ptr(ptrs[0][0]);
+        for (int t=0; t < NBR_OF_THREADS; t++)
+            for (int i=0; i < ALLOCS_PER_THREAD; i++)
+                if (!ptrs[t][i] || *ptrs[t][i] != t * ALLOCS_PER_THREAD + i ||
+                    frame_get_bank_by_ptr(ptrs[t][i]) != bank)
+                    errors++;
+        printf("  Round %d: bank %d, %d errors\n", round, bank, errors);
+
+        frame_swap(true);
+    }
+
+    frame_allocator_destroy();
+}
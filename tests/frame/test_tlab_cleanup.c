@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <pthread.h>
+#define FRAME_TLAB
+#include "frame_allocator.h"
+
+
+/* We run multiple threads which allocate objects with clean up
+ * callbacks from thread local allocation buffers. The records go to
+ * the lists of the threads, which are linked to the bank once per
+ * thread. When the bank is cleared by a swap, we check that every
+ * callback is run once and that the callbacks of each thread are run
+ * in reverse order of registration.
+ */
+
+#define NBR_OF_THREADS 4
+#define ALLOCS_PER_THREAD 10000
+
+DECLARE_FRAME_ALLOCATOR();
+DECLARE_FRAME_TLAB();
+
+int last[NBR_OF_THREADS];
+int calls;
+int errors;
+
+
+void
+cb(int* a)
+{
+    int id = *a / ALLOCS_PER_THREAD;
+    int i = *a % ALLOCS_PER_THREAD;
+
+    if (i != last[id] - 1)
+        errors++;
+    last[id] = i;
+    calls++;
+}
+
+void*
+thread_cb(void* arg)
+{
+    int id = (int) (intptr_t) arg;
+
+    for (int i=0; i < ALLOCS_PER_THREAD; i++) {
+        int* a = frame_malloc_with_cleanup(sizeof(int), (void (*)(void*)) cb);
+        if (!a) {
+            printf("ALLOCATION ERROR\n");
+            return NULL;
+        }
+        *a = id * ALLOCS_PER_THREAD + i;
+    }
+
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (frame_allocator_init(NBR_OF_THREADS * ALLOCS_PER_THREAD * 128)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+
+    for (int round=0; round < 2 * FRAME_BANKS; round++) {
+        pthread_t id[NBR_OF_THREADS];
+        for (int i=0; i < NBR_OF_THREADS; i++)
+            pthread_create(&id[i], NULL, thread_cb, (void*) (intptr_t) i);
+        for (int i=0; i < NBR_OF_THREADS; i++)
+            pthread_join(id[i], NULL);
+
+        for (int i=0; i < NBR_OF_THREADS; i++)
+            last[i] = ALLOCS_PER_THREAD;
+        calls = 0;
+        errors = 0;
+        for (int i=0; i < FRAME_BANKS; i++)
+            frame_swap(true);
+        printf("  Round %d: %d of %d callbacks run, %d out of order\n", round,
+               calls, NBR_OF_THREADS * ALLOCS_PER_THREAD, errors);
+    }
+
+    frame_allocator_destroy();
+}
@@ -0,0 +1,62 @@
+#if defined(WIN32) || defined(_WIN32) || defined (__WIN32__)
+# include "config_windows.h"
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include "pool_allocator.h"
+
+
+/* Objects are carved until the pool is full. Freed objects are
+ * reused in LIFO order, and clearing the pool makes all of it
+ * available again.
+ */
+
+typedef struct {
+    int id;
+    char name[20];
+} connection_t;
+
+DECLARE_POOL_ALLOCATOR();
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    pool_allocator_init(sizeof(connection_t), 4096);
+
+    int n = 0;
+    int misaligned = 0;
+    connection_t* c;
+    connection_t* first = NULL;
+    connection_t* last = NULL;
+    while ((c = pool_malloc())) {
+        if ((uintptr_t) c % POOL_MIN_ALIGN)
+            misaligned++;
+        c->id = n++;
+        if (!first)
+            first = c;
+        last = c;
+    }
+    printf("  %d objects of %zu bytes, %d misaligned\n", n,
+           _pool_allocator->object_size, misaligned);
+    printf("  ids: first %d, last %d\n", first->id, last->id);
+
+    pool_free(first);
+    pool_free(last);
+    c = pool_malloc();
+    printf("  reused last freed: %s\n", c == last ? "ok" : "ERROR");
+    c = pool_malloc();
+    printf("  reused first freed: %s\n", c == first ? "ok" : "ERROR");
+    printf("  full: %s\n", pool_malloc() ? "ERROR" : "ok");
+
+    pool_allocator_clear();
+    int m = 0;
+    while (pool_malloc0())
+        m++;
+    printf("  after clear: %d objects %s\n", m, m == n ? "ok" : "ERROR");
+
+    pool_allocator_destroy();
+}
@@ -0,0 +1,87 @@
+#if defined(WIN32) || defined(_WIN32) || defined (__WIN32__)
+# include "config_windows.h"
+#endif
+#include <stdio.h>
+#include <pthread.h>
+#include "pool_allocator.h"
+
+
+/* Threads allocate objects, swap them with each other through a
+ * shared table and free the objects they get, so most objects are
+ * freed by another thread than the one that allocated them. An
+ * object must never be handed out twice, and every object must be
+ * back in the pool at the end.
+ */
+
+#define NBR_OF_THREADS 4
+#define ROUNDS 100000
+#define TABLE_SIZE 64
+
+typedef struct {
+    uint32_t link;      /* overwritten by the free list */
+    volatile int in_use;
+    int owner;
+} object_t;
+
+DECLARE_POOL_ALLOCATOR();
+
+object_t* volatile table[TABLE_SIZE];
+int errors;
+int failures;
+
+void*
+thread_cb(void* arg)
+{
+    int id = (int) (intptr_t) arg;
+    unsigned seed = id;
+
+    for (int i = 0; i < ROUNDS; i++) {
+        object_t* o = pool_malloc();
+
+        if (!o) {
+            __atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_exchange_n(&o->in_use, 1, __ATOMIC_ACQ_REL))
+            __atomic_fetch_add(&errors, 1, __ATOMIC_RELAXED);
+        o->owner = id;
+
+        o = __atomic_exchange_n(&table[rand_r(&seed) % TABLE_SIZE], o, __ATOMIC_ACQ_REL);
+        if (o) {
+            if (!o->in_use || o->owner < 0 || o->owner >= NBR_OF_THREADS)
+                __atomic_fetch_add(&errors, 1, __ATOMIC_RELAXED);
+            o->in_use = 0;
+            pool_free(o);
+        }
+    }
+
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    pool_allocator_init(sizeof(object_t), 64 * 1024);
+    size_t capacity = (64 * 1024 - sizeof(pool_allocator_t) - CACHE_LINE_SIZE) /
+                      _pool_allocator->object_size;
+
+    pthread_t id[NBR_OF_THREADS];
+    for (intptr_t t = 0; t < NBR_OF_THREADS; t++)
+        pthread_create(&id[t], NULL, thread_cb, (void*) t);
+    for (int t = 0; t < NBR_OF_THREADS; t++)
+        pthread_join(id[t], NULL);
+    printf("  %d errors, %d failures\n", errors, failures);
+
+    for (int i = 0; i < TABLE_SIZE; i++)
+        pool_free(table[i]);
+    size_t n = 0;
+    while (pool_malloc())
+        n++;
+    printf("  all objects back: %s\n", n >= capacity ? "ok" : "ERROR");
+
+    pool_allocator_destroy();
+}
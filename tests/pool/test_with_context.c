@@ -0,0 +1,46 @@
+#if defined(WIN32) || defined(_WIN32) || defined (__WIN32__)
+# include "config_windows.h"
+#endif
+#include <stdio.h>
+#define POOL_WITH_CONTEXT
+#include "pool_allocator.h"
+
+
+/* Two pools with objects of different sizes */
+
+typedef struct {
+    int id;
+    long deadline;
+} timer_t_;
+
+typedef struct {
+    int fd;
+    char buffer[200];
+} connection_t;
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    pool_allocator_t* timers;
+    pool_allocator_t* connections;
+    pool_allocator_init(&timers, sizeof(timer_t_), 4096);
+    pool_allocator_init(&connections, sizeof(connection_t), 4096);
+
+    timer_t_* t = pool_malloc(timers);
+    t->id = 1;
+    connection_t* c = pool_malloc(connections);
+    c->fd = 2;
+    printf("  timer=%d, connection=%d\n", t->id, c->fd);
+    printf("  object sizes: %zu and %zu\n", timers->object_size, connections->object_size);
+    pool_free(timers, t);
+    pool_free(connections, c);
+    printf("  reused: %s\n", pool_malloc(timers) == t && pool_malloc(connections) == c ?
+           "ok" : "ERROR");
+
+    pool_allocator_destroy(timers);
+    pool_allocator_destroy(connections);
+}
@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <string.h>
+#define REGION_GROW_UP
+#define REGION_REALLOC
+#include "region_allocator.h"
+
+
+/* With REGION_GROW_UP objects allocated one after another are laid
+ * out in ascending address order. The region is filled until it is
+ * full, and the space is reused after the region has been cleared.
+ * The most recent allocation grows in place without being moved.
+ */
+
+#define REGION_SIZE (64 * 1024)
+#define ALLOC_SIZE 40
+
+DECLARE_REGION_ALLOCATOR();
+
+unsigned char* ptrs[REGION_SIZE / ALLOC_SIZE];
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (region_allocator_init(REGION_SIZE)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+
+    for (int round = 0; round < 2; round++) {
+        int count = 0;
+        int errors = 0;
+
+        while ((ptrs[count] = region_malloc(ALLOC_SIZE))) {
+            memset(ptrs[count], round + 1, ALLOC_SIZE);
+            if (count > 0 && ptrs[count] < ptrs[count - 1] + ALLOC_SIZE)
+                errors++;
+            count++;
+        }
+        for (int i = 0; i < count; i++)
+            if (ptrs[i][0] != round + 1 || ptrs[i][ALLOC_SIZE - 1] != round + 1)
+                errors++;
+        printf("  Round %d: %d errors, region %s\n", round, errors,
+               region_allocator_used() > REGION_SIZE - 256 ? "filled" : "ERROR");
+        region_allocator_clear();
+    }
+
+    char* s = region_malloc(8);
+    strcpy(s, "grow");
+    char* t = region_realloc(s, 4096);
+    strcat(t, " in place");
+    printf("  %s: %s\n", t, t == s ? "ok" : "ERROR: moved");
+
+    region_allocator_destroy();
+}
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <pthread.h>
+#define REGION_GROWABLE
+#include "region_allocator.h"
+
+
+/* We start with a small region and let multiple threads allocate
+ * much more than it can hold. The region grows by linking in new
+ * blocks. After clearing, only the initial and the largest block
+ * are kept. Requests too large for any block must fail without
+ * growing the region. Finally we check that the memory limit is
+ * respected.
+ */
+
+#define NBR_OF_THREADS 4
+#define ALLOCS_PER_THREAD 20000
+
+DECLARE_REGION_ALLOCATOR();
+
+int* ptrs[NBR_OF_THREADS][ALLOCS_PER_THREAD];
+
+
+void*
+thread_cb(void* arg)
+{
+    int id = (int) (intptr_t) arg;
+
+    for (int i=0; i < ALLOCS_PER_THREAD; i++) {
+        int* a = region_malloc(sizeof(int));
+        if (!a) {
+            printf("ALLOCATION ERROR\n");
+            return NULL;
+        }
+        *a = id * ALLOCS_PER_THREAD + i;
+        ptrs[id][i] = a;
+    }
+
+    return NULL;
+}
+
+int count_blocks(void)
+{
+    int n = 1;
+    for (region_allocator_t* b = _region_allocator->next; b; b = b->next)
+        n++;
+    return n;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (region_allocator_init(4096)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+
+    for (int round=0; round < 2; round++) {
+        pthread_t id[NBR_OF_THREADS];
+        for (int i=0; i < NBR_OF_THREADS; i++)
+            pthread_create(&id[i], NULL, thread_cb, (void*) (intptr_t) i);
+        for (int i=0; i < NBR_OF_THREADS; i++)
+            pthread_join(id[i], NULL);
+
+        int errors = 0;
+        for (int t=0; t < NBR_OF_THREADS; t++)
+            for (int i=0; i < ALLOCS_PER_THREAD; i++)
+                if (*ptrs[t][i] != t * ALLOCS_PER_THREAD + i)
+                    errors++;
+        printf("  Round %d: %d errors\n", round, errors);
+
+        region_allocator_clear();
+        printf("  Blocks after clear: %d\n", count_blocks());
+    }
+
+    size_t total = _region_allocator->total;
+    printf("  Size overflow: %s\n",
+           !region_malloc(SIZE_MAX) && !region_malloc(SIZE_MAX - 4) &&
+           !region_malloc_aligned(8, SIZE_MAX / 2 + 1) &&
+           !region_malloc_aligned(SIZE_MAX / 2 + 1, 8) &&
+           _region_allocator->total == total ? "ok" : "ERROR");
+
+    size_t limit = _region_allocator->total + 64 * 1024;
+    region_allocator_set_limit(limit);
+    int n = 0;
+    while (region_malloc(1000))
+        n++;
+    printf("  Limit: %s\n", _region_allocator->total <= limit && n > 0 ? "ok" : "ERROR");
+
+    region_allocator_destroy();
+}
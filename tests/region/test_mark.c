@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <string.h>
+#include "region_allocator.h"
+
+
+/* We do nested temporary work with marks. Rolling back to a mark
+ * runs only the clean ups registered after it and lets the memory
+ * be reused. Rolling back to the outer mark releases the inner work
+ * as well.
+ */
+
+DECLARE_REGION_ALLOCATOR();
+
+void cb(char* s)
+{
+    printf("  cleaning: '%s'\n", s);
+}
+
+char* alloc_str(const char* s)
+{
+    char* p = region_malloc_with_cleanup(strlen(s) + 1, (void (*)(void*)) cb);
+    strcpy(p, s);
+    return p;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (region_allocator_init(4096)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+
+    alloc_str("request");
+
+    region_mark_t parse = region_mark();
+    alloc_str("parse 1");
+    alloc_str("parse 2");
+
+    region_mark_t transform = region_mark();
+    void* scratch = region_malloc(100);
+    alloc_str("transform");
+    printf("Rollback transform\n");
+    region_rollback(transform);
+
+    void* reused = region_malloc(100);
+    printf("  memory reused: %s\n", reused == scratch ? "ok" : "ERROR");
+
+    alloc_str("parse 3");
+    printf("Rollback parse\n");
+    region_rollback(parse);
+
+    /* The region can be filled again after the rollback */
+    region_mark_t fill = region_mark();
+    int n = 0, m = 0;
+    while (region_malloc(64))
+        n++;
+    region_rollback(fill);
+    while (region_malloc(64))
+        m++;
+    printf("  refill: %s\n", n > 0 && n == m ? "ok" : "ERROR");
+
+    printf("Destroy\n");
+    region_allocator_destroy();
+}
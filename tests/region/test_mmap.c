@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#define REGION_MMAP
+#define REGION_MMAP_KEEP (64 * 1024)
+#include "region_allocator.h"
+
+
+/* We reserve a large region, but only the pages we touch are
+ * committed. After a spike the region is cleared and the resident
+ * memory drops back near the kept high-water mark.
+ */
+
+#define REGION_SIZE (256 * 1024 * 1024)
+#define SPIKE_SIZE (32 * 1024 * 1024)
+
+DECLARE_REGION_ALLOCATOR();
+
+/* Resident memory of the process in bytes */
+size_t rss(void)
+{
+    long pages = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        fclose(f);
+    }
+
+    return (size_t) resident * sysconf(_SC_PAGESIZE);
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    size_t base = rss();
+    if (region_allocator_init(REGION_SIZE)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+    printf("  lazy commit: %s\n", rss() - base < SPIKE_SIZE / 4 ? "ok" : "ERROR");
+
+    for (int round = 0; round < 2; round++) {
+        for (size_t n = 0; n < SPIKE_SIZE; n += 4096) {
+            char* p = region_malloc(4096);
+            if (!p) {
+                printf("ALLOCATION ERROR\n");
+                exit(1);
+            }
+            memset(p, 0xff, 4096);
+        }
+        size_t spike = rss();
+
+        region_allocator_clear();
+        size_t cleared = rss();
+        printf("  Round %d: decommit %s\n", round,
+               (long) (spike - cleared) > SPIKE_SIZE / 2 ? "ok" : "ERROR");
+    }
+
+    region_allocator_destroy();
+}
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <string.h>
+#define REGION_PREZERO
+#define REGION_REALLOC
+#define REGION_MMAP
+#define REGION_MMAP_KEEP (64 * 1024)
+#include "region_allocator.h"
+
+
+/* The memory is cleared when the region is cleared or rolled back, so
+ * region_malloc0 hands out memory without clearing it. We dirty the
+ * memory and check that every later allocation reads as zero, both
+ * in the pages kept and in the pages decommitted.
+ */
+
+#define REGION_SIZE (4 * 1024 * 1024)
+#define CHUNK_SIZE (256 * 1024)
+
+DECLARE_REGION_ALLOCATOR();
+
+
+int
+is_zero(unsigned char* p, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        if (p[i])
+            return 0;
+
+    return 1;
+}
+
+/* Fill the region with dirty chunks */
+int
+dirty(void)
+{
+    int chunks = 0;
+    void* p;
+
+    while ((p = region_malloc(CHUNK_SIZE))) {
+        memset(p, 0xff, CHUNK_SIZE);
+        chunks++;
+    }
+
+    return chunks;
+}
+
+/* Check that the whole region reads as zero again */
+int
+check(void)
+{
+    int chunks = 0;
+    unsigned char* p;
+
+    while ((p = region_malloc0(CHUNK_SIZE))) {
+        if (!is_zero(p, CHUNK_SIZE))
+            return -1;
+        chunks++;
+    }
+
+    return chunks;
+}
+
+void
+cb(void* p)
+{
+    (void) p;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (region_allocator_init(REGION_SIZE)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+
+    int chunks = dirty();
+    region_allocator_clear();
+    int zeroed = check();
+    printf("  clear: %d of %d chunks zero, %s\n", zeroed, chunks,
+           zeroed == chunks ? "ok" : "ERROR");
+    region_allocator_clear();
+
+    region_malloc(CHUNK_SIZE);
+    region_mark_t mark = region_mark();
+    chunks = dirty();
+    region_rollback(mark);
+    zeroed = check();
+    printf("  rollback: %d of %d chunks zero, %s\n", zeroed, chunks,
+           zeroed == chunks ? "ok" : "ERROR");
+    region_allocator_clear();
+
+    unsigned char* a = region_malloc(CHUNK_SIZE);
+    memset(a, 0xff, CHUNK_SIZE);
+    printf("  shrink keeps space: %s\n",
+           region_realloc(a, 16) == a && GET_REALLOC_SIZE(a) == 16 ?
+           "ok" : "ERROR");
+    a = region_malloc0(CHUNK_SIZE);
+    printf("  after shrink: %s\n", is_zero(a, CHUNK_SIZE) ? "ok" : "ERROR");
+    region_allocator_clear();
+
+    dirty();
+    region_allocator_clear();
+    a = region_malloc_with_cleanup(CHUNK_SIZE, cb);
+    printf("  with clean up: %s\n", a && is_zero(a, CHUNK_SIZE) ? "ok" : "ERROR");
+
+    region_allocator_destroy();
+}
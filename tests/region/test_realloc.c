@@ -0,0 +1,74 @@
+#if defined(WIN32) || defined(_WIN32) || defined (__WIN32__)
+# include "config_windows.h"
+#endif
+#include <stdio.h>
+#include <string.h>
+#define REGION_REALLOC
+#include "region_allocator.h"
+
+
+/* The oldest of many objects with clean up callbacks is grown again
+ * and again. Its clean up record is found from the object itself, so
+ * the length of the clean up list does not matter. Only the record
+ * of the last copy calls the callback. Objects without a callback
+ * cannot be reallocated with region_realloc_with_cleanup.
+ */
+
+#define NBR_OF_OBJECTS 100000
+#define GROWTHS 1000
+
+DECLARE_REGION_ALLOCATOR();
+
+int cleanups;
+int vector_cleanups;
+int* vector;
+
+void cb(int* a)
+{
+    cleanups++;
+    if (a == vector)
+        vector_cleanups++;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    region_allocator_init(32 * 1024 * 1024);
+
+    size_t n = 4;
+    vector = region_malloc_with_cleanup(n * sizeof(int), (void (*)(void*)) cb);
+    for (size_t i = 0; i < n; i++)
+        vector[i] = (int) i;
+    for (int i = 0; i < NBR_OF_OBJECTS; i++)
+        region_malloc_with_cleanup(sizeof(int), (void (*)(void*)) cb);
+
+    int errors = 0;
+    for (int g = 0; g < GROWTHS; g++) {
+        vector = region_realloc_with_cleanup(vector, (n + 4) * sizeof(int));
+        if (!vector) {
+            printf("  ERROR: realloc failed\n");
+            return 1;
+        }
+        for (size_t i = n; i < n + 4; i++)
+            vector[i] = (int) i;
+        n += 4;
+    }
+    for (size_t i = 0; i < n; i++)
+        if (vector[i] != (int) i)
+            errors++;
+    printf("  %zu elements, %d errors\n", n, errors);
+
+    void* plain = region_malloc(16);
+    printf("  without clean up: %s\n",
+           region_realloc_with_cleanup(plain, 32) ? "ERROR" : "NULL");
+
+    region_allocator_clear();
+    printf("  %d clean ups (expected %d), vector cleaned %d time(s)\n",
+           cleanups, NBR_OF_OBJECTS + 1, vector_cleanups);
+
+    region_allocator_destroy();
+}
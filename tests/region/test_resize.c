@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#define REGION_REALLOC
+#define REGION_MMAP
+#include "region_allocator.h"
+
+
+/* A string is built by growing it again and again. As long as it is
+ * the most recent allocation it grows in place and the region holds
+ * only one copy of it. Shrinking it returns the space to the region.
+ * An older object is copied, when it grows. Then threads build
+ * strings concurrently, so the resize often loses the race and the
+ * content is copied instead. Last, an object larger than 4 GiB keeps
+ * its size, when the address space allows it.
+ */
+
+#define NBR_OF_THREADS 4
+#define APPENDS 10000
+#define CHUNK "0123456789abcdef"
+#define CHUNK_SIZE 16
+
+DECLARE_REGION_ALLOCATOR();
+
+int errors[NBR_OF_THREADS];
+
+
+int
+check(char* s, size_t n)
+{
+    for (size_t i = 0; i < n; i += CHUNK_SIZE)
+        if (memcmp(s + i, CHUNK, CHUNK_SIZE))
+            return 1;
+
+    return 0;
+}
+
+void*
+thread_cb(void* arg)
+{
+    int id = (int) (intptr_t) arg;
+    char* s = NULL;
+    size_t n = 0;
+
+    for (int i = 0; i < APPENDS; i++) {
+        char* p = s ? region_realloc(s, n + CHUNK_SIZE) : region_malloc(CHUNK_SIZE);
+
+        if (!p) {
+            errors[id]++;
+            break;
+        }
+        s = p;
+        memcpy(s + n, CHUNK, CHUNK_SIZE);
+        n += CHUNK_SIZE;
+    }
+    errors[id] += check(s, n);
+
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    region_allocator_init(64 * 1024 * 1024);
+
+    size_t used = region_allocator_used();
+    char* s = region_malloc(CHUNK_SIZE);
+    size_t n = 0;
+    for (int i = 0; i < APPENDS; i++) {
+        s = region_realloc(s, n + CHUNK_SIZE);
+        memcpy(s + n, CHUNK, CHUNK_SIZE);
+        n += CHUNK_SIZE;
+    }
+    printf("  grown to %zu bytes using %zu bytes, %s\n", n,
+           region_allocator_used() - used, check(s, n) ? "ERROR" : "ok");
+
+    s = region_realloc(s, 100 * CHUNK_SIZE);
+    printf("  shrunk to %zu bytes using %zu bytes, %s\n",
+           GET_REALLOC_SIZE(s), region_allocator_used() - used,
+           check(s, 100 * CHUNK_SIZE) ? "ERROR" : "ok");
+
+    region_malloc(CHUNK_SIZE);
+    char* t = region_realloc(s, 200 * CHUNK_SIZE);
+    memcpy(t + 100 * CHUNK_SIZE, t, 100 * CHUNK_SIZE);
+    printf("  older object %s, %s\n", t == s ? "ERROR: not moved" : "copied",
+           check(t, 200 * CHUNK_SIZE) ? "ERROR" : "ok");
+    region_malloc(CHUNK_SIZE);
+    printf("  shrink of older object in place: %s\n",
+           region_realloc(t, CHUNK_SIZE) == t && GET_REALLOC_SIZE(t) == CHUNK_SIZE ?
+           "ok" : "ERROR");
+    region_allocator_clear();
+
+    pthread_t id[NBR_OF_THREADS];
+    for (int i = 0; i < NBR_OF_THREADS; i++)
+        pthread_create(&id[i], NULL, thread_cb, (void*) (intptr_t) i);
+    int total = 0;
+    for (int i = 0; i < NBR_OF_THREADS; i++) {
+        pthread_join(id[i], NULL);
+        total += errors[i];
+    }
+    printf("  %d threads: %d errors\n", NBR_OF_THREADS, total);
+    region_allocator_destroy();
+
+    if (sizeof(size_t) > 4 &&
+        !region_allocator_init((size_t) 6 * 1024 * 1024 * 1024)) {
+        size_t big = (size_t) 5 * 1024 * 1024 * 1024;
+        char* b = region_malloc(big);
+        printf("  object of %zu bytes: size %s\n", big,
+               b && GET_REALLOC_SIZE(b) == big ? "ok" : "ERROR");
+        region_allocator_destroy();
+    }
+}
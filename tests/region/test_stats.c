@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <pthread.h>
+#define REGION_STATS
+#include "region_allocator.h"
+
+
+/* Multiple threads allocate from the region with statistics enabled.
+ * The counters must add up exactly even though the threads update
+ * them concurrently. Then we fill the region to count failures and
+ * check the high-water mark after clearing. A second, empty clear
+ * must show in the usage of the recent clears but keep the mark.
+ */
+
+#define NBR_OF_THREADS 4
+#define ALLOCS_PER_THREAD 10000
+
+DECLARE_REGION_ALLOCATOR();
+
+void cb(void* p)
+{
+    (void) p;
+}
+
+void*
+thread_cb(void* arg)
+{
+    (void) arg;
+
+    for (int i=0; i < ALLOCS_PER_THREAD; i++) {
+        if (!region_malloc(sizeof(int)) ||
+            !region_malloc_with_cleanup(sizeof(int), cb)) {
+            printf("ALLOCATION ERROR\n");
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+#define CHECK(name,value,expected)                                     \
+    printf("  %s: %zu %s\n", name, (size_t) (value), (value) == (expected) ? "ok" : "ERROR")
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (region_allocator_init(4096*1024)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+
+    pthread_t id[NBR_OF_THREADS];
+    for (int i=0; i < NBR_OF_THREADS; i++)
+        pthread_create(&id[i], NULL, thread_cb, NULL);
+    for (int i=0; i < NBR_OF_THREADS; i++)
+        pthread_join(id[i], NULL);
+
+    region_stats_t stats = region_allocator_stats();
+    size_t allocs = 2 * NBR_OF_THREADS * ALLOCS_PER_THREAD;
+    CHECK("allocations", stats.allocations, allocs);
+    CHECK("bytes", stats.bytes, allocs * sizeof(int));
+    CHECK("failures", stats.failures, 0);
+    printf("  cas retries: %s\n", stats.cas_retries < allocs ? "ok" : "ERROR");
+
+    while (region_malloc(1000))
+        ;
+    stats = region_allocator_stats();
+    CHECK("failures", stats.failures, 1);
+    size_t used = stats.used;
+
+    region_allocator_clear();
+    stats = region_allocator_stats();
+    CHECK("cleanups", stats.cleanups, allocs / 2);
+    CHECK("high water", stats.high_water, used);
+    CHECK("used", stats.used, 0);
+    CHECK("last used", stats.last_used, used);
+
+    region_allocator_clear();
+    stats = region_allocator_stats();
+    CHECK("clears", stats.clears, 2);
+    CHECK("last used", stats.last_used, 0);
+    CHECK("previous used", stats.recent_used[1], used);
+    CHECK("high water", stats.high_water, used);
+
+    region_allocator_destroy();
+}
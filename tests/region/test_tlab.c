@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <pthread.h>
+#define REGION_TLAB
+#include "region_allocator.h"
+
+
+/* We run multiple threads which allocate integers from thread
+ * local allocation buffers. After all threads have finished we
+ * check that no allocation was overwritten by another thread.
+ */
+
+#define NBR_OF_THREADS 4
+#define ALLOCS_PER_THREAD 10000
+
+DECLARE_REGION_ALLOCATOR();
+DECLARE_REGION_TLAB();
+
+int* ptrs[NBR_OF_THREADS][ALLOCS_PER_THREAD];
+
+
+void*
+thread_cb(void* arg)
+{
+    int id = (int) (intptr_t) arg;
+
+    for (int i=0; i < ALLOCS_PER_THREAD; i++) {
+        int* a = region_malloc(sizeof(int));
+        if (!a) {
+            printf("ALLOCATION ERROR\n");
+            return NULL;
+        }
+        *a = id * ALLOCS_PER_THREAD + i;
+        ptrs[id][i] = a;
+    }
+
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (region_allocator_init(NBR_OF_THREADS * ALLOCS_PER_THREAD * 64)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+
+    for (int round=0; round < 2; round++) {
+        pthread_t id[NBR_OF_THREADS];
+        for (int i=0; i < NBR_OF_THREADS; i++)
+            pthread_create(&id[i], NULL, thread_cb, (void*) (intptr_t) i);
+        for (int i=0; i < NBR_OF_THREADS; i++)
+            pthread_join(id[i], NULL);
+
+        int errors = 0;
+        for (int t=0; t < NBR_OF_THREADS; t++)
+            for (int i=0; i < ALLOCS_PER_THREAD; i++)
+                if (!ptrs[t][i] || *ptrs[t][i] != t * ALLOCS_PER_THREAD + i)
+                    errors++;
+        printf("  Round %d: %d errors\n", round, errors);
+
+        region_allocator_clear();
+    }
+
+    region_allocator_destroy();
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#define REGION_WAIT_FREE
+#include "region_allocator.h"
+
+
+/* We run multiple threads which allocate from the region until it
+ * is full. Each allocation is filled with the id of the thread.
+ * Then we check that no allocation was overwritten and that the
+ * region can be reused after it has been cleared. In the last round
+ * other threads make requests larger than the region, which must fail
+ * without moving the frame pointer. The small requests must not fail
+ * before the region is full, so it is filled with as many allocations
+ * as in the first round. Last, requests whose rounded size wraps
+ * around must fail.
+ */
+
+#define NBR_OF_THREADS 4
+#define REGION_SIZE (64 * 1024)
+#define ALLOC_SIZE 24
+#define LARGE_REQUESTS 10000
+
+DECLARE_REGION_ALLOCATOR();
+
+unsigned char* ptrs[NBR_OF_THREADS][REGION_SIZE / ALLOC_SIZE];
+int counts[NBR_OF_THREADS];
+
+
+void*
+thread_cb(void* arg)
+{
+    int id = (int) (intptr_t) arg;
+    unsigned char* p;
+
+    counts[id] = 0;
+    while ((p = region_malloc(ALLOC_SIZE))) {
+        memset(p, id, ALLOC_SIZE);
+        ptrs[id][counts[id]++] = p;
+    }
+
+    return NULL;
+}
+
+void*
+thread_large_cb(void* arg)
+{
+    int* failures = arg;
+
+    for (int i=0; i < LARGE_REQUESTS; i++)
+        *failures += !region_malloc(2 * REGION_SIZE);
+
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    if (region_allocator_init(REGION_SIZE)) {
+        printf("Unable to allocate enough memory\n");
+        exit(1);
+    }
+
+    int first = 0;
+    for (int round=0; round < 3; round++) {
+        pthread_t id[NBR_OF_THREADS];
+        pthread_t large[2];
+        int failures[2] = { 0, 0 };
+        if (round == 2) {
+            for (int i=0; i < 2; i++)
+                pthread_create(&large[i], NULL, thread_large_cb, &failures[i]);
+        }
+        for (int i=0; i < NBR_OF_THREADS; i++)
+            pthread_create(&id[i], NULL, thread_cb, (void*) (intptr_t) i);
+        for (int i=0; i < NBR_OF_THREADS; i++)
+            pthread_join(id[i], NULL);
+        if (round == 2)
+            for (int i=0; i < 2; i++)
+                pthread_join(large[i], NULL);
+
+        int total = 0;
+        int errors = 0;
+        for (int t=0; t < NBR_OF_THREADS; t++) {
+            total += counts[t];
+            for (int i=0; i < counts[t]; i++)
+                for (int j=0; j < ALLOC_SIZE; j++)
+                    if (ptrs[t][i][j] != t)
+                        errors++;
+        }
+        if (!round)
+            first = total;
+        printf("  Round %d: %s, %d errors\n", round,
+               total > 0 && !region_malloc(ALLOC_SIZE) ? "full" : "NOT FULL",
+               errors);
+        if (round == 2)
+            printf("  %d large requests failed, %d of %d allocations: %s\n",
+                   failures[0] + failures[1], total, first,
+                   total == first &&
+                   failures[0] + failures[1] == 2 * LARGE_REQUESTS ?
+                   "ok" : "ERROR");
+
+        region_allocator_clear();
+    }
+
+    printf("  Size overflow: %s\n",
+           !region_malloc(SIZE_MAX) && !region_malloc(SIZE_MAX - 4) &&
+           !region_malloc_aligned(8, SIZE_MAX / 2 + 1) ? "ok" : "ERROR");
+
+    region_allocator_destroy();
+}
@@ -0,0 +1,53 @@
+#if defined(WIN32) || defined(_WIN32) || defined (__WIN32__)
+# include "config_windows.h"
+#endif
+#include <stdio.h>
+#include "smart_ptr_allocator.h"
+
+
+int cleanups = 0;
+
+void cb(void* a)
+{
+    (void) a;
+    cleanups++;
+}
+
+int check(const char* what, void* p, size_t align)
+{
+    if (!p || ((uintptr_t) p & (align - 1))) {
+        printf("  ERROR: %s %p is not aligned to %zu\n", what, p, align);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    int errors = 0;
+    int count = 0;
+    for (size_t align = 1; align <= 4096; align <<= 1) {
+        void* a = smart_ptr_malloc_aligned(3, align);
+        void* b = smart_ptr_malloc_aligned_with_cleanup(5, align, cb);
+        void* c = smart_ptr_malloc(7);
+        void* d = smart_ptr_malloc_with_cleanup(9, cb);
+        errors += check("smart_ptr_malloc_aligned", a, align);
+        errors += check("smart_ptr_malloc_aligned_with_cleanup", b, align);
+        errors += check("smart_ptr_malloc", c, SMART_PTR_MIN_ALIGN);
+        errors += check("smart_ptr_malloc_with_cleanup", d, SMART_PTR_MIN_ALIGN);
+        smart_ptr_ref(b);
+        smart_ptr_unref(a);
+        smart_ptr_unref(b);
+        smart_ptr_unref(b);
+        smart_ptr_unref(c);
+        smart_ptr_unref(d);
+        count += 2;
+    }
+    printf("  %d errors\n", errors);
+    printf("  %d clean ups (expected %d)\n", cleanups, count);
+}
@@ -0,0 +1,129 @@
+#if defined(WIN32) || defined(_WIN32) || defined (__WIN32__)
+# include "config_windows.h"
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#define SMART_PTR_BIASED
+#include "smart_ptr_allocator.h"
+
+
+/* The owner of an object counts its references in the biased count
+ * and other threads in the shared count. Objects released by other
+ * threads are queued to the owner, which merges the counts when it
+ * allocates or collects. After the owner has exited, the other
+ * threads merge the counts themselves.
+ */
+
+#define NBR_OF_THREADS 4
+#define NBR_OF_OBJECTS 10000
+
+DECLARE_SMART_PTR_BIASED();
+
+int destroyed;
+
+void cb(int* a)
+{
+    (void) a;
+    __atomic_fetch_add(&destroyed, 1, __ATOMIC_RELAXED);
+}
+
+int* objects[NBR_OF_OBJECTS];
+
+/* Drop the references passed by the owner */
+void*
+unref_cb(void* arg)
+{
+    intptr_t t = (intptr_t) arg;
+
+    for (int i = t; i < NBR_OF_OBJECTS; i += NBR_OF_THREADS)
+        smart_ptr_unref(objects[i]);
+
+    return NULL;
+}
+
+/* Take and drop references of its own */
+void*
+share_cb(void* arg)
+{
+    (void) arg;
+    for (int i = 0; i < NBR_OF_OBJECTS; i++) {
+        for (int n = 0; n < 10; n++)
+            smart_ptr_ref(objects[i]);
+        for (int n = 0; n < 10; n++)
+            smart_ptr_unref(objects[i]);
+    }
+
+    return NULL;
+}
+
+void*
+exit_cb(void* arg)
+{
+    (void) arg;
+    for (int i = 0; i < NBR_OF_OBJECTS; i++) {
+        objects[i] = smart_ptr_malloc_with_cleanup(sizeof(int), (void (*)(void*)) cb);
+        smart_ptr_unref(smart_ptr_ref(objects[i]));
+    }
+    smart_ptr_biased_thread_exit();
+
+    return NULL;
+}
+
+void
+check(const char* name, int expected)
+{
+    printf("  %s: %d destroyed %s\n", name, destroyed,
+           destroyed == expected ? "ok" : "ERROR");
+    destroyed = 0;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    int* a = smart_ptr_malloc_with_cleanup(sizeof(int), (void (*)(void*)) cb);
+    for (int n = 0; n < 10; n++)
+        smart_ptr_ref(a);
+    printf("  owner counts: biased %u, shared %d\n", *GET_BIASP(a),
+           (int) *GET_REFCOUNTP(a) >> REFCOUNT_SHIFT);
+    for (int n = 0; n < 10; n++)
+        smart_ptr_unref(a);
+    check("owner refs", 0);
+    smart_ptr_unref(a);
+    check("owner", 1);
+
+    pthread_t id[NBR_OF_THREADS];
+    for (int i = 0; i < NBR_OF_OBJECTS; i++)
+        objects[i] = smart_ptr_malloc_with_cleanup(sizeof(int), (void (*)(void*)) cb);
+    for (intptr_t t = 0; t < NBR_OF_THREADS; t++)
+        pthread_create(&id[t], NULL, unref_cb, (void*) t);
+    for (int t = 0; t < NBR_OF_THREADS; t++)
+        pthread_join(id[t], NULL);
+    check("before collect", 0);
+    smart_ptr_biased_collect();
+    check("passed to others", NBR_OF_OBJECTS);
+
+    for (int i = 0; i < NBR_OF_OBJECTS; i++)
+        objects[i] = smart_ptr_malloc_with_cleanup(sizeof(int), (void (*)(void*)) cb);
+    for (int t = 0; t < NBR_OF_THREADS; t++)
+        pthread_create(&id[t], NULL, share_cb, NULL);
+    for (int i = 0; i < NBR_OF_OBJECTS; i++) {
+        smart_ptr_ref(objects[i]);
+        smart_ptr_unref(objects[i]);
+    }
+    for (int t = 0; t < NBR_OF_THREADS; t++)
+        pthread_join(id[t], NULL);
+    for (int i = 0; i < NBR_OF_OBJECTS; i++)
+        smart_ptr_unref(objects[i]);
+    check("shared", NBR_OF_OBJECTS);
+
+    pthread_create(&id[0], NULL, exit_cb, NULL);
+    pthread_join(id[0], NULL);
+    for (int i = 0; i < NBR_OF_OBJECTS; i++)
+        smart_ptr_unref(objects[i]);
+    check("owner exited", NBR_OF_OBJECTS);
+}
@@ -0,0 +1,43 @@
+#if defined(WIN32) || defined(_WIN32) || defined (__WIN32__)
+# include "config_windows.h"
+#endif
+#include <stdio.h>
+#define SMART_PTR_SINGLE_THREADED
+#include "smart_ptr_allocator.h"
+
+
+/* Reference counts are updated without atomic operations. Strong
+ * and weak references work as in the thread safe mode.
+ */
+
+void cb(int* a)
+{
+    printf("  Destroy: %d\n", *a);
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    int* a = smart_ptr_malloc_with_cleanup(sizeof(int), (void (*)(void*)) cb);
+    *a = 1;
+    for (int n = 0; n < 1000; n++)
+        smart_ptr_ref(a);
+    printf("  count: %u\n", *GET_REFCOUNTP(a) >> REFCOUNT_SHIFT);
+    for (int n = 0; n < 1000; n++)
+        smart_ptr_unref(a);
+    printf("Dropping the last reference\n");
+    smart_ptr_unref(a);
+
+    int* b = smart_ptr_malloc_weakable(sizeof(int), (void (*)(void*)) cb);
+    *b = 2;
+    smart_ptr_weak_t* w = smart_ptr_weak(b);
+    smart_ptr_unref(smart_ptr_lock(w));
+    printf("Dropping the strong reference\n");
+    smart_ptr_unref(b);
+    printf("  lock after destroy: %s\n", smart_ptr_lock(w) ? "ERROR" : "ok");
+    smart_ptr_weak_unref(w);
+}
@@ -0,0 +1,124 @@
+#if defined(WIN32) || defined(_WIN32) || defined (__WIN32__)
+# include "config_windows.h"
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#define SMART_PTR_SLAB
+#include "smart_ptr_allocator.h"
+
+
+/* Small objects are allocated from the slabs of the thread cache and
+ * a freed block is reused by the next allocation of the same size.
+ * Large objects fall back to MALLOC. Objects allocated by one thread
+ * and freed by others return to the slabs of the owner through the
+ * remote lists. The cache of an exited thread is adopted by the next
+ * thread.
+ */
+
+#define NBR_OF_THREADS 4
+#define NBR_OF_OBJECTS 10000
+
+DECLARE_SMART_PTR_SLAB();
+
+int cleanups;
+
+void cb(int* a)
+{
+    (void) a;
+    __atomic_fetch_add(&cleanups, 1, __ATOMIC_RELAXED);
+}
+
+int* objects[NBR_OF_OBJECTS];
+
+void*
+unref_cb(void* arg)
+{
+    intptr_t t = (intptr_t) arg;
+
+    for (int i = t; i < NBR_OF_OBJECTS; i += NBR_OF_THREADS) {
+        if (*objects[i] != i)
+            printf("ERROR: object %d has %d\n", i, *objects[i]);
+        smart_ptr_unref(objects[i]);
+    }
+    smart_ptr_slab_thread_exit();
+
+    return NULL;
+}
+
+void*
+exit_cb(void* arg)
+{
+    smart_ptr_unref(smart_ptr_slab_malloc(32));
+    *(smart_ptr_slab_cache_t**) arg = _smart_ptr_slab_cache;
+    smart_ptr_slab_thread_exit();
+
+    return NULL;
+}
+
+/* Number of slabs in a size class of the calling thread */
+int
+slab_count(size_t size)
+{
+    int n = 0;
+    smart_ptr_slab_t* slab = _smart_ptr_slab_cache->slabs[
+        ROUND_UP(REFCOUNT_HEADER_SIZE, SMART_PTR_MIN_ALIGN) / SMART_PTR_MIN_ALIGN +
+        ROUND_UP(size, SMART_PTR_MIN_ALIGN) / SMART_PTR_MIN_ALIGN - 1];
+
+    for (; slab; slab = slab->next)
+        n++;
+
+    return n;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    int errors = 0;
+    for (size_t size = 1; size <= 2048; size *= 2) {
+        unsigned char* p = smart_ptr_slab_malloc(size);
+        bool slab = *GET_REFCOUNTP(p) & REFCOUNT_FLAG_SLAB;
+        for (size_t i = 0; i < size; i++)
+            p[i] = (unsigned char) size;
+        if ((uintptr_t) p % SMART_PTR_MIN_ALIGN)
+            errors++;
+        smart_ptr_unref(p);
+        void* q = smart_ptr_slab_malloc(size);
+        printf("  %zu bytes: %s, %s\n", size, slab ? "slab" : "malloc",
+               !slab || q == p ? "reused" : "ERROR: not reused");
+        smart_ptr_unref(q);
+    }
+    printf("  %d misaligned\n", errors);
+
+    for (int i = 0; i < NBR_OF_OBJECTS; i++) {
+        objects[i] = smart_ptr_slab_malloc_with_cleanup(sizeof(int), (void (*)(void*)) cb);
+        *objects[i] = i;
+    }
+    int slabs = slab_count(sizeof(int));
+
+    pthread_t id[NBR_OF_THREADS];
+    for (intptr_t t = 0; t < NBR_OF_THREADS; t++)
+        pthread_create(&id[t], NULL, unref_cb, (void*) t);
+    for (int t = 0; t < NBR_OF_THREADS; t++)
+        pthread_join(id[t], NULL);
+    printf("  %d clean ups (expected %d)\n", cleanups, NBR_OF_OBJECTS);
+
+    for (int i = 0; i < NBR_OF_OBJECTS; i++)
+        objects[i] = smart_ptr_slab_malloc_with_cleanup(sizeof(int), (void (*)(void*)) cb);
+    printf("  remote frees reused: %s\n",
+           slab_count(sizeof(int)) == slabs ? "ok" : "ERROR");
+    for (int i = 0; i < NBR_OF_OBJECTS; i++)
+        smart_ptr_unref(objects[i]);
+
+    smart_ptr_slab_cache_t* first;
+    smart_ptr_slab_cache_t* second;
+    pthread_create(&id[0], NULL, exit_cb, &first);
+    pthread_join(id[0], NULL);
+    pthread_create(&id[0], NULL, exit_cb, &second);
+    pthread_join(id[0], NULL);
+    printf("  cache adopted: %s\n", first == second ? "ok" : "ERROR");
+}
@@ -0,0 +1,86 @@
+#if defined(WIN32) || defined(_WIN32) || defined (__WIN32__)
+# include "config_windows.h"
+#endif
+#include <stdio.h>
+#include <pthread.h>
+#include "smart_ptr_allocator.h"
+
+
+/* A cache holds weak references to the objects. Locking a weak
+ * reference gives a strong one while the object is alive. The object
+ * is destroyed as soon as the last strong reference is dropped, even
+ * if the cache still holds the weak reference. Finally threads lock
+ * and drop the object while its owner drops the last strong
+ * reference.
+ */
+
+#define NBR_OF_THREADS 4
+#define ROUNDS 1000
+
+void cb(int* a)
+{
+    printf("  Destroy: %d\n", *a);
+}
+
+int destroyed;
+
+void cb_count(int* a)
+{
+    (void) a;
+    __atomic_fetch_add(&destroyed, 1, __ATOMIC_RELAXED);
+}
+
+void*
+thread_cb(void* arg)
+{
+    smart_ptr_weak_t* w = arg;
+
+    for (int i = 0; i < 100; i++) {
+        int* a = smart_ptr_lock(w);
+        if (!a)
+            break;
+        if (*a != 42)
+            printf("ERROR: %d\n", *a);
+        smart_ptr_unref(a);
+    }
+    smart_ptr_weak_unref(w);
+
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    printf("Test case: %s", argv[0]);
+    if (argc > 1)
+        printf(" %s", argv[1]);
+    printf("\n");
+
+    int* a = smart_ptr_malloc_weakable(sizeof(int), (void (*)(void*)) cb);
+    *a = 1;
+    smart_ptr_weak_t* cache = smart_ptr_weak(a);
+
+    int* b = smart_ptr_lock(cache);
+    printf("  locked: %s\n", b == a ? "ok" : "ERROR");
+    smart_ptr_unref(b);
+
+    printf("Dropping the strong reference\n");
+    smart_ptr_unref(a);
+    printf("  lock after destroy: %s\n", smart_ptr_lock(cache) ? "ERROR" : "ok");
+    smart_ptr_weak_unref(cache);
+
+    int* c = smart_ptr_malloc(sizeof(int));
+    printf("  strong only: %s\n", smart_ptr_weak(c) ? "ERROR" : "ok");
+    smart_ptr_unref(c);
+
+    for (int round = 0; round < ROUNDS; round++) {
+        int* d = smart_ptr_malloc_weakable(sizeof(int), (void (*)(void*)) cb_count);
+        *d = 42;
+        pthread_t id[NBR_OF_THREADS];
+        for (int i = 0; i < NBR_OF_THREADS; i++)
+            pthread_create(&id[i], NULL, thread_cb, smart_ptr_weak(d));
+        smart_ptr_unref(d);
+        for (int i = 0; i < NBR_OF_THREADS; i++)
+            pthread_join(id[i], NULL);
+    }
+    printf("  %d destroyed (expected %d)\n", destroyed, ROUNDS);
+}